@@ -9,6 +9,16 @@
 #include "difficultyanalyzer.h"
 #include "rangeterrain.h"
 #include "rangedrawer.h"
+#include "simdvec.h"
+#include "workerpool.h"
+#include <vector>
+#include <chrono>
+#include <limits>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
 
 //DifficultyAnalyzer gDifficultyAnalyzer;
 
@@ -24,20 +34,299 @@ const float heightPerStep       = 1;
 const float curvePerStep        = 1;
 const float comboPerStep        = 1.0f / sqrtf(2.0f);
 
+// The chord a piece of a curved path is tested as may be this far from it
+const float curveTolerance      = 0.05f;
+const int maxCurveDepth         = 16;    // Halvings of a piece at most, whatever the tolerance
+
+// A point of a path has to be this far under the ground to be taken as blocked without testing it
+const float groundMargin        = 1e-3f;
+
+int DifficultyAnalyzer::candidateWindow = 16;
+bool DifficultyAnalyzer::minimalClearance = true;
+bool DifficultyAnalyzer::cacheSegments = true;
+SegmentCache DifficultyAnalyzer::segmentCache;
+float DifficultyAnalyzer::clearanceRadius = 0.5f;   // The half width of the path drawn
+bool DifficultyAnalyzer::curvedPaths = true;
+
 bool DifficultyAnalyzer::PathIsClear(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target) {
-    return !IntersectionBetweenPoints(tee, p1) && !IntersectionBetweenPoints(p1, p2) && !IntersectionBetweenPoints(p2, target);
+    if (curvedPaths)
+        return CurveIsClear(tee, p1, p2, target, NULL);
+    return !PathSegmentHits(tee, p1, true, false) && !PathSegmentHits(p1, p2, false, false) && !PathSegmentHits(p2, target, false, true);
+}
+
+bool DifficultyAnalyzer::PathIsClear(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target, const SegmentTest &knownClear) {
+    if (curvedPaths)
+        return CurveIsClear(tee, p1, p2, target, &knownClear);
+    auto KnownClear = [&] (const vec3 &start, const vec3 &end) {
+        const vec3 piece[4] = { start, start, end, end };
+        return knownClear(start, end, clearanceRadius, piece);
+    };
+    return (KnownClear(tee, p1) || !PathSegmentHits(tee, p1, true, false)) &&
+           (KnownClear(p1, p2) || !PathSegmentHits(p1, p2, false, false)) &&
+           (KnownClear(p2, target) || !PathSegmentHits(p2, target, false, true));
+}
+
+vec3 DifficultyAnalyzer::CurvePosition(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target, const float &t) {
+    const float s = 1 - t;
+    return (s * s * s) * tee + (3 * s * s * t) * p1 + (3 * s * t * t) * p2 + (t * t * t) * target;
+}
+
+// The pieces of cubic Bézier curve b before and after t (de Casteljau)
+static void SplitCurve(const vec3 (&b)[4], const float &t, vec3 (&before)[4], vec3 (&after)[4]) {
+    const vec3 b01 = mix(b[0], b[1], t), b12 = mix(b[1], b[2], t), b23 = mix(b[2], b[3], t);
+    const vec3 b012 = mix(b01, b12, t), b123 = mix(b12, b23, t);
+    const vec3 b0123 = mix(b012, b123, t);
+    const vec3 first = b[0], last = b[3];
+    before[0] = first;  before[1] = b01;    before[2] = b012;   before[3] = b0123;
+    after[0] = b0123;   after[1] = b123;    after[2] = b23;     after[3] = last;
+}
+
+/*
+ Where the curve through the control points leaves distance cut (along xz) of the tee, and where
+ it comes that near the target. The xz of the curve only depends on the xz of the control points,
+ so a raised path is split at the same t. The distance is taken to grow away from each end, which
+ it does unless the curve turns back.
+ */
+static void GroundCuts(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target, const float &cut, float &t0, float &t1) {
+    
+    auto Cut = [&] (const vec3 &ground, const float &from, const float &to) {
+        auto Distance = [&] (const float &t) {
+            const vec3 p = DifficultyAnalyzer::CurvePosition(tee, p1, p2, target, t);
+            return glm::length(vec2(p.x - ground.x, p.z - ground.z));
+        };
+        if (Distance(to) <= cut)
+            return to;
+        float near = from, far = to;
+        for ( int i=0; i<24; i++ ) {
+            const float mid = (near + far) * 0.5f;
+            if (Distance(mid) <= cut)
+                near = mid;
+            else
+                far = mid;
+        }
+        return far;
+    };
+    t0 = Cut(tee, 0, 1);
+    t1 = Cut(target, 1, 0);
+}
+
+bool DifficultyAnalyzer::CurveIsClear(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target, const SegmentTest* knownClear) {
+    
+    const vec3 curve[4] = { tee, p1, p2, target };
+    if (clearanceRadius <= 0)
+        return CurvePieceIsClear(curve, 0, knownClear, 0);
+    
+    // as PathSegmentHits(), the parts within two radii (along xz) of the tee and target are split
+    // off, and a raised path still passes above a lower clear one
+    float t0, t1;
+    GroundCuts(tee, p1, p2, target, 2 * clearanceRadius, t0, t1);
+    if (!(t0 < t1))
+        return CurvePieceIsClear(curve, 0, knownClear, 0);
+    
+    vec3 teePart[4], rest[4], middle[4], targetPart[4];
+    SplitCurve(curve, t0, teePart, rest);
+    SplitCurve(rest, (t1 - t0) / (1 - t0), middle, targetPart);
+    return CurvePieceIsClear(teePart, 0, knownClear, 0) &&
+           CurvePieceIsClear(middle, clearanceRadius, knownClear, 0) &&
+           CurvePieceIsClear(targetPart, 0, knownClear, 0);
+}
+
+bool DifficultyAnalyzer::CurvePieceIsClear(const vec3 (&b)[4], const float &radius, const SegmentTest* knownClear, const int &depth) {
+    
+    /*
+     The piece is within the convex hull of its control points, so within the chord moved by the
+     hull of 0 and how far b[1] and b[2] are from their nearest points on it, and within a ball
+     around the middle of the box of those. A ball that much larger moving along the moved chord
+     covers every ball along the piece, and every chord of a smaller piece of it, so while it stays
+     off the terrain the piece is clear however finely it would be split. Shots bulge up, so the
+     chord is mostly raised and the ball grows by half the bulge. Well above the terrain long pieces
+     are cleared at once, and only those near it are split down to the tolerance.
+     */
+    const vec3 chord = b[3] - b[0];
+    const float chordLength2 = dot(chord, chord);
+    vec3 lo(0), hi(0);
+    float stray = 0;
+    for ( int i=1; i<=2; i++ ) {
+        const float t = chordLength2 > 0 ? glm::clamp(dot(b[i] - b[0], chord) / chordLength2, 0.0f, 1.0f) : 0;
+        const vec3 offset = b[i] - (b[0] + t * chord);
+        lo = glm::min(lo, offset);
+        hi = glm::max(hi, offset);
+        stray = std::max(stray, glm::length(offset));
+    }
+    
+    const bool leaf = stray <= curveTolerance || depth >= maxCurveDepth;
+    const vec3 center = leaf ? vec3(0) : (lo + hi) * 0.5f;
+    const float r = leaf ? radius : radius + glm::length(hi - lo) * 0.5f;
+    const vec3 start = b[0] + center, end = b[3] + center;
+    if ((knownClear && (*knownClear)(start, end, r, b)) || !SegmentHits(start, end, r))
+        return true;
+    if (leaf)
+        return false;
+    
+    vec3 before[4], after[4];
+    SplitCurve(b, 0.5f, before, after);
+    return CurvePieceIsClear(before, radius, knownClear, depth + 1) && CurvePieceIsClear(after, radius, knownClear, depth + 1);
+}
+
+float DifficultyAnalyzer::LeastLift(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target, const vec3 &offset, const GroundBound &ground) {
+    
+    /*
+     Points sampled about a grid step apart along the path. Lifting p1 and p2 by y lifts the point
+     at t of a curve by y * 3t(1 - t), and the point at f along a straight segment by y times how
+     far it is from the tee or target, so each point needs its depth under the ground divided by
+     that. A straight path is tested as it is, so any of its points under the ground blocks it.
+     The parts of a curve near the tee and target are tested as chords that may stray from it,
+     but elsewhere the ball covers the curve if it is larger than that.
+     */
+    const vec3 a = p1 + offset, b = p2 + offset;
+    const float g = gTerrain.GridRes();
+    float lift = -std::numeric_limits<float>::infinity();
+    auto Sample = [&] (const vec3 &point, const float &weight) {
+        if (weight > 0)
+            lift = std::max(lift, (ground(point.x, point.z) - groundMargin - point.y) / weight);
+    };
+    auto Stations = [&] (const vec3 &from, const vec3 &to) {
+        return std::max((int) ceil(glm::length(vec2(to.x - from.x, to.z - from.z)) / g), 1);
+    };
+    
+    if (curvedPaths) {
+        if (clearanceRadius < curveTolerance)
+            return lift;
+        float t0, t1;
+        GroundCuts(tee, a, b, target, 2 * clearanceRadius, t0, t1);
+        const int n = Stations(tee, a) + Stations(a, b) + Stations(b, target);
+        for ( int i=0; i<=n; i++ ) {
+            const float t = t0 + (t1 - t0) * i / n;
+            Sample(CurvePosition(tee, a, b, target, t), 3 * t * (1 - t));
+        }
+        return lift;
+    }
+    
+    const vec3 points[4] = { tee, p1, p2, target };
+    for ( int k=0; k<3; k++ ) {
+        const int n = Stations(points[k] + (k > 0 ? offset : vec3(0)), points[k+1] + (k < 2 ? offset : vec3(0)));
+        for ( int i=0; i<=n; i++ ) {
+            const float f = i / (float) n;
+            const float weight = k == 0 ? f : k == 1 ? 1 : 1 - f;
+            Sample(mix(points[k], points[k+1], f) + offset * weight, weight);
+        }
+    }
+    return lift;
 }
 
+/*
+ The adjustments the search tries, easiest first: the initial path, then one more step of height,
+ curve or combo, whichever is easiest, with the right curve before the left one.
+ */
+class DifficultyAnalyzer::CandidateSequence {
+public:
+    
+    enum Strategy { INITIAL, HEIGHT, CURVE_RIGHT, CURVE_LEFT, COMBO_RIGHT, COMBO_LEFT, STRATEGIES };
+    
+    struct Candidate {
+        vec3 diff;          // Added to p1 and p2
+        float difficulty;
+        Strategy strategy;
+    };
+    
+    CandidateSequence(const float &distance, const float &initialHeightDifficulty, const int &heightSteps, const vec3 &up, const vec3 &right, const float &initialDifficulty)
+        : distance(distance), initialHeightDifficulty(initialHeightDifficulty), up(up), right(right),
+          heightSteps(heightSteps), curveSteps(0), comboSteps(0), initialTried(false), pendingLeft(false) {
+        left.difficulty = initialDifficulty;
+        left.strategy = INITIAL;
+    }
+    
+    // The next candidate, false once all are IMPOSSIBLE
+    bool Next(Candidate &candidate) {
+        
+        if (!initialTried) {
+            initialTried = true;
+            candidate = left;
+            candidate.diff = vec3(0);
+            return true;
+        }
+        
+        if (pendingLeft) {
+            pendingLeft = false;
+            candidate = left;
+            return true;
+        }
+        
+        float heightDifficulty = distance + HeightDifficulty((heightSteps + 1) * heightPerStep);
+        float curveDifficulty  = distance + CurveDifficulty((curveSteps + 1) * curvePerStep) + initialHeightDifficulty;
+        float comboDifficulty  = distance + ComboDifficulty((comboSteps + 1) * comboPerStep, (comboSteps + 1) * comboPerStep);
+        
+        if (heightDifficulty > IMPOSSIBLE && curveDifficulty > IMPOSSIBLE && comboDifficulty > IMPOSSIBLE)
+            return false;
+        
+        float minDifficulty = std::min(heightDifficulty, std::min(curveDifficulty, comboDifficulty));
+        
+        if (minDifficulty == heightDifficulty) {
+            heightSteps += 1;
+            candidate.diff = up * (heightSteps * heightPerStep);
+            candidate.difficulty = heightDifficulty;
+            candidate.strategy = HEIGHT;
+        } else if (minDifficulty == curveDifficulty) {
+            curveSteps += 1;
+            // curve to the right (path curves left), then to the left (path curves right)
+            candidate.diff = right * (curveSteps * curvePerStep);
+            candidate.difficulty = curveDifficulty;
+            candidate.strategy = CURVE_RIGHT;
+            left.diff = -right * (curveSteps * curvePerStep);
+            left.difficulty = curveDifficulty;
+            left.strategy = CURVE_LEFT;
+            pendingLeft = true;
+        } else {
+            comboSteps += 1;
+            candidate.diff = up * (comboSteps * heightPerStep) + right * (comboSteps * curvePerStep);
+            candidate.difficulty = comboDifficulty;
+            candidate.strategy = COMBO_RIGHT;
+            left.diff = up * (comboSteps * heightPerStep) - right * (comboSteps * curvePerStep);
+            left.difficulty = comboDifficulty;
+            left.strategy = COMBO_LEFT;
+            pendingLeft = true;
+        }
+        return true;
+    }
+    
+private:
+    
+    const float distance;
+    const float initialHeightDifficulty;
+    const vec3 up, right;
+    int heightSteps, curveSteps, comboSteps;
+    bool initialTried;
+    bool pendingLeft;
+    Candidate left;     // Left variant of the last curve or combo step, or the initial difficulty
+};
+
 float DifficultyAnalyzer::CalculateDifficulty(const vec3 &tee, const vec3 &target, vec3 &p1_adjusted, vec3 &p2_adjusted, float &distance) {
+    return CalculateDifficulty(tee, target, p1_adjusted, p2_adjusted, distance, candidateWindow);
+}
+
+float DifficultyAnalyzer::CalculateDifficulty(const vec3 &tee, const vec3 &target, vec3 &p1_adjusted, vec3 &p2_adjusted, float &distance, const int &window) {
+    return SearchDifficulty(tee, target, p1_adjusted, p2_adjusted, distance, window, NULL, NULL);
+}
+
+float DifficultyAnalyzer::CalculateDifficulty(const vec3 &tee, const vec3 &target, vec3 &p1_adjusted, vec3 &p2_adjusted, float &distance, const SegmentTest &knownClear) {
+    return SearchDifficulty(tee, target, p1_adjusted, p2_adjusted, distance, 1, &knownClear, NULL);
+}
+
+float DifficultyAnalyzer::CalculateDifficulty(const vec3 &tee, const vec3 &target, vec3 &p1_adjusted, vec3 &p2_adjusted, float &distance, const SegmentTest &knownClear, const GroundBound &ground) {
+    return SearchDifficulty(tee, target, p1_adjusted, p2_adjusted, distance, 1, &knownClear, &ground);
+}
+
+float DifficultyAnalyzer::SearchDifficulty(const vec3 &tee, const vec3 &target, vec3 &p1_adjusted, vec3 &p2_adjusted, float &distance, const int &window, const SegmentTest* knownClear, const GroundBound* ground) {
     /*
      See attached description of golf shot modelling.
      */
     
     distance = glm::length(target - tee);
     
-    // Lift tee and target just slightly to avoid immediate collisions with ground
-    vec3 adjustedTee = tee + vec3(0,0.1,0);
-    vec3 adjustedTarget = target + vec3(0,0.1,0);;
+    // Lift tee and target just slightly to avoid immediate collisions with ground, or to the center of the ball
+    const float lift = std::max(0.1f, clearanceRadius);
+    vec3 adjustedTee = tee + vec3(0,lift,0);
+    vec3 adjustedTarget = target + vec3(0,lift,0);
     
     vec3 tee_to_target_xz = adjustedTarget - adjustedTee;
     tee_to_target_xz.y = 0;
@@ -47,8 +336,6 @@ float DifficultyAnalyzer::CalculateDifficulty(const vec3 &tee, const vec3 &targe
 
     // Steps when finding difficulty
     int heightSteps = 0;
-    int curveSteps = 0;
-    int comboSteps = 0; // combination of height and curve
     
     // We need to adjust height if target is to high for our initial approach
     float initialHeightDifficulty = 0; // Stems from having to hit high enough to reach the green
@@ -72,131 +359,680 @@ float DifficultyAnalyzer::CalculateDifficulty(const vec3 &tee, const vec3 &targe
     p1_adjusted = p1;
     p2_adjusted = p2;
     
-    // Is path clear to begin with?
-    if (PathIsClear(adjustedTee, p1, p2, adjustedTarget))
-        return distance + HeightDifficulty(heightSteps * heightPerStep) + initialHeightDifficulty;
+    CandidateSequence sequence(distance, initialHeightDifficulty, heightSteps, up, right,
+                               distance + HeightDifficulty(heightSteps * heightPerStep) + initialHeightDifficulty);
+    CandidateSequence::Candidate candidate;
     
-    while (true) {
+    if (minimalClearance) {
+        /*
+         Raising a path lifts every point of it above the same ground, so if a height step is clear
+         so are the ones above it, and the first clear one is bisected for. Curving moves the path
+         over other ground, and a wider curve may hit what a narrower one missed, so the curve and
+         combo steps are still tried in turn, but only those easier than the best path found so far.
+         
+         Before a step is tested against the terrain, its least lift (see LeastLift()) is found
+         from the ground under its corridor, once per side and width as the combo and curve steps
+         of a width go over the same ground. Steps lifted less pass under the terrain and are
+         rejected without a test. With S points sampled along a path, H height steps and C curve
+         widths tried, that is O(S) ground heights per width, O(S * C) in all, and only the steps
+         not rejected are tested: O(log H) height steps and the curve and combo steps left.
+         
+         The candidates are listed in the order the step search tries them, and the clear one listed
+         first is the one it stops at, so the difficulty is the same.
+         */
+        vector<CandidateSequence::Candidate> candidates;
+        vector<int> steps[CandidateSequence::STRATEGIES];   // Indices into candidates, of each strategy
+        vector<int> width;                                  // Of each candidate, in curve steps
+        while (sequence.Next(candidate)) {
+            steps[candidate.strategy].push_back((int) candidates.size());
+            width.push_back((int) steps[candidate.strategy].size());
+            candidates.push_back(candidate);
+        }
         
-        // Take next step depending on which is easiest.
-        float heightDifficulty = distance + HeightDifficulty((heightSteps + 1) * heightPerStep);
-        float curveDifficulty  = distance + CurveDifficulty((curveSteps + 1) * curvePerStep) + initialHeightDifficulty;
-        float comboDifficulty  = distance + ComboDifficulty((comboSteps + 1) * comboPerStep, (comboSteps + 1) * comboPerStep);
+        const GroundBound surface = [] (const float &x, const float &z) { return gTerrain.SurfaceHeight(x, z); };
+        const GroundBound &under = ground ? *ground : surface;
+        const float straightLift = LeastLift(adjustedTee, p1, p2, adjustedTarget, vec3(0), under);
+        vector<float> curveLift[2];     // Of each side, by width, NAN until found
         
-        // If difficulty exceeded IMPOSSIBLE, indicate this bu returning -1
-        if (heightDifficulty > IMPOSSIBLE && curveDifficulty > IMPOSSIBLE && comboDifficulty > IMPOSSIBLE)
-            return -1;
+        auto Blocked = [&] (const int &i) {
+            const CandidateSequence::Candidate &c = candidates[i];
+            if (c.strategy == CandidateSequence::INITIAL || c.strategy == CandidateSequence::HEIGHT)
+                return c.diff.y < straightLift;
+            
+            const int side = c.strategy == CandidateSequence::CURVE_RIGHT || c.strategy == CandidateSequence::COMBO_RIGHT ? 0 : 1;
+            vector<float> &lift = curveLift[side];
+            if ((int) lift.size() <= width[i])
+                lift.resize(width[i] + 1, NAN);
+            if (std::isnan(lift[width[i]])) {
+                const vec3 offset = (side == 0 ? right : -right) * (width[i] * curvePerStep);
+                lift[width[i]] = LeastLift(adjustedTee, p1, p2, adjustedTarget, offset, under);
+            }
+            return c.diff.y < lift[width[i]];
+        };
         
-        // Which approach offers the easiest shot?
-        float minDifficulty = std::min(heightDifficulty, std::min(curveDifficulty, comboDifficulty));
+        auto Clear = [&] (const int &i) {
+            if (Blocked(i))
+                return false;
+            const vec3 a = p1 + candidates[i].diff, b = p2 + candidates[i].diff;
+            return knownClear ? PathIsClear(adjustedTee, a, b, adjustedTarget, *knownClear)
+                              : PathIsClear(adjustedTee, a, b, adjustedTarget);
+        };
         
-        vec3 diff;
-        if (minDifficulty == heightDifficulty) {
-            
-            heightSteps += 1;
-            
-            diff = up * (heightSteps * heightPerStep);
-            p1_adjusted = p1 + diff;
-            p2_adjusted = p2 + diff;
-            if (PathIsClear(adjustedTee, p1_adjusted, p2_adjusted, adjustedTarget))
-                return heightDifficulty;
-            
-        } else if (minDifficulty == curveDifficulty) {
-            
-            curveSteps += 1;
-            
-            // Try curve to the right (path curves left)
-            diff = right * (curveSteps * curvePerStep);
-            p1_adjusted = p1 + diff;
-            p2_adjusted = p2 + diff;
-            if (PathIsClear(adjustedTee, p1_adjusted, p2_adjusted, adjustedTarget))
-                return curveDifficulty;
-            
-            // Try curve to the left (path curves right)
-            diff = -right * (curveSteps * curvePerStep);
-            p1_adjusted = p1 + diff;
-            p2_adjusted = p2 + diff;
-            if (PathIsClear(adjustedTee, p1_adjusted, p2_adjusted, adjustedTarget))
-                return curveDifficulty;
-            
-            
-            
-        } else if (minDifficulty == comboDifficulty) {
-            
-            comboSteps += 1;
-            
-            // Try curve to the right (path curves left)
-            diff = up * (comboSteps * heightPerStep) + right * (comboSteps * curvePerStep);
-            p1_adjusted = p1 + diff;
-            p2_adjusted = p2 + diff;
-            if (PathIsClear(adjustedTee, p1_adjusted, p2_adjusted, adjustedTarget))
-                return comboDifficulty;
+        int best = Clear(0) ? 0 : (int) candidates.size();
+        
+        const vector<int> &heights = steps[CandidateSequence::HEIGHT];
+        int hi = (int) (std::lower_bound(heights.begin(), heights.end(), best) - heights.begin()) - 1;
+        if (hi >= 0 && Clear(heights[hi])) {
+            int lo = 0;
+            while (lo < hi) {
+                const int mid = (lo + hi) / 2;
+                if (Clear(heights[mid]))
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            best = heights[hi];
+        }
+        
+        /*
+         The curve and combo steps easier than the best path and not rejected are tested in order,
+         window at a time on gWorkerPool as the step search, and the first clear one is the best.
+         */
+        int next = 1;
+        for ( int size=1; ; size=std::min(2 * size, std::max(1, window)) ) {
+            vector<int> batch;
+            for ( ; next < best && (int) batch.size() < size; next++ )
+                if (candidates[next].strategy != CandidateSequence::HEIGHT && !Blocked(next))
+                    batch.push_back(next);
+            if (batch.empty())
+                break;
             
-            // Try curve to the left (path curves right)
-            diff = up * (comboSteps * heightPerStep) - right * (comboSteps * curvePerStep);
-            p1_adjusted = p1 + diff;
-            p2_adjusted = p2 + diff;
-            if (PathIsClear(adjustedTee, p1_adjusted, p2_adjusted, adjustedTarget))
-                return comboDifficulty;
+            std::atomic<int> firstClear((int) batch.size());
+            gWorkerPool.ParallelFor((int) batch.size(), [&] (int j) {
+                if (j > firstClear)
+                    return;
+                const vec3 a = p1 + candidates[batch[j]].diff, b = p2 + candidates[batch[j]].diff;
+                if (knownClear ? PathIsClear(adjustedTee, a, b, adjustedTarget, *knownClear)
+                               : PathIsClear(adjustedTee, a, b, adjustedTarget)) {
+                    int first = firstClear;
+                    while (j < first && !firstClear.compare_exchange_weak(first, j)) {}
+                }
+            });
+            if (firstClear < (int) batch.size()) {
+                best = batch[firstClear];
+                break;
+            }
         }
+        
+        // as the step search, the clear path or the last one tried
+        const int last = std::min(best, (int) candidates.size() - 1);
+        p1_adjusted = p1 + candidates[last].diff;
+        p2_adjusted = p2 + candidates[last].diff;
+        return best < (int) candidates.size() ? candidates[best].difficulty : -1;
+    }
+    
+    if (window <= 1) {
+        // one path at a time, stopping at the first clear one
+        while (sequence.Next(candidate)) {
+            p1_adjusted = p1 + candidate.diff;
+            p2_adjusted = p2 + candidate.diff;
+            if (knownClear ? PathIsClear(adjustedTee, p1_adjusted, p2_adjusted, adjustedTarget, *knownClear)
+                           : PathIsClear(adjustedTee, p1_adjusted, p2_adjusted, adjustedTarget))
+                return candidate.difficulty;
+        }
+        // If difficulty exceeded IMPOSSIBLE, indicate this bu returning -1
+        return -1;
     }
+    
+    /*
+     The next few candidates at a time, on all cores, doubling up to window so shots that are clear
+     early don't pay for the ones after. The first clear one in the order above is the one the serial
+     search stops at, so candidates after a clear one are skipped rather than tested, and the result
+     is the same.
+     */
+    vector<CandidateSequence::Candidate> candidates;
+    candidates.reserve(window);
+    bool exhausted = false;
+    for ( int size=1; !exhausted; size=std::min(2 * size, window) ) {
+        
+        candidates.clear();
+        while ((int) candidates.size() < size && !(exhausted = !sequence.Next(candidate)))
+            candidates.push_back(candidate);
+        if (candidates.empty())
+            break;
+        
+        std::atomic<int> firstClear((int) candidates.size());
+        gWorkerPool.ParallelFor((int) candidates.size(), [&] (int i) {
+            if (i > firstClear)
+                return;
+            if (PathIsClear(adjustedTee, p1 + candidates[i].diff, p2 + candidates[i].diff, adjustedTarget)) {
+                int first = firstClear;
+                while (i < first && !firstClear.compare_exchange_weak(first, i)) {}
+            }
+        });
+        
+        // the serial search leaves the last path it tried in p1_adjusted and p2_adjusted
+        const int last = std::min((int) firstClear, (int) candidates.size() - 1);
+        p1_adjusted = p1 + candidates[last].diff;
+        p2_adjusted = p2 + candidates[last].diff;
+        if (firstClear < (int) candidates.size())
+            return candidates[firstClear].difficulty;
+    }
+    return -1;
 }
 
-bool DifficultyAnalyzer::IntersectionBetweenPoints(const vec3 &start, const vec3 &end) {
+vector<ShotDifficulty> DifficultyAnalyzer::CalculateDifficultyBatch(const vector<pair<vec3, vec3>> &shots) {
+    
+    /*
+     The terrain and its max height pyramid are only read while finding paths, so every worker
+     shares them. Shots take from a few to hundreds of path tests, so they are handed out one at a
+     time as workers become free rather than split up front. Each shot searches its candidates
+     serially, the cores being busy with other shots.
+     */
+    vector<ShotDifficulty> results(shots.size());
+    gWorkerPool.ParallelFor((int) shots.size(), [&] (int i) {
+        ShotDifficulty &r = results[i];
+        r.difficulty = CalculateDifficulty(shots[i].first, shots[i].second, r.p1_adjusted, r.p2_adjusted, r.distance, 1);
+    });
+    return results;
+}
+
+// Möller–Trumbore: start + t * dir hits triangle (v0, v1, v2) at t, solving the same system
+// as the brute force intersection without inverting it
+static bool IntersectTriangle(const vec3 &start, const vec3 &dir, const vec3 &v0, const vec3 &v1, const vec3 &v2, float &t) {
+    
+    const vec3 e1 = v1 - v0;
+    const vec3 e2 = v2 - v0;
+    const vec3 p = cross(dir, e2);
+    const float det = dot(e1, p);
+    if (det == 0)
+        return false;
+    
+    const float invDet = 1 / det;
+    const vec3 b = start - v0;
+    const float u = dot(b, p) * invDet;
+    if (u < 0 || u > 1)
+        return false;
+    
+    const vec3 q = cross(b, e1);
+    const float v = dot(dir, q) * invDet;
+    if (v < 0 || u + v > 1)
+        return false;
+    
+    t = dot(e2, q) * invDet;
+    return true;
+}
+
+// The smallest t in (tMin, tMax) where start + t * dir hits one of the two triangles of quad (x, y)
+static bool IntersectQuad(const vec3 &start, const vec3 &dir, const int &x, const int &y, const float &tMin, const float &tMax, float &t) {
+    
+    const vec3 v1 = gTerrain.SamplePosition(x  , y  );
+    const vec3 v2 = gTerrain.SamplePosition(x  , y+1);
+    const vec3 v3 = gTerrain.SamplePosition(x+1, y  );
+    const vec3 v4 = gTerrain.SamplePosition(x+1, y+1);
+    
+    // same triangles as the index data, see TerrainTile
+    float ta, tb;
+    bool a, b;
+    if (gTerrain.DiagonalUp(x, y)) {
+        a = IntersectTriangle(start, dir, v1, v2, v3, ta);
+        b = IntersectTriangle(start, dir, v4, v3, v2, tb);
+    } else {
+        a = IntersectTriangle(start, dir, v1, v4, v2, ta);
+        b = IntersectTriangle(start, dir, v4, v3, v1, tb);
+    }
+    a = a && ta > tMin && ta < tMax;
+    b = b && tb > tMin && tb < tMax;
+    
+    if (a || b)
+        t = a && b ? std::min(ta, tb) : (a ? ta : tb);
+    return a || b;
+}
+
+// Narrows [t0, t1] to where s + t * d is within [lo, hi], false if nothing is left
+static bool ClipToSlab(const float &s, const float &d, const float &lo, const float &hi, float &t0, float &t1) {
     
-    const vec3 dir = end - start;
+    if (d == 0)
+        return s >= lo && s <= hi;
     
-    // iterate through all terrain vertices and check for intersection
-    for (int i = 0; i < (X_INTERVAL-1) * (Y_INTERVAL-1) * FLOATS_PER_TRIANGLE * 2 - 36 ; i += 36) {
+    float ta = (lo - s) / d, tb = (hi - s) / d;
+    if (ta > tb)
+        std::swap(ta, tb);
+    t0 = std::max(t0, ta);
+    t1 = std::min(t1, tb);
+    return t0 <= t1;
+}
+
+/*
+ Calls visit(x, y) for the quads whose xz footprint start + t * dir crosses for 0 <= t <= tEnd,
+ in order of t, until it returns true (Amanatides & Woo, "A Fast Voxel Traversal Algorithm for
+ Ray Tracing"). A quad's triangles lie within its footprint, so the first quad with a hit has
+ the closest one. Returns whether visit() returned true.
+ */
+template<typename Visit>
+static bool TraverseQuads(const vec3 &start, const vec3 &dir, const float &tEnd, const Visit &visit) {
+    
+    // in sample coordinates, x along world x and y along world -z
+    const float res = gTerrain.GridRes();
+    const float sx = start.x / res, sy = -start.z / res;
+    const float dx = dir.x / res, dy = -dir.z / res;
+    const int lastX = gTerrain.XInterval() - 2, lastY = gTerrain.YInterval() - 2;
+    
+    float t0 = 0, t1 = tEnd;
+    if (!ClipToSlab(sx, dx, 0, lastX + 1, t0, t1) || !ClipToSlab(sy, dy, 0, lastY + 1, t0, t1))
+        return false;
+    
+    int x = glm::clamp((int) floor(sx + t0 * dx), 0, lastX);
+    int y = glm::clamp((int) floor(sy + t0 * dy), 0, lastY);
+    const int stepX = dx > 0 ? 1 : -1;
+    const int stepY = dy > 0 ? 1 : -1;
+    const float inf = std::numeric_limits<float>::infinity();
+    
+    while (true) {
         
-        vec3 v0 = vec3(gTerrain.vertexData[i], gTerrain.vertexData[i+1], gTerrain.vertexData[i+2]);
-        vec3 v1 = vec3(gTerrain.vertexData[i+12],gTerrain.vertexData[i+13],gTerrain.vertexData[i+14]);
-        vec3 v2 = vec3(gTerrain.vertexData[i+24],gTerrain.vertexData[i+25],gTerrain.vertexData[i+26]);
+        if (visit(x, y))
+            return true;
         
-        vec3 e1 = v1 - v0;
-        vec3 e2 = v2 - v0;
-        vec3 b = start - v0;
-        mat3 A( -dir, e1, e2 );
-        vec3 x = glm::inverse( A ) * b; // x = (t, u, v)
+        // t where the footprint leaves the quad through its x and y sides (from the side, not
+        // accumulated, so long segments don't drift)
+        const float tx = dx == 0 ? inf : (x + (stepX > 0) - sx) / dx;
+        const float ty = dy == 0 ? inf : (y + (stepY > 0) - sy) / dy;
+        if (std::min(tx, ty) >= t1)
+            return false;
         
-        if (x.x > 0 && x.x < 1 && x.y >= 0 && x.z >= 0 && x.y + x.z <= 1) {
-//            cout << "intersection t: " << x.x << endl;
-            return true;
-        }
+        if (tx < ty)
+            x += stepX;
+        else
+            y += stepY;
+        if (x < 0 || x > lastX || y < 0 || y > lastY)
+            return false;
+    }
+}
+
+// Whether start + t * dir hits the terrain for 0 < t < 1, walking the quads under it
+static bool TraverseSegment(const vec3 &start, const vec3 &dir) {
+    
+    float t;
+    return TraverseQuads(start, dir, 1, [&] (const int &x, const int &y) {
+        return IntersectQuad(start, dir, x, y, 0, 1, t);
+    });
+}
+
+// Whether start + t * dir hits the terrain for 0 < t < 1 within block (x, y) of level l of the
+// max height pyramid, skipping the blocks it passes above
+static bool IntersectBlock(const vec3 &start, const vec3 &dir, const int &l, const int &x, const int &y) {
+    
+    const HeightPyramid &pyramid = gTerrain.MaxHeights();
+    const float res = gTerrain.GridRes();
+    
+    // where the segment is over the block, in sample coordinates (x along world x, y along world -z)
+    float t0 = 0, t1 = 1;
+    if (!ClipToSlab(start.x / res, dir.x / res, x << l, std::min((x + 1) << l, pyramid.Width(0)), t0, t1) ||
+        !ClipToSlab(-start.z / res, -dir.z / res, y << l, std::min((y + 1) << l, pyramid.Height(0)), t0, t1))
+        return false;
+    
+    // the segment is straight, so its lowest point there is at either end
+    if (std::min(start.y + t0 * dir.y, start.y + t1 * dir.y) > pyramid.Max(l, x, y))
+        return false;
+    
+    if (l == 0) {
+        float t;
+        return IntersectQuad(start, dir, x, y, 0, 1, t);
+    }
+    
+    for ( int cy=2*y; cy<std::min(2*y + 2, pyramid.Height(l-1)); cy++ )
+        for ( int cx=2*x; cx<std::min(2*x + 2, pyramid.Width(l-1)); cx++ )
+            if (IntersectBlock(start, dir, l-1, cx, cy))
+                return true;
+    
+    return false;
+}
+
+bool DifficultyAnalyzer::IntersectionBetweenPoints(const vec3 &start, const vec3 &end) {
+    
+    // high shots are cleared after a few blocks
+    const int top = gTerrain.MaxHeights().Levels() - 1;
+    return IntersectBlock(start, end - start, top, 0, 0);
+}
+
+// Whether start + t * dir for 0 < t < 1 may come within radius of a quad within block (x, y) of
+// level l of the max height pyramid, descending the pyramid widened and raised by the radius
+static bool IntersectCapsuleBlock(const vec3 &start, const vec3 &dir, const float &radius, const int &l, const int &x, const int &y) {
+    
+    const HeightPyramid &pyramid = gTerrain.MaxHeights();
+    const float res = gTerrain.GridRes();
+    const float pad = radius / res;
+    
+    float t0 = 0, t1 = 1;
+    if (!ClipToSlab(start.x / res, dir.x / res, (x << l) - pad, std::min((x + 1) << l, pyramid.Width(0)) + pad, t0, t1) ||
+        !ClipToSlab(-start.z / res, -dir.z / res, (y << l) - pad, std::min((y + 1) << l, pyramid.Height(0)) + pad, t0, t1))
+        return false;
+    
+    if (std::min(start.y + t0 * dir.y, start.y + t1 * dir.y) > pyramid.Max(l, x, y) + radius)
+        return false;
+    
+    if (l == 0) {
+        // a point within radius of a triangle is within radius above its plane (or below it), and
+        // the distance to the plane is linear along the segment
+        const vec3 v1 = gTerrain.SamplePosition(x  , y  );
+        const vec3 v2 = gTerrain.SamplePosition(x  , y+1);
+        const vec3 v3 = gTerrain.SamplePosition(x+1, y  );
+        const vec3 v4 = gTerrain.SamplePosition(x+1, y+1);
+        auto Near = [&] (const vec3 &a, const vec3 &b, const vec3 &c) {
+            vec3 n = normalize(cross(b - a, c - a));
+            if (n.y < 0)
+                n = -n;
+            return std::min(dot(start + t0 * dir - a, n), dot(start + t1 * dir - a, n)) <= radius;
+        };
+        return gTerrain.DiagonalUp(x, y) ? Near(v1, v2, v3) || Near(v4, v3, v2) : Near(v1, v4, v2) || Near(v4, v3, v1);
     }
     
+    for ( int cy=2*y; cy<std::min(2*y + 2, pyramid.Height(l-1)); cy++ )
+        for ( int cx=2*x; cx<std::min(2*x + 2, pyramid.Width(l-1)); cx++ )
+            if (IntersectCapsuleBlock(start, dir, radius, l-1, cx, cy))
+                return true;
+    
     return false;
 }
 
+bool DifficultyAnalyzer::CapsuleBetweenPoints(const vec3 &start, const vec3 &end, const float &radius) {
+    
+    const int top = gTerrain.MaxHeights().Levels() - 1;
+    return IntersectCapsuleBlock(start, end - start, radius, top, 0, 0);
+}
+
+bool DifficultyAnalyzer::SegmentHits(const vec3 &start, const vec3 &end, const float &radius) {
+    
+    auto Test = [&] () {
+        return radius > 0 ? CapsuleBetweenPoints(start, end, radius) : IntersectionBetweenPoints(start, end);
+    };
+    
+    bool intersects;
+    if (!cacheSegments)
+        return Test();
+    if (segmentCache.Find(start, end, radius, intersects))
+        return intersects;
+    
+    const unsigned int version = gTerrain.Version();
+    intersects = Test();
+    segmentCache.Insert(start, end, radius, intersects, version);
+    return intersects;
+}
+
+bool DifficultyAnalyzer::PathSegmentHits(const vec3 &start, const vec3 &end, const bool &startOnGround, const bool &endOnGround) {
+    
+    if (clearanceRadius <= 0)
+        return SegmentHits(start, end, 0);
+    
+    /*
+     The ball rests on the ground at the tee and target, so near them it would touch the slope it
+     is hit from or lands on. The parts within two radii of them are split off by xz distance, which
+     raising the path doesn't change, so a raised path still passes above a lower clear one.
+     */
+    const float length = glm::length(vec2(end.x - start.x, end.z - start.z));
+    const float cut = 2 * clearanceRadius;
+    const float t0 = startOnGround ? cut / length : 0;
+    const float t1 = endOnGround ? 1 - cut / length : 1;
+    if (!(t0 < t1))
+        return SegmentHits(start, end, 0);
+    
+    const vec3 a = t0 > 0 ? start + (end - start) * t0 : start;
+    const vec3 b = t1 < 1 ? start + (end - start) * t1 : end;
+    return (t0 > 0 && SegmentHits(start, a, 0)) || SegmentHits(a, b, clearanceRadius) || (t1 < 1 && SegmentHits(b, end, 0));
+}
+
 bool DifficultyAnalyzer::ClosestIntersection(vec3 start, vec3 dir, Intersection& closestIntersection) {
     
-    float closest_t = std::numeric_limits<float>::max();
-    float closest_index = -1;
+    float t;
+    const float inf = std::numeric_limits<float>::infinity();
+    if (!TraverseQuads(start, dir, inf, [&] (const int &x, const int &y) {
+        return IntersectQuad(start, dir, x, y, 0, inf, t);
+    }))
+        return false;
     
-    // iterate through all terrain vertices and check for intersection
-    for (int i = 0; i < (X_INTERVAL-1) * (Y_INTERVAL-1) * FLOATS_PER_TRIANGLE * 2 - 36 ; i += 36) {
-        
-        vec3 v0 = vec3(gTerrain.vertexData[i], gTerrain.vertexData[i+1], gTerrain.vertexData[i+2]);
-        vec3 v1 = vec3(gTerrain.vertexData[i+12],gTerrain.vertexData[i+13],gTerrain.vertexData[i+14]);
-        vec3 v2 = vec3(gTerrain.vertexData[i+24],gTerrain.vertexData[i+25],gTerrain.vertexData[i+26]);
+    closestIntersection.position = start + t * dir;
+    closestIntersection.distance = t;
+    return true;
+}
 
-        vec3 e1 = v1 - v0;
-        vec3 e2 = v2 - v0;
-        vec3 b = start - v0;
-        mat3 A( -dir, e1, e2 );
-        vec3 x = glm::inverse( A ) * b; // x = (t, u, v)
-        
-        if (x.x < closest_t && x.x > 0 && x.y >= 0 && x.z >= 0 && x.y + x.z <= 1) {
-            closest_t = x.x;
-            closest_index = i;
-        }
+bool DifficultyAnalyzer::IntersectionBetweenPointsBruteForce(const vec3 &start, const vec3 &end) {
+    
+    // every terrain triangle, a vector of them at a time
+    float t;
+    return gTerrain.Triangles().Intersect(start, end - start, 0, 1, t, true);
+}
+
+bool DifficultyAnalyzer::ClosestIntersectionBruteForce(vec3 start, vec3 dir, Intersection& closestIntersection) {
+    
+    float t;
+    if (!gTerrain.Triangles().Intersect(start, dir, 0, std::numeric_limits<float>::infinity(), t))
+        return false;
+    
+    closestIntersection.position = start + t * dir;
+    closestIntersection.distance = t;
+    return true;
+}
+
+void DifficultyAnalyzer::TestTraversal() {
+    
+    // segments and rays between random points around the terrain, from below it to well above
+    const int count = 2000;
+    const float width = gTerrain.Width(), depth = gTerrain.Depth();
+    auto RandomPoint = [&] () {
+        return vec3(width * (rand() / float(RAND_MAX) * 1.2f - 0.1f),
+                    rand() / float(RAND_MAX) * 40 - 10,
+                    -depth * (rand() / float(RAND_MAX) * 1.2f - 0.1f));
+    };
+    vector<vec3> starts(count), ends(count);
+    for ( int i=0; i<count; i++ ) {
+        starts[i] = RandomPoint();
+        ends[i] = RandomPoint();
     }
     
-    if (closest_index >= 0) {
-        closestIntersection.position = start + closest_t * dir;
-        closestIntersection.distance = closest_t;
-        return true;
+    // results and milliseconds per query of each method
+    auto Run = [&] (vector<float> &results, const function<float (const vec3&, const vec3&)> &query) {
+        results.resize(count);
+        auto start = std::chrono::high_resolution_clock::now();
+        for ( int i=0; i<count; i++ )
+            results[i] = query(starts[i], ends[i]);
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / count;
+    };
+    auto Closest = [] (bool (*closest)(vec3, vec3, Intersection&)) {
+        return [closest] (const vec3 &start, const vec3 &end) {
+            Intersection hit;
+            return closest(start, end - start, hit) ? hit.distance : -1.0f;
+        };
+    };
+    
+    // the triangles are built on first use
+    auto buildStart = std::chrono::high_resolution_clock::now();
+    gTerrain.Triangles();
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+    
+    vector<float> pyramid, capsule, traversal, bruteForce, rayTraversal, rayBruteForce;
+    double pyramidMs    = Run(pyramid, [] (const vec3 &start, const vec3 &end) { return (float) IntersectionBetweenPoints(start, end); });
+    double capsuleMs    = Run(capsule, [] (const vec3 &start, const vec3 &end) { return (float) CapsuleBetweenPoints(start, end, clearanceRadius); });
+    double traversalMs  = Run(traversal, [] (const vec3 &start, const vec3 &end) { return (float) TraverseSegment(start, end - start); });
+    double bruteForceMs = Run(bruteForce, [] (const vec3 &start, const vec3 &end) { return (float) IntersectionBetweenPointsBruteForce(start, end); });
+    double rayTraversalMs  = Run(rayTraversal, Closest(ClosestIntersection));
+    double rayBruteForceMs = Run(rayBruteForce, Closest(ClosestIntersectionBruteForce));
+    
+    vector<vec3> dirs(count);
+    vector<float> rayBatch(count);
+    for ( int i=0; i<count; i++ )
+        dirs[i] = ends[i] - starts[i];
+    auto batchStart = std::chrono::high_resolution_clock::now();
+    gTerrain.Triangles().IntersectBatch(&starts[0], &dirs[0], count, 0, std::numeric_limits<float>::infinity(), &rayBatch[0]);
+    double rayBatchMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - batchStart).count() / count;
+    
+    int pyramidMismatches = 0, traversalMismatches = 0, rayMismatches = 0, batchMismatches = 0, hits = 0, capsuleHits = 0;
+    for ( int i=0; i<count; i++ ) {
+        hits += bruteForce[i] != 0;
+        capsuleHits += capsule[i] != 0;
+        pyramidMismatches += pyramid[i] != bruteForce[i];
+        traversalMismatches += traversal[i] != bruteForce[i];
+        rayMismatches += abs(rayTraversal[i] - rayBruteForce[i]) > 1e-4f;
+        batchMismatches += rayBatch[i] != rayBruteForce[i];
     }
     
-    return false;
-}
\ No newline at end of file
+    cout << "Terrain intersection vs brute force, " << count << " segments (" << hits << " hit) and rays" << endl;
+    cout << "  segments, max height pyramid: " << pyramidMs << " ms, " << pyramidMismatches << " mismatches" << endl;
+    cout << "  segments, ball of radius " << clearanceRadius << ": " << capsuleMs << " ms, " << capsuleHits << " hit" << endl;
+    cout << "  segments, quad traversal: " << traversalMs << " ms, " << traversalMismatches << " mismatches" << endl;
+    cout << "  segments, brute force: " << bruteForceMs << " ms (" << SimdISA() << ", triangles built in " << buildMs << " ms)" << endl;
+    cout << "  rays, quad traversal: " << rayTraversalMs << " ms, " << rayMismatches << " mismatches" << endl;
+    cout << "  rays, brute force: " << rayBruteForceMs << " ms, batched " << rayBatchMs << " ms, " << batchMismatches << " mismatches" << endl;
+}
+
+/*
+ Shots between random samples of the terrain, for the tests below. A tee and target that coincide
+ give no direction to shoot in, so they are drawn again.
+ */
+static vector<pair<vec3, vec3>> RandomShots(const int &count) {
+    const int maxX = gTerrain.XInterval() - 1, maxY = gTerrain.YInterval() - 1;
+    auto RandomPoint = [&] () {
+        return gTerrain.SamplePosition(rand() % (maxX + 1), rand() % (maxY + 1));
+    };
+    vector<pair<vec3, vec3>> shots(count);
+    for ( int i=0; i<count; i++ ) {
+        do {
+            shots[i] = make_pair(RandomPoint(), RandomPoint());
+        } while (shots[i].first.x == shots[i].second.x && shots[i].first.z == shots[i].second.z);
+    }
+    return shots;
+}
+
+/*
+ Shots rated one at a time, with the settings setup() changes. Before it, the segment cache is off
+ and candidates are tested one at a time, and every setting is restored after.
+ */
+struct ShotTiming {
+    vector<ShotDifficulty> results;
+    double ms;          // Per shot
+    double segments;    // Tested per shot, counted in a second run without the cache
+    int impossible;
+};
+
+static ShotTiming TimeShots(const vector<pair<vec3, vec3>> &shots, const function<void ()> &setup) {
+    
+    const bool solver = DifficultyAnalyzer::minimalClearance, cached = DifficultyAnalyzer::cacheSegments, curved = DifficultyAnalyzer::curvedPaths;
+    const int window = DifficultyAnalyzer::candidateWindow;
+    DifficultyAnalyzer::cacheSegments = false;
+    DifficultyAnalyzer::candidateWindow = 1;
+    setup();
+    
+    const int count = (int) shots.size();
+    ShotTiming timing;
+    timing.results.resize(count);
+    timing.impossible = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for ( int i=0; i<count; i++ ) {
+        ShotDifficulty &r = timing.results[i];
+        r.difficulty = DifficultyAnalyzer::CalculateDifficulty(shots[i].first, shots[i].second, r.p1_adjusted, r.p2_adjusted, r.distance);
+        timing.impossible += r.difficulty < 0;
+    }
+    timing.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / std::max(count, 1);
+    
+    // again, none known to be clear
+    DifficultyAnalyzer::cacheSegments = false;
+    int tested = 0;
+    ShotDifficulty r;
+    for ( int i=0; i<count; i++ )
+        DifficultyAnalyzer::CalculateDifficulty(shots[i].first, shots[i].second, r.p1_adjusted, r.p2_adjusted, r.distance, [&] (const vec3&, const vec3&, const float&, const vec3 (&)[4]) {
+            tested++;
+            return false;
+        });
+    timing.segments = tested / (double) std::max(count, 1);
+    
+    DifficultyAnalyzer::minimalClearance = solver;
+    DifficultyAnalyzer::cacheSegments = cached;
+    DifficultyAnalyzer::curvedPaths = curved;
+    DifficultyAnalyzer::candidateWindow = window;
+    return timing;
+}
+
+// Shots whose results differ in any way
+static int Mismatches(const vector<ShotDifficulty> &a, const vector<ShotDifficulty> &b) {
+    int mismatches = 0;
+    for ( int i=0; i<(int) a.size(); i++ )
+        mismatches += memcmp(&a[i], &b[i], sizeof(ShotDifficulty)) != 0;
+    return mismatches;
+}
+
+void DifficultyAnalyzer::TestCandidateWindow() {
+    
+    const vector<pair<vec3, vec3>> shots = RandomShots(200);
+    const int window = std::max(2, candidateWindow);
+    ShotTiming serial = TimeShots(shots, [] () {});
+    ShotTiming parallel = TimeShots(shots, [&] () { candidateWindow = window; });
+    
+    cout << "Difficulty of " << shots.size() << " random shots (" << serial.impossible << " impossible), " << gWorkerPool.Size() << " threads" << endl;
+    cout << "  serial " << (minimalClearance ? "minimal clearance: " : "step search: ") << serial.ms << " ms" << endl;
+    cout << "  " << window << " candidates at a time: " << parallel.ms << " ms, " << Mismatches(serial.results, parallel.results) << " mismatches" << endl;
+}
+
+void DifficultyAnalyzer::TestDifficultyBatch(const vector<vec3> &targets) {
+    
+    // random tees, to each target in turn if there are any
+    const int tees = 256, perTee = targets.empty() ? 8 : (int) targets.size();
+    vector<pair<vec3, vec3>> shots = RandomShots(tees * perTee);
+    for ( int i=0; i<(int) shots.size(); i++ ) {
+        shots[i].first = shots[i / perTee * perTee].first;
+        if (!targets.empty())
+            shots[i].second = targets[i % perTee];
+    }
+    
+    ShotTiming serial = TimeShots(shots, [] () {});
+    const bool cached = cacheSegments;
+    cacheSegments = false;
+    auto start = std::chrono::high_resolution_clock::now();
+    vector<ShotDifficulty> batch = CalculateDifficultyBatch(shots);
+    double batchMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    cacheSegments = cached;
+    
+    cout << "Difficulty of " << tees << " tees to " << perTee << " targets (" << serial.impossible << " impossible), " << gWorkerPool.Size() << " threads" << endl;
+    cout << "  one at a time: " << 1000 / serial.ms << " shots/s" << endl;
+    cout << "  batch: " << shots.size() / batchMs * 1000 << " shots/s, " << Mismatches(serial.results, batch) << " mismatches" << endl;
+}
+
+void DifficultyAnalyzer::TestMinimalClearance() {
+    
+    const vector<pair<vec3, vec3>> shots = RandomShots(200);
+    ShotTiming stepped = TimeShots(shots, [] () { minimalClearance = false; });
+    ShotTiming solved = TimeShots(shots, [] () { minimalClearance = true; });
+    
+    cout << "Difficulty of " << shots.size() << " random shots (" << stepped.impossible << " impossible)" << endl;
+    cout << "  step search: " << stepped.ms << " ms, " << stepped.segments << " segments tested" << endl;
+    cout << "  minimal clearance: " << solved.ms << " ms, " << solved.segments << " segments tested, " << Mismatches(stepped.results, solved.results) << " mismatches" << endl;
+}
+
+void DifficultyAnalyzer::TestSegmentCache() {
+    
+    const vector<pair<vec3, vec3>> shots = RandomShots(200);
+    segmentCache.Clear();
+    ShotTiming uncached = TimeShots(shots, [] () {});
+    ShotTiming first = TimeShots(shots, [] () { cacheSegments = true; });
+    const unsigned int hits = segmentCache.Hits(), misses = segmentCache.Misses();
+    ShotTiming second = TimeShots(shots, [] () { cacheSegments = true; });
+    
+    cout << "Difficulty of " << shots.size() << " random shots" << endl;
+    cout << "  without the segment cache: " << uncached.ms << " ms" << endl;
+    cout << "  first time with it: " << first.ms << " ms" << endl;
+    cout << "  second time: " << second.ms << " ms, " << segmentCache.Hits() - hits << " hits, " << segmentCache.Misses() - misses
+         << " misses, " << Mismatches(uncached.results, first.results) + Mismatches(uncached.results, second.results) << " mismatches" << endl;
+}
+
+void DifficultyAnalyzer::TestCurvedPaths() {
+    
+    const vector<pair<vec3, vec3>> shots = RandomShots(200);
+    ShotTiming straight = TimeShots(shots, [] () { curvedPaths = false; });
+    ShotTiming curved = TimeShots(shots, [] () { curvedPaths = true; });
+    
+    int differ = 0;
+    for ( int i=0; i<(int) shots.size(); i++ )
+        differ += straight.results[i].difficulty != curved.results[i].difficulty;
+    
+    cout << "Difficulty of " << shots.size() << " random shots (" << differ << " differ)" << endl;
+    cout << "  straight segments: " << straight.ms << " ms, " << straight.segments << " segments tested, " << straight.impossible << " impossible" << endl;
+    cout << "  curves: " << curved.ms << " ms, " << curved.segments << " segments tested, " << curved.impossible << " impossible" << endl;
+}
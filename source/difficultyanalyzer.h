@@ -10,9 +10,14 @@
 #define __DGIProject__difficultyanalyzer__
 
 #include <iostream>
+#include <vector>
+#include <utility>
+#include <functional>
 #include <glm/glm.hpp>
 #include "model.h"
+#include "segmentcache.h"
 
+using namespace std;
 using namespace glm;
 
 /*
@@ -24,8 +29,28 @@ struct Intersection {
     ModelAsset* asset;
 };
 
+/*
+ Result of CalculateDifficulty() for one shot
+ */
+struct ShotDifficulty {
+    float difficulty;   // -1 if impossible
+    float distance;
+    vec3 p1_adjusted;
+    vec3 p2_adjusted;
+};
+
 class DifficultyAnalyzer {
     
+public:
+    
+    // Whether a ball of radius moving from start to end is known to stay off the terrain. The
+    // segment is tested in place of a piece of a shot path, which is within the convex hull of the
+    // four points of piece (the ends, twice, for a straight one).
+    typedef function<bool (const vec3 &start, const vec3 &end, const float &radius, const vec3 (&piece)[4])> SegmentTest;
+    
+    // A height the terrain at world (x, z) reaches at least, -infinity if none
+    typedef function<float (const float &x, const float &z)> GroundBound;
+    
 private:
     
     static float HeightDifficulty(const float &extraHeight) {
@@ -42,17 +67,117 @@ private:
     }
     
 
+    // Test only the triangles of the terrain quads under the segment (skipping those it passes
+    // high above, see HeightPyramid) or ray
     static bool IntersectionBetweenPoints(const vec3 &start, const vec3 &end);
     static bool ClosestIntersection(vec3 start, vec3 dir,Intersection& closestIntersection);
     
+    // Whether a ball of radius moving from start to end may touch the terrain. It is kept off the
+    // planes of the triangles it passes near, so it may be stopped by a ridge or valley it would
+    // clear, but never passes through the terrain.
+    static bool CapsuleBetweenPoints(const vec3 &start, const vec3 &end, const float &radius);
+    
+    // IntersectionBetweenPoints(), or CapsuleBetweenPoints() if radius > 0, through segmentCache if cacheSegments
+    static bool SegmentHits(const vec3 &start, const vec3 &end, const float &radius);
+    
+    // SegmentHits() with clearanceRadius for a segment of a shot path. Within two radii (along xz) of
+    // an end on the ground, the tee or the target, the ball only has to keep its center above it.
+    static bool PathSegmentHits(const vec3 &start, const vec3 &end, const bool &startOnGround, const bool &endOnGround);
+    
+    // Same as the above, testing every triangle of the terrain
+    static bool IntersectionBetweenPointsBruteForce(const vec3 &start, const vec3 &end);
+    static bool ClosestIntersectionBruteForce(vec3 start, vec3 dir,Intersection& closestIntersection);
+    
     static bool PathIsClear(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target);
+    static bool PathIsClear(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target, const SegmentTest &knownClear);
+    
+    // PathIsClear() for the curve of curvedPaths, with knownClear if not NULL. Within two radii (along
+    // xz) of the tee and target the curve only has to stay above the ground, as PathSegmentHits().
+    static bool CurveIsClear(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target, const SegmentTest* knownClear);
+    
+    // Whether piece b of a curve keeps a ball of radius off the terrain, testing its chord moved and
+    // with the ball grown to cover the piece, and halving the piece only where that fails. Pieces
+    // within curveTolerance of their chords are tested as the chords.
+    static bool CurvePieceIsClear(const vec3 (&b)[4], const float &radius, const SegmentTest* knownClear, const int &depth);
+    
+    // The least lift of p1 and p2 alike that keeps the points sampled along path tee, p1 + offset,
+    // p2 + offset, target above ground (offset is along xz). Paths lifted less are blocked.
+    static float LeastLift(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target, const vec3 &offset, const GroundBound &ground);
+    
+    // CalculateDifficulty(), with knownClear as below if not NULL, and ground (see LeastLift()) the
+    // terrain surface if NULL
+    static float SearchDifficulty(const vec3 &tee, const vec3 &target, vec3 &p1_adjusted, vec3 &p2_adjusted, float &distance, const int &window, const SegmentTest* knownClear, const GroundBound* ground);
+    
+    class CandidateSequence;
     
 public:
     
 //    static const float SCALE_FACTOR; // To be able to test with smaller terrain but with realistic parameters
     static const float IMPOSSIBLE; // The maximum level of difficulty
     
+    // Candidate paths tested at once on gWorkerPool, or 1 to test one at a time, by the step search
+    // and by the curve and combo steps of minimalClearance. The first clear candidate in order is
+    // taken whatever the window, so the difficulty is that of testing one at a time.
+    static int candidateWindow;
+    
+    // Bisect for the first clear height step instead of trying the steps in turn, see
+    // SearchDifficulty(). Where clearance isn't monotonic in height it may settle on another
+    // step, TestMinimalClearance() counts how often.
+    static bool minimalClearance;
+    
+    // Keep whether the segments of shot paths hit the terrain in segmentCache, until the terrain
+    // under them changes.
+    static bool cacheSegments;
+    static SegmentCache segmentCache;
+    
+    // Shot paths have to keep a ball of this radius off the terrain, or only the path itself if 0.
+    // The tee and target are lifted to the center of the ball resting on them.
+    static float clearanceRadius;
+    
+    // Shots follow the cubic Bézier curve with the tee, p1, p2 and target as control points, instead
+    // of the straight segments between them
+    static bool curvedPaths;
+    
+    // The point at t (0 to 1) of the curve through the control points of a shot path
+    static vec3 CurvePosition(const vec3 &tee, const vec3 & p1, const vec3 &p2, const vec3 &target, const float &t);
+    
     static float CalculateDifficulty(const vec3 &tee, const vec3 &target, vec3 &p1_adjusted, vec3 &p2_adjusted, float &distance);
+    static float CalculateDifficulty(const vec3 &tee, const vec3 &target, vec3 &p1_adjusted, vec3 &p2_adjusted, float &distance, const int &window);
+    
+    // One path at a time, taking the segments knownClear(start, end, radius, piece) returns true for
+    // as clear without testing them against the terrain. It is called for every segment about to be
+    // tested.
+    static float CalculateDifficulty(const vec3 &tee, const vec3 &target, vec3 &p1_adjusted, vec3 &p2_adjusted, float &distance, const SegmentTest &knownClear);
+    
+    // As the above, with ground a height the terrain reaches at least (see GroundBound) in place of
+    // the terrain surface when finding the steps that pass under it
+    static float CalculateDifficulty(const vec3 &tee, const vec3 &target, vec3 &p1_adjusted, vec3 &p2_adjusted, float &distance, const SegmentTest &knownClear, const GroundBound &ground);
+    
+    // CalculateDifficulty() for each (tee, target) of shots, spread over gWorkerPool a shot at a time
+    static vector<ShotDifficulty> CalculateDifficultyBatch(const vector<pair<vec3, vec3>> &shots);
+    
+    // Prints how often the faster intersections disagree with the brute force ones on random
+    // segments and rays over the current terrain, and how fast each is
+    static void TestTraversal();
+    
+    // Prints how long random shots take with and without candidateWindow, and whether the results differ
+    static void TestCandidateWindow();
+    
+    // Prints how long random shots take and how many segments they test with and without
+    // minimalClearance, and how often the difficulty differs
+    static void TestMinimalClearance();
+    
+    // Prints how long random shots take without segmentCache, the first time with it and the
+    // second time, and whether the results differ
+    static void TestSegmentCache();
+    
+    // Prints how long random shots take and how many segments they test along curves and along
+    // straight segments, and how often the difficulty differs
+    static void TestCurvedPaths();
+    
+    // Prints how many shots per second CalculateDifficultyBatch() rates, from random tees to each
+    // of targets (or random ones if there are none), and whether the results differ from one at a time
+    static void TestDifficultyBatch(const vector<vec3> &targets);
     
 };
 
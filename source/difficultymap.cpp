@@ -0,0 +1,511 @@
+//
+//  difficultymap.cpp
+//  DGIProject
+//
+
+#include "difficultymap.h"
+#include "difficultyanalyzer.h"
+#include "rangeterrain.h"
+#include "workerpool.h"
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <limits>
+
+DifficultyMap gDifficultyMap;
+
+// A segment has to pass this much above the profile, so rounding in the triangle tests can't matter
+const float profileMargin = 1e-3f;
+
+DifficultyMap::DifficultyMap() {
+    step = 1;
+    radius = 0;
+    curved = false;
+    cellsX = cellsY = 0;
+    rings = leaves = 0;
+    version = 0;
+    regenerations = 0;
+    lastComputedCells = 0;
+}
+
+void DifficultyMap::Clear() {
+    difficulty.clear();
+    spanFirst.clear();
+    spanCount.clear();
+    profile.clear();
+    ground.clear();
+    horizon.clear();
+    changedCells.clear();
+    cellsX = cellsY = 0;
+    lastComputedCells = 0;
+}
+
+void DifficultyMap::Compute(const vec3 &tee, const int &step) {
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    this->tee = tee;
+    this->step = std::max(step, 1);
+    radius = DifficultyAnalyzer::clearanceRadius;
+    curved = DifficultyAnalyzer::curvedPaths;
+
+    // the last sample is a cell too, however the step divides the terrain
+    const int X = gTerrain.XInterval(), Y = gTerrain.YInterval();
+    cellsX = (X - 1 + this->step - 1) / this->step + 1;
+    cellsY = (Y - 1 + this->step - 1) / this->step + 1;
+    difficulty.assign(cellsX * cellsY, 0);
+    spanFirst.assign(cellsX * cellsY, 0);
+    spanCount.assign(cellsX * cellsY, 0);
+
+    version = gTerrain.Version();
+    regenerations = gTerrain.Regenerations();
+
+    BuildProfile();
+
+    vector<int> cells(cellsX * cellsY);
+    for ( int i=0; i<cellsX * cellsY; i++ )
+        cells[i] = i;
+    ComputeCells(cells);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    cout << "Difficulty map: " << cellsX << "x" << cellsY << " cells in " << ms << " ms" << endl;
+}
+
+bool DifficultyMap::Update(const vec3 &tee) {
+
+    if (!Computed())
+        return false;
+
+    const int X = gTerrain.XInterval(), Y = gTerrain.YInterval();
+    if (tee != this->tee || radius != DifficultyAnalyzer::clearanceRadius || curved != DifficultyAnalyzer::curvedPaths ||
+        regenerations != gTerrain.Regenerations() || cellsX != (X - 1 + step - 1) / step + 1 || cellsY != (Y - 1 + step - 1) / step + 1) {
+        Compute(tee, step);
+        return true;
+    }
+
+    if (gTerrain.Version() == version)
+        return false;
+
+    /*
+     The sectors of the quads around every changed sample. Markings are listed among them too,
+     but only the samples in quads that changed since the cells were computed matter.
+     */
+    vector<int> changedSectors(DIFFICULTY_MAP_SECTORS, 0);
+    bool changed = false;
+    const float g = gTerrain.GridRes();
+    for ( const xy &xy : gTerrain.ChangedVertices() ) {
+
+        const int x = xy.x, y = xy.y;
+        if (gTerrain.QuadsVersion(x - 1, y - 1, x, y) <= version)
+            continue;
+        changed = true;
+
+        int firstSector, sectorCount, firstRing, lastRing;
+        Extent(vec2((x - 1) * g - radius, -(y + 1) * g - radius), vec2((x + 1) * g + radius, -(y - 1) * g + radius),
+               firstSector, sectorCount, firstRing, lastRing);
+        for ( int i=0; i<sectorCount; i++ )
+            changedSectors[(firstSector + i) % DIFFICULTY_MAP_SECTORS] = 1;
+    }
+    version = gTerrain.Version();
+
+    if (!changed)
+        return false;
+
+    BuildProfile();
+
+    // changed sectors before each sector, twice around so spans can wrap
+    vector<int> before(2 * DIFFICULTY_MAP_SECTORS + 1, 0);
+    for ( int i=0; i<2 * DIFFICULTY_MAP_SECTORS; i++ )
+        before[i+1] = before[i] + changedSectors[i % DIFFICULTY_MAP_SECTORS];
+
+    vector<int> cells;
+    for ( int i=0; i<cellsX * cellsY; i++ )
+        if (before[spanFirst[i] + spanCount[i]] != before[spanFirst[i]])
+            cells.push_back(i);
+    ComputeCells(cells);
+
+    return true;
+}
+
+void DifficultyMap::ComputeCells(const vector<int> &cells) {
+
+    const int X = gTerrain.XInterval(), Y = gTerrain.YInterval();
+    const int half = DIFFICULTY_MAP_SECTORS / 2;
+
+    gWorkerPool.ParallelFor((int) cells.size(), [&] (int i) {
+
+        const int c = cells[i];
+        const int x = std::min((c % cellsX) * step, X - 1), y = std::min((c / cellsX) * step, Y - 1);
+        const vec3 target = gTerrain.SamplePosition(x, y);
+
+        // sectors the tested segments end in, relative to the target's
+        const int targetSector = Sector(target.x, target.z);
+        int lo = 0, hi = 0;
+        auto Cross = [&] (const vec3 &p) {
+            if (p.x == tee.x && p.z == tee.z)
+                return;
+            const int d = (Sector(p.x, p.z) - targetSector + DIFFICULTY_MAP_SECTORS + half) % DIFFICULTY_MAP_SECTORS - half;
+            lo = std::min(lo, d);
+            hi = std::max(hi, d);
+        };
+
+        /*
+         The segments tested as a ray, or along straight paths with the radius the horizon is for,
+         are cleared by it if they start at the tee. The steps rejected from the ground are never
+         tested, so the sectors they are rejected from are kept as well.
+         */
+        vec3 p1, p2;
+        float distance;
+        difficulty[c] = DifficultyAnalyzer::CalculateDifficulty(tee, target, p1, p2, distance, [&] (const vec3 &start, const vec3 &end, const float &r, const vec3 (&piece)[4]) {
+            for ( const vec3 &p : piece )
+                Cross(p);
+            if ((r == 0 || (!curved && r == radius)) && AboveHorizon(start, end))
+                return true;
+            return AboveProfile(start, end, std::max(r - radius, 0.0f));
+        }, [&] (const float &x, const float &z) {
+            Cross(vec3(x, 0, z));
+            return Ground(x, z);
+        });
+
+        /*
+         A piece of a path is within the convex hull of its points, which sweeps the shorter way
+         between their directions, so the tested ones are within lo..hi as long as that is less than
+         half a turn. Beyond it, or when the tee and target coincide and there are no directions, any
+         change could matter.
+         */
+        if (hi - lo + 3 >= half || (target.x == tee.x && target.z == tee.z)) {
+            spanFirst[c] = 0;
+            spanCount[c] = DIFFICULTY_MAP_SECTORS;
+        } else {
+            spanFirst[c] = (targetSector + lo - 1 + DIFFICULTY_MAP_SECTORS) % DIFFICULTY_MAP_SECTORS;
+            spanCount[c] = hi - lo + 3;
+        }
+    });
+
+    changedCells.insert(changedCells.end(), cells.begin(), cells.end());
+    lastComputedCells = (int) cells.size();
+}
+
+void DifficultyMap::BuildProfile() {
+
+    const int X = gTerrain.XInterval(), Y = gTerrain.YInterval();
+    const float g = gTerrain.GridRes();
+
+    // out to the farthest corner of the terrain
+    float maxDistance = 0;
+    for ( const vec2 &corner : { vec2(0, 0), vec2(gTerrain.Width(), 0), vec2(0, -gTerrain.Depth()), vec2(gTerrain.Width(), -gTerrain.Depth()) } )
+        maxDistance = std::max(maxDistance, length(corner - vec2(tee.x, tee.z)));
+    rings = (int) ((maxDistance + radius) / g) + 2;
+    for ( leaves=1; leaves<rings; leaves*=2 ) {}
+    profile.assign(DIFFICULTY_MAP_SECTORS * 2 * leaves, -std::numeric_limits<float>::infinity());
+    ground.assign(DIFFICULTY_MAP_SECTORS * rings, std::numeric_limits<float>::infinity());
+
+    for ( int y=0; y<Y-1; y++ ) {
+        for ( int x=0; x<X-1; x++ ) {
+
+            // the box the ball's center has to stay out of, see DifficultyAnalyzer::CapsuleBetweenPoints()
+            // and the lowest of its samples, in the same sectors and rings as they cover the quad
+            const float h = gTerrain.QuadMaxHeight(x, y) + radius;
+            const float low = std::min(std::min(gTerrain.Height(x, y), gTerrain.Height(x + 1, y)),
+                                       std::min(gTerrain.Height(x, y + 1), gTerrain.Height(x + 1, y + 1)));
+            int firstSector, sectorCount, firstRing, lastRing;
+            Extent(vec2(x * g - radius, -(y + 1) * g - radius), vec2((x + 1) * g + radius, -y * g + radius),
+                   firstSector, sectorCount, firstRing, lastRing);
+
+            for ( int i=0; i<sectorCount; i++ ) {
+                const int sector = (firstSector + i) % DIFFICULTY_MAP_SECTORS;
+                float* ring = &profile[sector * 2 * leaves + leaves];
+                float* lowest = &ground[sector * rings];
+                for ( int r=firstRing; r<=lastRing; r++ ) {
+                    ring[r] = std::max(ring[r], h);
+                    lowest[r] = std::min(lowest[r], low);
+                }
+            }
+        }
+    }
+
+    // and the highest of every two rings, every four and so on
+    for ( int s=0; s<DIFFICULTY_MAP_SECTORS; s++ ) {
+        float* tree = &profile[s * 2 * leaves];
+        for ( int node=leaves-1; node>=1; node-- )
+            tree[node] = std::max(tree[2 * node], tree[2 * node + 1]);
+    }
+
+    /*
+     A segment from the lifted tee rising s per unit of distance is s times the near edge of each
+     ring it reaches above the tee there, so it stays above the profile if s is more than the height
+     of each ring over the tee divided by that. Within two radii of the tee it is tested as a ray,
+     which the triangles there have to stay under instead, as the profile of ring 0 is the quads
+     around the tee and so reaches the ball of the tee itself.
+     */
+    const float teeY = LiftedTee().y;
+    const float near = radius > 0 ? std::min(2 * radius, g) : g;
+    horizon.assign(DIFFICULTY_MAP_SECTORS * rings, 0);
+    for ( int s=0; s<DIFFICULTY_MAP_SECTORS; s++ ) {
+        const float* ring = &profile[s * 2 * leaves + leaves];
+        float slope = NearTeeSlope(s, near);
+        if (near < g)
+            slope = std::max(slope, (ring[0] + profileMargin - teeY) / near);
+        horizon[s * rings] = slope;
+        for ( int r=1; r<rings; r++ ) {
+            slope = std::max(slope, (ring[r] + profileMargin - teeY) / (r * g));
+            horizon[s * rings + r] = slope;
+        }
+    }
+}
+
+float DifficultyMap::NearTeeSlope(const int &sector, const float &far) const {
+
+    const int X = gTerrain.XInterval(), Y = gTerrain.YInterval();
+    const float g = gTerrain.GridRes();
+    const vec2 t(tee.x, tee.z);
+    const float teeY = LiftedTee().y;
+
+    // the most a plane of gradient rises along the directions of the sector, and one more on
+    // either side for rounding, counterclockwise from d0 to d1
+    const vec2 d0 = normalize(Direction((sector + DIFFICULTY_MAP_SECTORS - 1) % DIFFICULTY_MAP_SECTORS * 4.0f / DIFFICULTY_MAP_SECTORS));
+    const vec2 d1 = normalize(Direction((sector + 2) % DIFFICULTY_MAP_SECTORS * 4.0f / DIFFICULTY_MAP_SECTORS));
+    auto Rise = [&] (const vec2 &gradient) {
+        float rise = std::max(dot(gradient, d0), dot(gradient, d1));
+        if (d0.x * gradient.y - d0.y * gradient.x >= 0 && gradient.x * d1.y - gradient.y * d1.x >= 0)
+            rise = std::max(rise, length(gradient));
+        return rise;
+    };
+
+    /*
+     Over a quad nearer than far, the ray has to stay above the planes of both its triangles. At
+     distance r it is h + s * r over a plane at height e at the tee rising k along it, so s has to be
+     more than k + (e - h) / r from the nearest to the farthest r. A plane above the tee itself
+     can only be passed if the quad is away from it.
+     */
+    float slope = 0;
+    const int x0 = std::max((int) floor((t.x - far) / g), 0), x1 = std::min((int) floor((t.x + far) / g), X - 2);
+    const int y0 = std::max((int) floor((-t.y - far) / g), 0), y1 = std::min((int) floor((-t.y + far) / g), Y - 2);
+    for ( int y=y0; y<=y1; y++ ) {
+        for ( int x=x0; x<=x1; x++ ) {
+
+            const vec2 lo(x * g, -(y + 1) * g), hi((x + 1) * g, -y * g);
+            const float nearest = length(clamp(t, lo, hi) - t);
+            if (nearest >= far)
+                continue;
+
+            // the tee in the quad's own coordinates, along x and -z
+            const float u = t.x / g - x, v = -t.y / g - y;
+            const float h1 = gTerrain.Height(x  , y  ), h2 = gTerrain.Height(x  , y+1);
+            const float h3 = gTerrain.Height(x+1, y  ), h4 = gTerrain.Height(x+1, y+1);
+
+            // each plane by its height at a corner (u0, v0) and how much it rises along u and v
+            auto Plane = [&] (const float &h, const float &u0, const float &v0, const float &du, const float &dv) {
+                const float e = h + (u - u0) * du + (v - v0) * dv + profileMargin - teeY;
+                const float k = Rise(vec2(du, -dv) / g);
+                if (e <= 0)
+                    slope = std::max(slope, k + e / far);
+                else
+                    slope = nearest > 0 ? std::max(slope, k + e / nearest) : std::numeric_limits<float>::infinity();
+            };
+            if (gTerrain.DiagonalUp(x, y)) {
+                Plane(h1, 0, 0, h3 - h1, h2 - h1);
+                Plane(h4, 1, 1, h4 - h2, h4 - h3);
+            } else {
+                Plane(h1, 0, 0, h4 - h2, h2 - h1);
+                Plane(h1, 0, 0, h3 - h1, h4 - h3);
+            }
+        }
+    }
+    return slope;
+}
+
+bool DifficultyMap::AboveHorizon(const vec3 &start, const vec3 &end) const {
+
+    if (start != LiftedTee())
+        return false;
+
+    const float length = glm::length(vec2(end.x - start.x, end.z - start.z));
+    if (!(length > 0))
+        return false;
+
+    const float rise = (end.y - start.y) / length;
+    const int ring = std::min((int) (length / gTerrain.GridRes()), rings - 1);
+    return rise >= 0 && rise > horizon[Sector(end.x, end.z) * rings + ring];
+}
+
+float DifficultyMap::Ground(const float &x, const float &z) const {
+
+    // nothing off the terrain, nor in sectors and rings without quads
+    if (!(x >= 0 && x <= gTerrain.Width() && z <= 0 && z >= -gTerrain.Depth()))
+        return -std::numeric_limits<float>::infinity();
+    const int ring = (int) (length(vec2(x - tee.x, z - tee.z)) / gTerrain.GridRes());
+    if (ring >= rings)
+        return -std::numeric_limits<float>::infinity();
+    const float h = ground[Sector(x, z) * rings + ring];
+    return h < std::numeric_limits<float>::infinity() ? h : -std::numeric_limits<float>::infinity();
+}
+
+void DifficultyMap::Extent(const vec2 &lo, const vec2 &hi, int &firstSector, int &sectorCount, int &firstRing, int &lastRing) const {
+
+    const float g = gTerrain.GridRes();
+    const vec2 t(tee.x, tee.z);
+    const vec2 corners[4] = { lo, vec2(hi.x, lo.y), vec2(lo.x, hi.y), hi };
+
+    const vec2 nearest = clamp(t, lo, hi);
+    float farthest = 0;
+    for ( const vec2 &corner : corners )
+        farthest = std::max(farthest, length(corner - t));
+    firstRing = std::max((int) (length(nearest - t) / g) - 1, 0);
+    lastRing = std::min((int) (farthest / g) + 1, rings - 1);
+
+    // around the tee, every direction
+    if (t.x >= lo.x - g && t.x <= hi.x + g && t.y >= lo.y - g && t.y <= hi.y + g) {
+        firstSector = 0;
+        sectorCount = DIFFICULTY_MAP_SECTORS;
+        return;
+    }
+
+    // the rectangle is less than half a turn wide from further away, so its corners are on either
+    // side of its center
+    const vec2 center = (lo + hi) * 0.5f - t;
+    const float centerAngle = Angle(center.x, center.y);
+    float minAngle = 0, maxAngle = 0;
+    for ( const vec2 &corner : corners ) {
+        float angle = Angle(corner.x - t.x, corner.y - t.y) - centerAngle;
+        if (angle > 2)
+            angle -= 4;
+        if (angle < -2)
+            angle += 4;
+        minAngle = std::min(minAngle, angle);
+        maxAngle = std::max(maxAngle, angle);
+    }
+
+    const int first = (int) floor((centerAngle + minAngle) * (DIFFICULTY_MAP_SECTORS / 4)) - 1;
+    const int last = (int) floor((centerAngle + maxAngle) * (DIFFICULTY_MAP_SECTORS / 4)) + 1;
+    firstSector = (first % DIFFICULTY_MAP_SECTORS + DIFFICULTY_MAP_SECTORS) % DIFFICULTY_MAP_SECTORS;
+    sectorCount = std::min(last - first + 1, DIFFICULTY_MAP_SECTORS);
+}
+
+bool DifficultyMap::AboveProfile(const vec3 &start, const vec3 &end, const float &extra) const {
+
+    const vec2 a(start.x - tee.x, start.z - tee.z), b(end.x - tee.x, end.z - tee.z);
+    const float ra = length(a), rb = length(b);
+    if (!(ra + rb > 0))
+        return false;   // vertical above the tee, or not a number
+
+    const float g = gTerrain.GridRes();
+
+    // a larger ball, in the sectors and rings of the xz box of the segment widened by the difference,
+    // and no lower than its lowest end less the difference
+    if (extra > 0) {
+        int firstSector, sectorCount, firstRing, lastRing;
+        Extent(vec2(std::min(start.x, end.x) - extra, std::min(start.z, end.z) - extra),
+               vec2(std::max(start.x, end.x) + extra, std::max(start.z, end.z) + extra),
+               firstSector, sectorCount, firstRing, lastRing);
+        if (sectorCount > 32)
+            return false;
+        const float lowest = std::min(start.y, end.y) - extra - profileMargin;
+        for ( int i=0; i<sectorCount; i++ )
+            if (ProfileMax((firstSector + i) % DIFFICULTY_MAP_SECTORS, firstRing, lastRing) >= lowest)
+                return false;
+        return true;
+    }
+
+    // most segments end near the ground at the tee or target, and fail right there
+    const vec3 &low = start.y < end.y ? start : end;
+    const float rl = start.y < end.y ? ra : rb;
+    if (rl > 0 && (int) (rl / g) < rings &&
+        low.y <= profile[Sector(low.x, low.z) * 2 * leaves + leaves + (int) (rl / g)] + profileMargin)
+        return false;
+
+    // both ends in the same direction from the tee (to well within a sector), where the height is
+    // linear in the distance from the tee
+    if (abs(a.x * b.y - a.y * b.x) <= 1e-5f * ra * rb && dot(a, b) >= 0) {
+        const vec3 &farthest = ra > rb ? start : end;
+        const float r0 = std::min(ra, rb), r1 = std::max(ra, rb);
+        const float h0 = ra < rb ? start.y : end.y, h1 = ra < rb ? end.y : start.y;
+        return AboveRings(Sector(farthest.x, farthest.z), 1, 0, leaves, r0, r1, h0, h1);
+    }
+
+    // elsewhere, the segment is within the sectors between its ends, and the rings between its
+    // point nearest to the tee and its farthest end, and no lower than its lowest end
+    const int first = Sector(start.x, start.z);
+    const int d = (Sector(end.x, end.z) - first + DIFFICULTY_MAP_SECTORS + DIFFICULTY_MAP_SECTORS / 2) % DIFFICULTY_MAP_SECTORS - DIFFICULTY_MAP_SECTORS / 2;
+    if (abs(d) > 32)
+        return false;
+
+    const vec2 ab = b - a;
+    const float t = glm::clamp(-dot(a, ab) / dot(ab, ab), 0.0f, 1.0f);
+    const int r0 = (int) (length(a + t * ab) / g), r1 = std::min((int) (std::max(ra, rb) / g), rings - 1);
+    const float lowest = std::min(start.y, end.y) - profileMargin;
+    for ( int i=0; i<=abs(d); i++ )
+        if (ProfileMax((first + (d < 0 ? -i : i) + DIFFICULTY_MAP_SECTORS) % DIFFICULTY_MAP_SECTORS, r0, r1) >= lowest)
+            return false;
+    return true;
+}
+
+bool DifficultyMap::AboveRings(const int &sector, const int &node, const int &lo, const int &hi, const float &r0, const float &r1, const float &h0, const float &h1) const {
+
+    // where the segment is over rings lo..hi-1
+    const float g = gTerrain.GridRes();
+    const float a = std::max(r0, lo * g), b = std::min(r1, hi * g);
+    if (a > b)
+        return true;
+
+    auto HeightAt = [&] (const float &r) {
+        return r1 > r0 ? h0 + (h1 - h0) * (r - r0) / (r1 - r0) : std::min(h0, h1);
+    };
+    if (std::min(HeightAt(a), HeightAt(b)) > profile[sector * 2 * leaves + node] + profileMargin)
+        return true;
+    if (node >= leaves)
+        return false;
+
+    const int mid = (lo + hi) / 2;
+    return AboveRings(sector, 2 * node, lo, mid, r0, r1, h0, h1) && AboveRings(sector, 2 * node + 1, mid, hi, r0, r1, h0, h1);
+}
+
+float DifficultyMap::ProfileMax(const int &sector, int r0, int r1) const {
+
+    const float* tree = &profile[sector * 2 * leaves];
+    float h = -std::numeric_limits<float>::infinity();
+    for ( r0 += leaves, r1 += leaves + 1; r0 < r1; r0 /= 2, r1 /= 2 ) {
+        if (r0 & 1)
+            h = std::max(h, tree[r0++]);
+        if (r1 & 1)
+            h = std::max(h, tree[--r1]);
+    }
+    return h;
+}
+
+int DifficultyMap::Sector(const float &x, const float &z) const {
+    const int s = (int) (Angle(x - tee.x, z - tee.z) * (DIFFICULTY_MAP_SECTORS / 4));
+    return s < DIFFICULTY_MAP_SECTORS ? s : 0;
+}
+
+float DifficultyMap::Angle(const float &x, const float &z) {
+    // 0 along x, 1 along z, 2 along -x and 3 along -z
+    if (x == 0 && z == 0)
+        return 0;
+    if (z >= 0)
+        return x >= 0 ? z / (x + z) : 1 - x / (z - x);
+    else
+        return x < 0 ? 2 - z / (-x - z) : 3 + x / (x - z);
+}
+
+vec2 DifficultyMap::Direction(const float &angle) {
+    const int quadrant = (int) angle % 4;
+    const float f = angle - floor(angle);
+    switch (quadrant) {
+        case 0:  return vec2(1 - f, f);
+        case 1:  return vec2(-f, 1 - f);
+        case 2:  return vec2(f - 1, -f);
+        default: return vec2(f, f - 1);
+    }
+}
+
+vec4 DifficultyMap::CellColor(const int &cx, const int &cy) const {
+
+    const float d = Difficulty(cx, cy);
+    if (d < 0)
+        return vec4(0.5, 0, 0.5, 1);
+
+    const float t = glm::clamp(d / DifficultyAnalyzer::IMPOSSIBLE, 0.0f, 1.0f);
+    return t < 0.5f ? mix(vec4(0, 0.8, 0, 1), vec4(1, 1, 0, 1), 2 * t)
+                    : mix(vec4(1, 1, 0, 1), vec4(1, 0, 0, 1), 2 * t - 1);
+}
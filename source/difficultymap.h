@@ -0,0 +1,137 @@
+//
+//  difficultymap.h
+//  DGIProject
+//
+
+#ifndef DGIProject_difficultymap_h
+#define DGIProject_difficultymap_h
+
+#include <vector>
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+#define DIFFICULTY_MAP_SECTORS  1024    // Directions from the tee the horizon profile is kept for
+
+/**
+ The difficulty of shots from one tee to every cell of the terrain, a cell being every step:th
+ sample in x and y, the same as CalculateDifficulty() gives for the sample.
+
+ Shots from the tee go out along directions, so the terrain is summarized once per tee as a
+ horizon profile: the highest point within each sector (of DIFFICULTY_MAP_SECTORS around the tee)
+ and ring (of one grid step), of every quad widened and raised by DifficultyAnalyzer::clearanceRadius.
+ The straight and raised paths lie in the vertical plane through the tee and the target, and a
+ segment of them that passes above the profile of its sector can't come near the terrain, so it is
+ cleared without testing the quads under them. The pieces of curved paths that are tested with a
+ larger ball are cleared against the sectors and rings of their box.
+
+ The segments from the tee start on the ground, under the profile, so the least rise that keeps
+ one off each sector out to each ring is found once per tee as a horizon, and the first segment of
+ every straight path in the sector is cleared by its rise alone. The lowest terrain of each sector
+ and ring is kept too, and the steps of the minimal clearance search that pass under it are
+ rejected from it (see DifficultyAnalyzer::GroundBound) without looking at the terrain.
+
+ The sectors crossed by the paths tried for each cell are kept, and when the terrain changes only
+ the cells whose paths crossed a changed sector are computed again.
+ */
+class DifficultyMap {
+public:
+
+    int lastComputedCells;  // By the last Compute() or Update()
+
+    DifficultyMap();
+
+    // The map from tee, of every step:th sample
+    void Compute(const vec3 &tee, const int &step);
+    void Clear();
+
+    // Computes the cells that the terrain changes since the last call affect (or all of them, if
+    // the terrain was regenerated, or the tee, the clearance radius or the shape of paths changed).
+    // The changed samples are taken from gTerrain.ChangedVertices(), so it is called before they
+    // are reset. False if nothing changed.
+    bool Update(const vec3 &tee);
+
+    inline bool Computed() const                { return !difficulty.empty(); }
+    inline int  CellsX() const                  { return cellsX; }
+    inline int  CellsY() const                  { return cellsY; }
+    inline int  Step() const                    { return step; }
+
+    // -1 if impossible, see CalculateDifficulty()
+    inline float Difficulty(const int &cx, const int &cy) const { return difficulty[cy * cellsX + cx]; }
+
+    // The cell covering sample (x, y), the one whose sample is nearest
+    inline int CellX(const int &x) const        { return std::min((x + step / 2) / step, cellsX - 1); }
+    inline int CellY(const int &y) const        { return std::min((y + step / 2) / step, cellsY - 1); }
+
+    // Overlay color of cell (cx, cy), from green (easy) over yellow to red, purple if impossible
+    vec4 CellColor(const int &cx, const int &cy) const;
+
+    // Cells computed since ResetChangedCells(), as cy * CellsX() + cx
+    inline const vector<int>& ChangedCells() const { return changedCells; }
+    inline void ResetChangedCells()             { changedCells.clear(); }
+
+private:
+
+    vec3            tee;
+    float           radius;         // DifficultyAnalyzer::clearanceRadius the profile is for
+    bool            curved;         // DifficultyAnalyzer::curvedPaths the cells are for
+    int             step;
+    int             cellsX, cellsY;
+    vector<float>   difficulty;     // cellsY * cellsX
+    vector<short>   spanFirst;      // Sectors crossed by the paths tried for each cell, from
+    vector<short>   spanCount;      // the first one and counting counterclockwise
+    unsigned int    version;        // gTerrain.Version() the cells are up to date with
+    int             regenerations;  // gTerrain.Regenerations() when they were all computed
+    vector<int>     changedCells;
+
+    int             rings;
+    int             leaves;         // Rings rounded up to a power of two
+    vector<float>   profile;        // Per sector, the highest terrain of its rings as a binary tree:
+                                    // ring r at leaves + r, and the highest of nodes 2n and 2n+1 at n
+    vector<float>   ground;         // Per sector and ring, the lowest sample of the quads in it
+    vector<float>   horizon;        // Per sector and ring r, the least rise per unit of distance that
+                                    // keeps a segment from the tee off rings 0..r
+
+    void BuildProfile();
+    void ComputeCells(const vector<int> &cells);
+
+    // Sectors (first, and counting counterclockwise) and rings of the xz rectangle, padded by one
+    // of each so rounding can't leave a point of the rectangle outside them
+    void Extent(const vec2 &lo, const vec2 &hi, int &firstSector, int &sectorCount, int &firstRing, int &lastRing) const;
+
+    // Whether segment start, end passes above the profile where it is, so it can't hit the terrain,
+    // with a ball extra larger than the profile is for
+    bool AboveProfile(const vec3 &start, const vec3 &end, const float &extra) const;
+
+    // Whether a segment from distance r0 to r1 of the tee, in the direction of the sector, with
+    // height h0 to h1, is above rings lo..hi-1 (node of the profile tree)
+    bool AboveRings(const int &sector, const int &node, const int &lo, const int &hi, const float &r0, const float &r1, const float &h0, const float &h1) const;
+
+    // Whether segment start, end from the lifted tee rises above the horizon where it is, so it
+    // can't hit the terrain, as a ray within two radii (along xz) of the tee as PathSegmentHits()
+    bool AboveHorizon(const vec3 &start, const vec3 &end) const;
+
+    // The least rise of a ray from the lifted tee in the directions of the sector, within ring 0 and
+    // less than distance far from the tee, that keeps it above the triangles there
+    float NearTeeSlope(const int &sector, const float &far) const;
+
+    // The lowest terrain at xz point (x, z), see DifficultyAnalyzer::GroundBound
+    float Ground(const float &x, const float &z) const;
+
+    float ProfileMax(const int &sector, int r0, int r1) const;  // Rings r0..r1
+
+    // The tee lifted as DifficultyAnalyzer::SearchDifficulty() lifts it, to the center of the ball
+    inline vec3 LiftedTee() const               { return tee + vec3(0, std::max(0.1f, radius), 0); }
+
+    int Sector(const float &x, const float &z) const;   // Of the direction to xz point (x, z) from the tee
+
+    // Of direction (x, z) in [0, 4), growing with the angle counterclockwise from x like atan2() but
+    // cheaper. The sectors are equal ranges of it.
+    static float Angle(const float &x, const float &z);
+    static vec2 Direction(const float &angle);  // Of Angle(), along its square
+};
+
+extern DifficultyMap gDifficultyMap;
+
+#endif
@@ -0,0 +1,85 @@
+//
+//  heightpyramid.cpp
+//  DGIProject
+//
+
+#include "heightpyramid.h"
+#include <algorithm>
+
+void HeightPyramid::Resize(const int &quadsX, const int &quadsY) {
+    
+    levels.clear();
+    widths.clear();
+    heights.clear();
+    
+    int w = quadsX, h = quadsY;
+    while (true) {
+        levels.push_back(vector<float>(w * h, 0.0f));
+        widths.push_back(w);
+        heights.push_back(h);
+        if (w == 1 && h == 1)
+            break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+    
+    changed.clear();
+    marked.assign(quadsX * quadsY, false);
+}
+
+void HeightPyramid::SetQuad(const int &x, const int &y, const float &h) {
+    
+    const int i = y * widths[0] + x;
+    levels[0][i] = h;
+    if (!marked[i]) {
+        marked[i] = true;
+        changed.push_back(i);
+    }
+}
+
+void HeightPyramid::Propagate() {
+    
+    // the blocks above the changed ones, a level at a time
+    vector<int> blocks = changed;
+    for ( int i : changed )
+        marked[i] = false;
+    changed.clear();
+    
+    for ( int l=1; l<Levels() && !blocks.empty(); l++ ) {
+        
+        for ( int &i : blocks )
+            i = (i / widths[l-1] / 2) * widths[l] + (i % widths[l-1]) / 2;
+        std::sort(blocks.begin(), blocks.end());
+        blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+        
+        for ( int i : blocks )
+            levels[l][i] = ChildrenMax(l, i % widths[l], i / widths[l]);
+    }
+}
+
+void HeightPyramid::SetAllQuads(const function<float (int, int)> &height) {
+    
+    for ( int y=0; y<heights[0]; y++ )
+        for ( int x=0; x<widths[0]; x++ )
+            levels[0][y * widths[0] + x] = height(x, y);
+    
+    for ( int i : changed )
+        marked[i] = false;
+    changed.clear();
+    
+    for ( int l=1; l<Levels(); l++ )
+        for ( int y=0; y<heights[l]; y++ )
+            for ( int x=0; x<widths[l]; x++ )
+                levels[l][y * widths[l] + x] = ChildrenMax(l, x, y);
+}
+
+float HeightPyramid::ChildrenMax(const int &l, const int &x, const int &y) const {
+    
+    // blocks on the last row/column may have a single child along it
+    const bool right = 2*x+1 < widths[l-1], below = 2*y+1 < heights[l-1];
+    float h = Max(l-1, 2*x, 2*y);
+    if (right)          h = std::max(h, Max(l-1, 2*x+1, 2*y  ));
+    if (below)          h = std::max(h, Max(l-1, 2*x  , 2*y+1));
+    if (right && below) h = std::max(h, Max(l-1, 2*x+1, 2*y+1));
+    return h;
+}
@@ -0,0 +1,54 @@
+//
+//  heightpyramid.h
+//  DGIProject
+//
+
+#ifndef DGIProject_heightpyramid_h
+#define DGIProject_heightpyramid_h
+
+#include <vector>
+#include <functional>
+
+using namespace std;
+
+/**
+ The highest point of the terrain over each quad (level 0), and over blocks of 2x2 quads,
+ 4x4 quads and so on (levels 1, 2, ...), up to a single block over the whole terrain. Block
+ (x, y) of level l covers the quads [x << l, (x + 1) << l) x [y << l, (y + 1) << l). Anything
+ entirely above a block's height can't hit the terrain within it.
+ */
+class HeightPyramid {
+public:
+    
+    // All heights 0, as over a flat terrain
+    void Resize(const int &quadsX, const int &quadsY);
+    
+    // Sets the height of quad (x, y). The blocks above it are updated by Propagate().
+    void SetQuad(const int &x, const int &y, const float &h);
+    
+    // Updates the blocks above the quads set since the last call
+    void Propagate();
+    
+    // Sets the height of every quad to height(x, y), and updates every block
+    void SetAllQuads(const function<float (int, int)> &height);
+    
+    inline int   Levels()                   const { return (int) levels.size(); }
+    inline int   Width(const int &level)    const { return widths[level]; }
+    inline int   Height(const int &level)   const { return heights[level]; }
+    inline float Max(const int &level, const int &x, const int &y) const {
+        return levels[level][y * widths[level] + x];
+    }
+    
+    bool operator==(const HeightPyramid &other) const { return levels == other.levels; }
+    
+private:
+    
+    vector<vector<float>>   levels;
+    vector<int>             widths, heights;
+    vector<int>             changed;        // Indices of the level 0 quads set since Propagate()
+    vector<bool>            marked;         // Whether a level 0 quad is in changed
+    
+    float ChildrenMax(const int &l, const int &x, const int &y) const;  // Height of block (x, y) of level l from level l-1
+};
+
+#endif
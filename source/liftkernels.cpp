@@ -0,0 +1,166 @@
+//
+//  liftkernels.cpp
+//  DGIProject
+//
+//  Batch evaluation of the control point falloff functions, a row of samples at a time.
+//  Built for SSE2 or NEON when the compiler targets them, otherwise one sample at a time, and
+//  once more for AVX2 by liftkernels_avx2.cpp.
+//
+
+#include "rangeterrain.h"
+#include "simdvec.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+namespace SIMD_NAMESPACE {
+
+/**
+ cos(x) and sin(x) for x in [0, PI/2], as Taylor polynomials in x^2 (absolute error below 1e-6 there).
+ */
+static inline VecF CosQuarter(const VecF &x) {
+    const VecF u = x * x;
+    return VecF(1.0f) + u * (VecF(-1.0f / 2) + u * (VecF(1.0f / 24) + u * (VecF(-1.0f / 720) +
+           u * (VecF(1.0f / 40320) + u * VecF(-1.0f / 3628800)))));
+}
+
+static inline VecF SinQuarter(const VecF &x) {
+    const VecF u = x * x;
+    return x * (VecF(1.0f) + u * (VecF(-1.0f / 6) + u * (VecF(1.0f / 120) + u * (VecF(-1.0f / 5040) +
+           u * (VecF(1.0f / 362880) + u * VecF(-1.0f / 39916800))))));
+}
+
+template <ControlPointFuncType functype>
+static inline VecF Falloff(const VecF &t);       // Lift relative to h, at distance t * spread
+
+template <> inline VecF Falloff<FUNC_LINEAR>(const VecF &t) {
+    return VecF(1.0f) - t;
+}
+
+template <> inline VecF Falloff<FUNC_COS>(const VecF &t) {
+    return CosQuarter(t * VecF(PI / 2));
+}
+
+template <> inline VecF Falloff<FUNC_SIN>(const VecF &t) {
+    return VecF(1.0f) - SinQuarter(t * VecF(PI / 2));
+}
+
+template <ControlPointFuncType functype>
+static void LiftRowOf(const ControlPoint &cp, const int &y, const int &min_x, const int &count, const float &gridRes, float* out) {
+
+    // The distances are compared squared, in samples, so whole vectors outside the spread skip the rest
+    const float dy = cp.y - y;
+    const VecF dy2(dy * dy);
+    const VecF radius2((cp.spread / gridRes) * (cp.spread / gridRes));
+    const VecF res(gridRes), spread(cp.spread), h(cp.h);
+
+    float tail[SIMD_WIDTH];
+    for ( int i=0; i<count; i+=SIMD_WIDTH ) {
+
+        const VecF dx = VecF(float(cp.x - min_x - i)) - VecF::Ramp();
+        const VecF d2 = dx * dx + dy2;
+        const VecF inside = VecF::LessEqual(d2, radius2);
+
+        VecF lift(0.0f);
+        if (!VecF::None(inside)) {
+            const VecF t = VecF::Sqrt(d2) * res / spread;
+            lift = VecF::Select(inside, h * Falloff<functype>(t));
+        }
+
+        // the last vector may reach past the row
+        if (i + SIMD_WIDTH <= count) {
+            lift.Store(out + i);
+        } else {
+            lift.Store(tail);
+            for ( int j=0; i+j<count; j++ )
+                out[i+j] = tail[j];
+        }
+    }
+}
+
+void LiftRow(const ControlPoint &cp, const int &y, const int &min_x, const int &count, const float &gridRes, float* out) {
+    switch (cp.functype) {
+        case FUNC_LINEAR:   LiftRowOf<FUNC_LINEAR>(cp, y, min_x, count, gridRes, out); break;
+        case FUNC_COS:      LiftRowOf<FUNC_COS>(cp, y, min_x, count, gridRes, out); break;
+        case FUNC_SIN:      LiftRowOf<FUNC_SIN>(cp, y, min_x, count, gridRes, out); break;
+    }
+}
+
+}
+
+#if !defined(SIMD_KERNELS_ONLY)
+
+#if defined(SIMD_AVX2_DISPATCH)
+namespace simd_avx2 {
+    void LiftRow(const ControlPoint &cp, const int &y, const int &min_x, const int &count, const float &gridRes, float* out);
+}
+#endif
+
+void ControlPoint::lift_row(int y, int min_x, int count, float gridRes, float* out) const {
+#if defined(SIMD_AVX2_DISPATCH)
+    if (SimdAVX2()) {
+        simd_avx2::LiftRow(*this, y, min_x, count, gridRes, out);
+        return;
+    }
+#endif
+    SIMD_NAMESPACE::LiftRow(*this, y, min_x, count, gridRes, out);
+}
+
+void TestLiftKernels() {
+
+    const char* names[] = { "linear", "cos", "sin" };
+    const float gridRes = 0.5f;
+    const int rows = 2000;
+    vector<float> row;
+
+    cout << "Lift kernels (" << SimdISA() << "), compared to ControlPoint::lift()" << endl;
+
+    for ( int f=FUNC_LINEAR; f<=FUNC_SIN; f++ ) {
+
+        // random control points, evaluated over their whole spread window
+        srand(f + 1);
+        vector<ControlPoint> cps;
+        for ( int i=0; i<rows; i++ )
+            cps.push_back(ControlPoint(rand() % 1000, rand() % 1000, (rand() % 2001 - 1000) / 10.0f, 1 + rand() % 20, (ControlPointFuncType) f));
+
+        // tolerance, relative to the height of the control point
+        float max_error = 0;
+        for ( const ControlPoint &cp : cps ) {
+            const int r = ceil(cp.spread / gridRes);
+            row.resize(2 * r + 1);
+            for ( int y=cp.y-r; y<=cp.y+r; y++ ) {
+                cp.lift_row(y, cp.x - r, 2 * r + 1, gridRes, &row[0]);
+                for ( int i=0; i<=2*r; i++ )
+                    max_error = std::max(max_error, abs(row[i] - cp.lift(cp.x - r + i, y, gridRes)) / abs(cp.h));
+            }
+        }
+
+        // throughput of the scalar path against the kernel
+        volatile float sink = 0;     // keeps the loops from being optimized away
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for ( const ControlPoint &cp : cps ) {
+            const int r = ceil(cp.spread / gridRes);
+            for ( int y=cp.y-r; y<=cp.y+r; y++ )
+                for ( int x=cp.x-r; x<=cp.x+r; x++ )
+                    sink += cp.lift(x, y, gridRes);
+        }
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for ( const ControlPoint &cp : cps ) {
+            const int r = ceil(cp.spread / gridRes);
+            for ( int y=cp.y-r; y<=cp.y+r; y++ ) {
+                cp.lift_row(y, cp.x - r, 2 * r + 1, gridRes, &row[0]);
+                sink += row[r];
+            }
+        }
+        auto t2 = std::chrono::high_resolution_clock::now();
+
+        double scalar_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        double kernel_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        cout << "  " << names[f] << ": max relative error " << max_error
+             << (max_error < 1e-5 ? " (ok)" : " (TOO LARGE)")
+             << ", scalar " << scalar_ms << " ms, kernel " << kernel_ms << " ms"
+             << " (" << scalar_ms / kernel_ms << "x)" << endl;
+    }
+}
+
+#endif
@@ -29,7 +29,7 @@
 #include <iostream>
 #include <stdexcept>
 #include <cmath>
-#include <list>
+#include <vector>
 #include <array>
 
 // tdogl classes
@@ -45,6 +45,7 @@
 #include "callbacks.h"
 #include "model.h"
 #include "difficultyanalyzer.h"
+#include "difficultymap.h"
 
 #define SCREEN_W                1024
 #define SCREEN_H                768
@@ -77,7 +78,10 @@ tdogl::Camera gCamera1; //Left camera
 tdogl::Camera gCamera2; //Right camera, overview
 
 ModelAsset gPathAsset;
-ModelAsset gTerrainModelAsset;
+ModelAsset gFlatTileAsset;                  // Drawn for terrain tiles that aren't allocated
+std::vector<ModelAsset> gTerrainTileAssets; // One per quad tile of gTerrain
+tdogl::Texture* gHeightColorTexture = NULL; // gTerrain.HeightColors() as a texture, used if they are in the shader
+tdogl::Texture* gDifficultyMapTexture = NULL; // The cells of gDifficultyMap colored, drawn over the terrain while shown
 ModelAsset gSkyboxAsset;
 ModelAsset gTeeAsset;
 ModelAsset gTargetAsset;
@@ -86,7 +90,6 @@ ModelInstance gSkyBoxInstance;
 ModelInstance gTeeInstance;
 ModelInstance gTargetInstance;
 
-std::list<ModelInstance> gInstances;
 GLfloat gDegreesRotated = 0.0f;
 
 glm::vec3 gLightPosition;
@@ -111,10 +114,10 @@ static tdogl::Program* LoadShaders(const char* vertFilename, const char* fragFil
 
 
 // returns a new tdogl::Texture created from the given filename
-static tdogl::Texture* LoadTexture(const char* filename) {
+static tdogl::Texture* LoadTexture(const char* filename, GLint wrapMode = GL_CLAMP_TO_EDGE) {
     tdogl::Bitmap bmp = tdogl::Bitmap::bitmapFromFile(ResourcePath(filename));
     bmp.flipVertically();
-    return new tdogl::Texture(bmp);
+    return new tdogl::Texture(bmp, GL_LINEAR, wrapMode);
 }
 
 //TODO set up in seperate class instead
@@ -123,49 +126,40 @@ static void createPathModel(const vec3 &tee, const vec3 &p1, const vec3 &p2, con
     float hw = 0.5f; // half hw
     const vec3 up(0,1,0);
     
-    // initial calculations to produce path of triangles
-    vec3 dir1 = glm::normalize(p1 - tee);
-    vec3 dir2 = glm::normalize(p2 - p1);
-    vec3 dir3 = glm::normalize(target - p2);
-    
-    vec3 r1 = glm::cross(dir1, up);
-    vec3 r2 = glm::cross(dir2, up);
-    vec3 r3 = glm::cross(dir3, up);
-    
-    vec3 fw1 = glm::cross(up, r1);
-//    vec3 fw2 = glm::cross(up, r2);
-    vec3 fw3 = glm::cross(up, r3);
-
-    float wAlongGround1 = glm::length(p1 - tee) * hw / p2.y;
-    float wAlongGround2 = glm::length(target - p2) * hw / p2.y;
-    
-    vec3 n_up1 = glm::cross(r1, dir1);
-    vec3 n_up2 = glm::cross(r3, dir3);
-    
-    vec3 v1_te = tee + wAlongGround1 * fw1;
-    vec3 v2_te = tee + hw * r1;
-    vec3 v3_te = tee + wAlongGround1 * -fw1;
-    vec3 v4_te = tee + hw * -r1;
-
-    vec3 v1_p1 = p1 + hw * -up;
-    vec3 v2_p1 = p1 + hw * r2;
-    vec3 v3_p1 = p1 + hw * up;
-    vec3 v4_p1 = p1 + hw * -r2;
-    
-    vec3 v1_p2 = p2 + hw * -up;
-    vec3 v2_p2 = p2 + hw * r2;
-    vec3 v3_p2 = p2 + hw * up;
-    vec3 v4_p2 = p2 + hw * -r2;
-    
-    vec3 v1_ta = target + wAlongGround2 * -fw3;
-    vec3 v2_ta = target + hw * r3;
-    vec3 v3_ta = target + wAlongGround2 * fw3;
-    vec3 v4_ta = target + hw * -r3;
+    // points along the path, the curve or the straight segments the difficulty was found for
+    const int curveSegments = 48;
+    std::vector<vec3> points;
+    if (DifficultyAnalyzer::curvedPaths) {
+        for ( int i=0; i<=curveSegments; i++ )
+            points.push_back(DifficultyAnalyzer::CurvePosition(tee, p1, p2, target, i / (float) curveSegments));
+    } else {
+        points = { tee, p1, p2, target };
+    }
+    const int segments = (int) points.size() - 1;
+    
+    // the corners of the path around each point, below, right, above and left of it, laid out along
+    // the ground at the tee and target
+    std::vector<std::array<vec3, 4> > corners(points.size()), normals(points.size());
+    for ( int i=0; i<=segments; i++ ) {
+        vec3 dir = glm::normalize(i == 0 ? points[1] - points[0] : i == segments ? points[i] - points[i-1] :
+                                  glm::normalize(points[i] - points[i-1]) + glm::normalize(points[i+1] - points[i]));
+        vec3 r = glm::normalize(glm::cross(dir, up));
+        vec3 n_up = glm::cross(r, dir);
+        normals[i] = {{ -n_up, r, n_up, -r }};
+        if (i == 0 || i == segments) {
+            vec3 fw = glm::cross(up, r);
+            float wAlongGround = hw / std::max(std::abs(dir.y), 0.05f);
+            float side = i == 0 ? 1 : -1;
+            corners[i] = {{ points[i] + side * wAlongGround * fw, points[i] + hw * r, points[i] - side * wAlongGround * fw, points[i] - hw * r }};
+        } else {
+            corners[i] = {{ points[i] - hw * n_up, points[i] + hw * r, points[i] + hw * n_up, points[i] - hw * r }};
+        }
+    }
     
     gPathAsset.shaders = LoadShaders("vertex-shader.txt", "fragment-shader.txt");
     gPathAsset.drawType = GL_TRIANGLES;
     gPathAsset.drawStart = 0;
-    gPathAsset.drawCount = 12*2*3;
+    gPathAsset.drawCount = segments*4*2*3;
     gPathAsset.texture = LoadTexture("orange.jpg");
     
     if (!gPathInitiated) {
@@ -182,122 +176,28 @@ static void createPathModel(const vec3 &tee, const vec3 &p1, const vec3 &p2, con
     // color
     vec4 c(1,0,0,1);
     
-    // make a path out of triangles
-    GLfloat vertexData[] = {
-        // X, Y, Z                           U,V     Normal                           Color
-        // tee to p1
-        // 1-2
-        v1_te.x, v1_te.y, v1_te.z,           1,1,    -n_up1.x,-n_up1.y,-n_up1.z,      c.r, c.g, c.b, c.a,
-        v1_p1.x, v1_p1.y, v1_p1.z,           1,0,    -n_up1.x,-n_up1.y,-n_up1.z,      c.r, c.g, c.b, c.a,
-        v2_p1.x, v2_p1.y, v2_p1.z,           0,0,        r1.x,    r1.y,    r1.z,      c.r, c.g, c.b, c.a,
-        
-        v1_te.x, v1_te.y, v1_te.z,           1,1,    -n_up1.x,-n_up1.y,-n_up1.z,      c.r, c.g, c.b, c.a,
-        v2_p1.x, v2_p1.y, v2_p1.z,           0,0,        r1.x,    r1.y,    r1.z,      c.r, c.g, c.b, c.a,
-        v2_te.x, v2_te.y, v2_te.z,           0,1,        r1.x,    r1.y,    r1.z,      c.r, c.g, c.b, c.a,
-        
-        // 2-3
-        v2_te.x, v2_te.y, v2_te.z,           1,1,        r1.x,    r1.y,    r1.z,      c.r, c.g, c.b, c.a,
-        v2_p1.x, v2_p1.y, v2_p1.z,           1,0,        r1.x,    r1.y,    r1.z,      c.r, c.g, c.b, c.a,
-        v3_p1.x, v3_p1.y, v3_p1.z,           0,0,     n_up1.x, n_up1.y, n_up1.z,      c.r, c.g, c.b, c.a,
-        
-        v2_te.x, v2_te.y, v2_te.z,           1,1,        r1.x,    r1.y,    r1.z,      c.r, c.g, c.b, c.a,
-        v3_p1.x, v3_p1.y, v3_p1.z,           0,0,     n_up1.x, n_up1.y, n_up1.z,      c.r, c.g, c.b, c.a,
-        v3_te.x, v3_te.y, v3_te.z,           0,1,     n_up1.x, n_up1.y, n_up1.z,      c.r, c.g, c.b, c.a,
-        
-        // 3-4
-        v3_te.x, v3_te.y, v3_te.z,           1,1,     n_up1.x, n_up1.y, n_up1.z,      c.r, c.g, c.b, c.a,
-        v3_p1.x, v3_p1.y, v3_p1.z,           1,0,     n_up1.x, n_up1.y, n_up1.z,      c.r, c.g, c.b, c.a,
-        v4_p1.x, v4_p1.y, v4_p1.z,           0,0,       -r1.x,   -r1.y,   -r1.z,      c.r, c.g, c.b, c.a,
-        
-        v3_te.x, v3_te.y, v3_te.z,           1,1,     n_up1.x, n_up1.y, n_up1.z,      c.r, c.g, c.b, c.a,
-        v4_p1.x, v4_p1.y, v4_p1.z,           0,0,       -r1.x,   -r1.y,   -r1.z,      c.r, c.g, c.b, c.a,
-        v4_te.x, v4_te.y, v4_te.z,           0,1,       -r1.x,   -r1.y,   -r1.z,      c.r, c.g, c.b, c.a,
-        
-        // 4-1
-        v4_te.x, v4_te.y, v4_te.z,           1,1,       -r1.x,   -r1.y,   -r1.z,      c.r, c.g, c.b, c.a,
-        v4_p1.x, v4_p1.y, v4_p1.z,           1,0,       -r1.x,   -r1.y,   -r1.z,      c.r, c.g, c.b, c.a,
-        v1_p1.x, v1_p1.y, v1_p1.z,           0,0,    -n_up1.x,-n_up1.y,-n_up1.z,      c.r, c.g, c.b, c.a,
-        
-        v4_te.x, v4_te.y, v4_te.z,           1,1,       -r1.x,   -r1.y,   -r1.z,      c.r, c.g, c.b, c.a,
-        v1_p1.x, v1_p1.y, v1_p1.z,           0,0,    -n_up1.x,-n_up1.y,-n_up1.z,      c.r, c.g, c.b, c.a,
-        v1_te.x, v1_te.y, v1_te.z,           0,1,    -n_up1.x,-n_up1.y,-n_up1.z,      c.r, c.g, c.b, c.a,
-        
-        // p1 to p2
-        // 1-2
-        v1_p1.x, v1_p1.y, v1_p1.z,           1,1,       -up.x,   -up.y,   -up.z,      c.r, c.g, c.b, c.a,
-        v1_p2.x, v1_p2.y, v1_p2.z,           1,0,       -up.x,   -up.y,   -up.z,      c.r, c.g, c.b, c.a,
-        v2_p2.x, v2_p2.y, v2_p2.z,           0,0,        r2.x,    r2.y,    r2.z,      c.r, c.g, c.b, c.a,
-        
-        v1_p1.x, v1_p1.y, v1_p1.z,           1,1,       -up.x,   -up.y,   -up.z,      c.r, c.g, c.b, c.a,
-        v2_p2.x, v2_p2.y, v2_p2.z,           0,0,        r2.x,    r2.y,    r2.z,      c.r, c.g, c.b, c.a,
-        v2_p1.x, v2_p1.y, v2_p1.z,           0,1,        r2.x,    r2.y,    r2.z,      c.r, c.g, c.b, c.a,
-        
-        // 2-3
-        v2_p1.x, v2_p1.y, v2_p1.z,           1,1,        r2.x,    r2.y,    r2.z,      c.r, c.g, c.b, c.a,
-        v2_p2.x, v2_p2.y, v2_p2.z,           1,0,        r2.x,    r2.y,    r2.z,      c.r, c.g, c.b, c.a,
-        v3_p2.x, v3_p2.y, v3_p2.z,           0,0,        up.x,    up.y,    up.z,      c.r, c.g, c.b, c.a,
-        
-        v2_p1.x, v2_p1.y, v2_p1.z,           1,1,        r2.x,    r2.y,    r2.z,      c.r, c.g, c.b, c.a,
-        v3_p2.x, v3_p2.y, v3_p2.z,           0,0,        up.x,    up.y,    up.z,      c.r, c.g, c.b, c.a,
-        v3_p1.x, v3_p1.y, v3_p1.z,           0,1,        up.x,    up.y,    up.z,      c.r, c.g, c.b, c.a,
-        
-        // 3-4
-        v3_p1.x, v3_p1.y, v3_p1.z,           1,1,        up.x,    up.y,    up.z,      c.r, c.g, c.b, c.a,
-        v3_p2.x, v3_p2.y, v3_p2.z,           1,0,        up.x,    up.y,    up.z,      c.r, c.g, c.b, c.a,
-        v4_p2.x, v4_p2.y, v4_p2.z,           0,0,       -r2.x,   -r2.y,   -r2.z,      c.r, c.g, c.b, c.a,
-        
-        v3_p1.x, v3_p1.y, v3_p1.z,           1,1,        up.x,    up.y,    up.z,      c.r, c.g, c.b, c.a,
-        v4_p2.x, v4_p2.y, v4_p2.z,           0,0,       -r2.x,   -r2.y,   -r2.z,      c.r, c.g, c.b, c.a,
-        v4_p1.x, v4_p1.y, v4_p1.z,           0,1,       -r2.x,   -r2.y,   -r2.z,      c.r, c.g, c.b, c.a,
-        
-        // 4-1
-        v4_p1.x, v4_p1.y, v4_p1.z,           1,1,       -r2.x,   -r2.y,   -r2.z,      c.r, c.g, c.b, c.a,
-        v4_p2.x, v4_p2.y, v4_p2.z,           1,0,       -r2.x,   -r2.y,   -r2.z,      c.r, c.g, c.b, c.a,
-        v1_p2.x, v1_p2.y, v1_p2.z,           0,0,       -up.x,   -up.y,   -up.z,      c.r, c.g, c.b, c.a,
-        
-        v4_p1.x, v4_p1.y, v4_p1.z,           1,1,       -r2.x,   -r2.y,   -r2.z,      c.r, c.g, c.b, c.a,
-        v1_p2.x, v1_p2.y, v1_p2.z,           0,0,       -up.x,   -up.y,   -up.z,      c.r, c.g, c.b, c.a,
-        v1_p1.x, v1_p1.y, v1_p1.z,           0,1,       -up.x,   -up.y,   -up.z,      c.r, c.g, c.b, c.a,
-
-        // p2 to target
-        // 1-2
-        v1_p2.x, v1_p2.y, v1_p2.z,           1,1,    -n_up2.x,-n_up2.y,-n_up2.z,      c.r, c.g, c.b, c.a,
-        v1_ta.x, v1_ta.y, v1_ta.z,           1,0,    -n_up2.x,-n_up2.y,-n_up2.z,      c.r, c.g, c.b, c.a,
-        v2_ta.x, v2_ta.y, v2_ta.z,           0,0,        r3.x,    r3.y,    r3.z,      c.r, c.g, c.b, c.a,
-        
-        v1_p2.x, v1_p2.y, v1_p2.z,           1,1,    -n_up2.x,-n_up2.y,-n_up2.z,      c.r, c.g, c.b, c.a,
-        v2_ta.x, v2_ta.y, v2_ta.z,           0,0,        r3.x,    r3.y,    r3.z,      c.r, c.g, c.b, c.a,
-        v2_p2.x, v2_p2.y, v2_p2.z,           0,1,        r3.x,    r3.y,    r3.z,      c.r, c.g, c.b, c.a,
-        
-        // 2-3
-        v2_p2.x, v2_p2.y, v2_p2.z,           1,1,        r3.x,    r3.y,    r3.z,      c.r, c.g, c.b, c.a,
-        v2_ta.x, v2_ta.y, v2_ta.z,           1,0,        r3.x,    r3.y,    r3.z,      c.r, c.g, c.b, c.a,
-        v3_ta.x, v3_ta.y, v3_ta.z,           0,0,     n_up2.x, n_up2.y, n_up2.z,      c.r, c.g, c.b, c.a,
-        
-        v2_p2.x, v2_p2.y, v2_p2.z,           1,1,        r3.x,    r3.y,    r3.z,      c.r, c.g, c.b, c.a,
-        v3_ta.x, v3_ta.y, v3_ta.z,           0,0,     n_up2.x, n_up2.y, n_up2.z,      c.r, c.g, c.b, c.a,
-        v3_p2.x, v3_p2.y, v3_p2.z,           0,1,     n_up2.x, n_up2.y, n_up2.z,      c.r, c.g, c.b, c.a,
-        
-        // 3-4
-        v3_p2.x, v3_p2.y, v3_p2.z,           1,1,     n_up2.x, n_up2.y, n_up2.z,      c.r, c.g, c.b, c.a,
-        v3_ta.x, v3_ta.y, v3_ta.z,           1,0,     n_up2.x, n_up2.y, n_up2.z,      c.r, c.g, c.b, c.a,
-        v4_ta.x, v4_ta.y, v4_ta.z,           0,0,       -r3.x,   -r3.y,   -r3.z,      c.r, c.g, c.b, c.a,
-        
-        v3_p2.x, v3_p2.y, v3_p2.z,           1,1,     n_up2.x, n_up2.y, n_up2.z,      c.r, c.g, c.b, c.a,
-        v4_ta.x, v4_ta.y, v4_ta.z,           0,0,       -r3.x,   -r3.y,   -r3.z,      c.r, c.g, c.b, c.a,
-        v4_p2.x, v4_p2.y, v4_p2.z,           0,1,       -r3.x,   -r3.y,   -r3.z,      c.r, c.g, c.b, c.a,
-        
-        // 4-1
-        v4_p2.x, v4_p2.y, v4_p2.z,           1,1,       -r3.x,   -r3.y,   -r3.z,      c.r, c.g, c.b, c.a,
-        v4_ta.x, v4_ta.y, v4_ta.z,           1,0,       -r3.x,   -r3.y,   -r3.z,      c.r, c.g, c.b, c.a,
-        v1_ta.x, v1_ta.y, v1_ta.z,           0,0,    -n_up2.x,-n_up2.y,-n_up2.z,      c.r, c.g, c.b, c.a,
-        
-        v4_p2.x, v4_p2.y, v4_p2.z,           1,1,       -r3.x,   -r3.y,   -r3.z,      c.r, c.g, c.b, c.a,
-        v1_ta.x, v1_ta.y, v1_ta.z,           0,0,    -n_up2.x,-n_up2.y,-n_up2.z,      c.r, c.g, c.b, c.a,
-        v1_p2.x, v1_p2.y, v1_p2.z,           0,1,    -n_up2.x,-n_up2.y,-n_up2.z,      c.r, c.g, c.b, c.a,
+    // make a path out of triangles, four sides between every two points
+    std::vector<GLfloat> vertexData;
+    vertexData.reserve(gPathAsset.drawCount * 12);
+    auto AddVertex = [&] (const int &i, const int &k, const float &u, const float &v) {
+        const vec3 &p = corners[i][k], &n = normals[i][k];
+        // X, Y, Z     U,V     Normal     Color
+        vertexData.insert(vertexData.end(), { p.x, p.y, p.z,    u, v,    n.x, n.y, n.z,    c.r, c.g, c.b, c.a });
     };
+    for ( int i=0; i<segments; i++ ) {
+        for ( int k=0; k<4; k++ ) {
+            const int l = (k + 1) % 4;
+            AddVertex(i, k, 1, 1);
+            AddVertex(i+1, k, 1, 0);
+            AddVertex(i+1, l, 0, 0);
+            
+            AddVertex(i, k, 1, 1);
+            AddVertex(i+1, l, 0, 0);
+            AddVertex(i, l, 0, 1);
+        }
+    }
     
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertexData), vertexData, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(GLfloat), vertexData.data(), GL_STATIC_DRAW);
     
     if (!gPathInitiated) {
         // connect the xyz to the "vert" attribute of the vertex shader
@@ -628,30 +528,45 @@ static void initSkyBox() {
  glBindVertexArray(0);
  }*/
 
-static void UpdateUsingMapBuffer(const ModelAsset &asset, GLfloat* data, vector<int> &indices, const int &floatsPerVertex) {
+static void UpdateUsingMapBuffer(const ModelAsset &asset, const TerrainVertex* data, vector<int> &indices) {
     
     // bind the VBO
     glBindBuffer(GL_ARRAY_BUFFER, asset.vbo);
-    GLfloat* buf = (GLfloat*) glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+    TerrainVertex* buf = (TerrainVertex*) glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
     
     for (int &idx : indices)
-        memcpy(buf + idx, data + idx, floatsPerVertex * sizeof(GLfloat));
+        buf[idx] = data[idx];
     
     // bind the VBO
     glUnmapBuffer(GL_ARRAY_BUFFER);
 }
 
-static void LoadAsset(ModelAsset &asset, const int &floatsPerVertex) {
-    asset.shaders = LoadShaders("vertex-shader.txt", "fragment-shader.txt");
+static void UpdateIndicesUsingMapBuffer(const ModelAsset &asset, GLushort* data, vector<int> &indices, const int &indicesPerQuad) {
+    
+    // bind the IBO (through the VAO, which holds it)
+    glBindVertexArray(asset.vao);
+    GLushort* buf = (GLushort*) glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY);
+    
+    for (int &idx : indices)
+        memcpy(buf + idx, data + idx, indicesPerQuad * sizeof(GLushort));
+    
+    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    glBindVertexArray(0);
+}
+
+// loads the indexed mesh of one terrain tile, shaders and texture are shared and must be set beforehand
+static void LoadAsset(ModelAsset &asset, const TerrainVertex* data, const GLushort* indices) {
     asset.drawType = GL_TRIANGLES;
     asset.drawStart = 0;
-    asset.drawCount = (X_INTERVAL - 1) * (Y_INTERVAL - 1) * 6;
-    asset.texture = LoadTexture("grass.png");
+    asset.drawCount = INDICES_PER_TILE;
     asset.shininess = 80.0;
     asset.specularColor = glm::vec3(1.0f, 1.0f, 1.0f);
     
-    glGenBuffers(1, &asset.vbo);
-    glGenVertexArrays(1, &asset.vao);
+    if (!asset.vbo) {
+        glGenBuffers(1, &asset.vbo);
+        glGenBuffers(1, &asset.ibo);
+        glGenVertexArrays(1, &asset.vao);
+    }
     
     // bind the VAO
     glBindVertexArray(asset.vao);
@@ -660,28 +575,164 @@ static void LoadAsset(ModelAsset &asset, const int &floatsPerVertex) {
     glBindBuffer(GL_ARRAY_BUFFER, asset.vbo);
     
     // write initial data
-    glBufferData(GL_ARRAY_BUFFER, asset.drawCount * floatsPerVertex*sizeof(GLfloat), gTerrain.vertexData, GL_DYNAMIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, VERTICES_PER_TILE * sizeof(TerrainVertex), data, GL_DYNAMIC_DRAW);
     
-    // connect the xyz to the "vert" attribute of the vertex shader
-    glEnableVertexAttribArray(asset.shaders->attrib("vert"));
-    glVertexAttribPointer(asset.shaders->attrib("vert"), 3, GL_FLOAT, GL_FALSE, floatsPerVertex*sizeof(GLfloat), NULL);
+    // bind the IBO (stored in the VAO) and write the initial indices
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, asset.ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, asset.drawCount * sizeof(GLushort), indices, GL_DYNAMIC_DRAW);
     
-    // connect the uv coords to the "vertTexCoord" attribute of the vertex shader
-    glEnableVertexAttribArray(asset.shaders->attrib("vertTexCoord"));
-    glVertexAttribPointer(asset.shaders->attrib("vertTexCoord"), 2, GL_FLOAT, GL_FALSE, floatsPerVertex*sizeof(GLfloat), (const GLvoid*)(3 * sizeof(GLfloat)));
+    // the position and uv coords are implicit in the vertex index, see terrain-vertex-shader.txt
     
-    // connect the normal to the "vertNormal" attribute of the vertex shader
+    // connect the quantized height to the "vertHeight" attribute of the vertex shader
+    glEnableVertexAttribArray(asset.shaders->attrib("vertHeight"));
+    glVertexAttribPointer(asset.shaders->attrib("vertHeight"), 1, GL_SHORT, GL_FALSE, sizeof(TerrainVertex), (const GLvoid*)offsetof(TerrainVertex, height));
+    
+    // connect the oct encoded normal to the "vertNormal" attribute of the vertex shader
     glEnableVertexAttribArray(asset.shaders->attrib("vertNormal"));
-    glVertexAttribPointer(asset.shaders->attrib("vertNormal"), 3, GL_FLOAT, GL_TRUE, floatsPerVertex*sizeof(GLfloat), (const GLvoid*)(5 * sizeof(GLfloat)));
+    glVertexAttribPointer(asset.shaders->attrib("vertNormal"), 2, GL_SHORT, GL_TRUE, sizeof(TerrainVertex), (const GLvoid*)offsetof(TerrainVertex, normal));
     
-    // connect the normal to the "vertNormal" attribute of the vertex shader
+    // connect the color to the "vertColor" attribute of the vertex shader
     glEnableVertexAttribArray(asset.shaders->attrib("vertColor"));
-    glVertexAttribPointer(asset.shaders->attrib("vertColor"), 4, GL_FLOAT, GL_FALSE,  floatsPerVertex*sizeof(GLfloat), (const GLvoid*)(8 * sizeof(GLfloat)));
+    glVertexAttribPointer(asset.shaders->attrib("vertColor"), 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(TerrainVertex), (const GLvoid*)offsetof(TerrainVertex, color));
     
     // unbind the VAO
     glBindVertexArray(0);
 }
 
+static void ReleaseAsset(ModelAsset &asset) {
+    if (asset.vbo) {
+        glDeleteBuffers(1, &asset.vbo);
+        glDeleteBuffers(1, &asset.ibo);
+        glDeleteVertexArrays(1, &asset.vao);
+        asset.vbo = 0;
+        asset.ibo = 0;
+        asset.vao = 0;
+    }
+}
+
+// uploads the vertices and indices of the terrain tiles that changed since last time
+static void UpdateTerrainTiles() {
+    
+    for (const xy &t : gTerrain.ChangedTiles()) {
+        
+        TerrainTile* tile = gTerrain.TileAt(t.x, t.y);
+        ModelAsset &asset = gTerrainTileAssets[t.y * gTerrain.QuadTilesX() + t.x];
+        
+        if (!asset.vbo) {
+            // first time the tile has vertex data of its own
+            asset.shaders = gFlatTileAsset.shaders;
+            asset.texture = gFlatTileAsset.texture;
+            LoadAsset(asset, tile->vertexData, tile->indexData);
+        } else {
+            UpdateUsingMapBuffer(asset, tile->vertexData, tile->changedVertexIndices);
+            if (!tile->changedQuadIndices.empty())
+                UpdateIndicesUsingMapBuffer(asset, tile->indexData, tile->changedQuadIndices, INDICES_PER_QUAD);
+        }
+        tile->changedVertexIndices.clear();
+        tile->changedQuadIndices.clear();
+    }
+    
+    gTerrain.ResetChangedTiles();
+}
+
+// uploads the colors of the cells of gDifficultyMap computed since last time
+static void UpdateDifficultyMapTexture() {
+    
+    const vector<int> &cells = gDifficultyMap.ChangedCells();
+    if (cells.empty())
+        return;
+    
+    const int cellsX = gDifficultyMap.CellsX(), cellsY = gDifficultyMap.CellsY();
+    auto ColorRows = [&] (const int &y0, const int &y1, vector<unsigned char> &pixels) {
+        pixels.resize((y1 - y0) * cellsX * 4);
+        for (int cy = y0; cy < y1; cy++)
+            for (int cx = 0; cx < cellsX; cx++) {
+                const vec4 color = gDifficultyMap.CellColor(cx, cy);
+                for (int c = 0; c < 4; c++)
+                    pixels[((cy - y0) * cellsX + cx) * 4 + c] = (unsigned char) round(glm::clamp(color[c], 0.0f, 1.0f) * 255);
+            }
+    };
+    
+    vector<unsigned char> pixels;
+    if (!gDifficultyMapTexture || gDifficultyMapTexture->originalWidth() != cellsX || gDifficultyMapTexture->originalHeight() != cellsY) {
+        // a cell per texel, row cy at v = cy
+        ColorRows(0, cellsY, pixels);
+        delete gDifficultyMapTexture;
+        gDifficultyMapTexture = new tdogl::Texture(tdogl::Bitmap(cellsX, cellsY, tdogl::Bitmap::Format_RGBA, &pixels[0]), GL_NEAREST, GL_CLAMP_TO_EDGE);
+    } else {
+        // the rows of the changed cells
+        int y0 = cellsY, y1 = 0;
+        for (const int &c : cells) {
+            y0 = std::min(y0, c / cellsX);
+            y1 = std::max(y1, c / cellsX + 1);
+        }
+        ColorRows(y0, y1, pixels);
+        glBindTexture(GL_TEXTURE_2D, gDifficultyMapTexture->object());
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0, cellsX, y1 - y0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    
+    gDifficultyMap.ResetChangedCells();
+}
+
+static void SetupCameras() {
+    
+    const float width = gTerrain.Width(), depth = gTerrain.Depth();
+    
+    // setup gCamera1 (left camera)
+    gCamera1.setPosition(glm::vec3(width / 2, 10, 0));
+    gCamera1.setViewportAspectRatio(gLeftCameraFullscreen ? 2 : 1);
+    gCamera1.setNearAndFarPlanes(0.5f, std::max(1000.0f, 2 * width));
+    gCamera1.lookAt(glm::vec3(width / 2, 0, -depth / 2));
+    
+    // setup gCamera2 (right camera)
+    gCamera2.setPosition(glm::vec3(width / 2, 100, -depth / 2));
+    gCamera2.setOrtho(-width / 2 - width * ORTHO_RELATIVE_MARGIN,
+                      width / 2 + width * ORTHO_RELATIVE_MARGIN,
+                      -depth / 2 - width * ORTHO_RELATIVE_MARGIN,
+                      depth / 2 + width * ORTHO_RELATIVE_MARGIN,
+                      0.5f,
+                      200.0f);
+    gCamera2.SetAboveMode(true);
+    
+    // setup gLight
+    gLightPosition = glm::vec3(width / 2, 50, -depth / 2);
+}
+
+// resizes the terrain (flattening it) and everything depending on its size, called from the tweakbar too
+void ResizeTerrain(const int &interval, const float &gridRes) {
+    
+    for (ModelAsset &asset : gTerrainTileAssets)
+        ReleaseAsset(asset);
+    
+    gTerrain.Resize(interval, interval, gridRes);
+    gRangeDrawer.Resize();
+    gPathShouldBeDrawn = false;
+    
+    // the flat tile depends on the grid resolution
+    LoadAsset(gFlatTileAsset, gTerrain.FlatTileVertexData(), gTerrain.FlatTileIndexData());
+    gTerrainTileAssets.assign(gTerrain.QuadTilesX() * gTerrain.QuadTilesY(), ModelAsset());
+    
+    SetupCameras();
+}
+
+// changes the height colors of the terrain, called from the tweakbar too
+void SetHeightColors(const float &minHeight, const float &maxHeight, const bool &inShader) {
+    
+    gTerrain.SetHeightColors(minHeight, maxHeight, inShader);
+    
+    // the flat tile has the color of height 0
+    LoadAsset(gFlatTileAsset, gTerrain.FlatTileVertexData(), gTerrain.FlatTileIndexData());
+    
+    // the ramp as a COLOR_RAMP_SIZE x 1 texture, for the fragment shader
+    unsigned char pixels[COLOR_RAMP_SIZE * 4];
+    for (int i = 0; i < COLOR_RAMP_SIZE; i++)
+        for (int c = 0; c < 4; c++)
+            pixels[i * 4 + c] = (unsigned char) round(glm::clamp(gTerrain.HeightColors().table[i][c], 0.0f, 1.0f) * 255);
+    
+    delete gHeightColorTexture;
+    gHeightColorTexture = new tdogl::Texture(tdogl::Bitmap(COLOR_RAMP_SIZE, 1, tdogl::Bitmap::Format_RGBA, pixels), GL_LINEAR, GL_CLAMP_TO_EDGE);
+}
 
 // convenience function that returns a translation matrix
 glm::mat4 translate(GLfloat x, GLfloat y, GLfloat z) {
@@ -857,10 +908,9 @@ static void RenderSkyBox() {
     shaders->stopUsing();
 }
 
-//renders a single `ModelInstance`
-static void RenderInstance(const ModelInstance& inst, tdogl::Camera& camera, bool ortho) {
-    ModelAsset* asset = inst.asset;
-    tdogl::Program* shaders = asset->shaders;
+//renders the terrain, one tile at a time
+static void RenderTerrain(tdogl::Camera& camera, bool ortho) {
+    tdogl::Program* shaders = gFlatTileAsset.shaders;
     
     //bind the shaders
     shaders->use();
@@ -875,7 +925,6 @@ static void RenderInstance(const ModelInstance& inst, tdogl::Camera& camera, boo
         shaders->setUniform("useColor", gLeftCameraUseColor);
         shaders->setUniform("monotoneLight", false);
     }
-    shaders->setUniform("model", inst.transform);
     shaders->setUniform("materialTex", 0); //set to 0 because the texture will be bound to GL_TEXTURE0
     //    shaders->setUniform("materialShininess", asset->shininess);
     //    shaders->setUniform("materialSpecularColor", asset->specularColor);
@@ -885,17 +934,57 @@ static void RenderInstance(const ModelInstance& inst, tdogl::Camera& camera, boo
     shaders->setUniform("light.ambientCoefficient", gLightAmbientCoefficient);
     shaders->setUniform("cameraPosition", camera.position());
     
-    //bind the texture
+    // for unpacking the vertices
+    shaders->setUniform("gridRes", gTerrain.GridRes());
+    shaders->setUniform("heightQuantum", HEIGHT_QUANTUM);
+    shaders->setUniform("tileVerticesX", TILE_VERTICES_X);
+    
+    // for coloring by height in the fragment shader
+    const ColorRamp &ramp = gTerrain.HeightColors();
+    shaders->setUniform("heightColorInShader", gTerrain.HeightColorInShader());
+    shaders->setUniform("heightColorTex", 1);
+    shaders->setUniform("heightColorMin", ramp.minHeight);
+    shaders->setUniform("heightColorMax", ramp.maxHeight);
+    shaders->setUniform("heightColorSize", (float) COLOR_RAMP_SIZE);
+    
+    // for drawing the difficulty map over the colors
+    const bool difficultyMapShown = gRangeDrawer.DifficultyMapShown() && gDifficultyMap.Computed() && gDifficultyMapTexture;
+    shaders->setUniform("difficultyMapShown", difficultyMapShown);
+    shaders->setUniform("difficultyMapTex", 2);
+    shaders->setUniform("difficultyMapCells", (float) gDifficultyMap.CellsX(), (float) gDifficultyMap.CellsY());
+    shaders->setUniform("difficultyMapStep", (float) gDifficultyMap.Step());
+    
+    //bind the textures
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, difficultyMapShown ? gDifficultyMapTexture->object() : 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, gHeightColorTexture->object());
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, asset->texture->object());
+    glBindTexture(GL_TEXTURE_2D, gFlatTileAsset.texture->object());
     
-    //bind VAO and draw
-    glBindVertexArray(asset->vao);
-    glDrawArrays(asset->drawType, asset->drawStart, asset->drawCount);
+    for (int ty = 0; ty < gTerrain.QuadTilesY(); ty++) {
+        for (int tx = 0; tx < gTerrain.QuadTilesX(); tx++) {
+            
+            // tiles without vertex data of their own are flat
+            const ModelAsset* asset = &gTerrainTileAssets[ty * gTerrain.QuadTilesX() + tx];
+            if (!asset->vbo)
+                asset = &gFlatTileAsset;
+            
+            // the vertex positions are relative to the tile origin
+            shaders->setUniform("model", glm::translate(glm::mat4(), gTerrain.TileOrigin(tx, ty)));
+            
+            //bind VAO (with the IBO) and draw
+            glBindVertexArray(asset->vao);
+            glDrawElements(asset->drawType, asset->drawCount, GL_UNSIGNED_SHORT, NULL);
+        }
+    }
     
     //unbind everything
     glBindVertexArray(0);
     glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
     shaders->stopUsing();
 }
 
@@ -936,13 +1025,10 @@ static void Render() {
                 RenderPath();
         }
         
-        std::list<ModelInstance>::const_iterator it;
-        for(it = gInstances.begin(); it != gInstances.end(); ++it){
-            if (i == 0 || gLeftCameraFullscreen) {
-                RenderInstance(*it, gCamera1, false);
-            } else {
-                RenderInstance(*it, gCamera2, true); // Render second viewport with 2D projection matrix
-            }
+        if (i == 0 || gLeftCameraFullscreen) {
+            RenderTerrain(gCamera1, false);
+        } else {
+            RenderTerrain(gCamera2, true); // Render second viewport with 2D projection matrix
         }
     }
         
@@ -1002,9 +1088,12 @@ static void Update(const float &dt) {
     
     // Adjust to terrain and marking changes
     if (gTerrain.VertexChanged() || gRangeDrawer.MarkChanged()) {
+        if (gRangeDrawer.DifficultyMapShown()) {
+            gDifficultyMap.Update(gRangeDrawer.TeeTerrainPos());
+            UpdateDifficultyMapTexture();
+        }
         gRangeDrawer.MarkTerrain();
-        UpdateUsingMapBuffer(gTerrainModelAsset, gTerrain.vertexData, gTerrain.changedVertexIndices, FLOATS_PER_VERTEX);
-        gTerrain.changedVertexIndices.clear();
+        UpdateTerrainTiles();
     }
     
     // Update ballpath
@@ -1031,8 +1120,8 @@ static void Update(const float &dt) {
             x -= margin_px;
             y -= margin_px;
             
-            float terrain_x = TERRAIN_WIDTH * x / terrain_side_px;
-            float terrain_y = TERRAIN_DEPTH * y / terrain_side_px;
+            float terrain_x = gTerrain.Width() * x / terrain_side_px;
+            float terrain_y = gTerrain.Depth() * y / terrain_side_px;
 
             gRangeDrawer.TerrainCoordClicked(terrain_x, terrain_y, gShiftDown);
             
@@ -1104,30 +1193,17 @@ void AppMain(int argc, char *argv[]) {
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS);
     
-    // initialise the terrain asset
-    LoadAsset(gTerrainModelAsset, FLOATS_PER_VERTEX);
-    ModelInstance instance;
-    instance.asset = &gTerrainModelAsset;
-    gInstances.push_back(instance);
+    // terrain size and resolution may be given as arguments (glutInit removed its own)
+    int interval = argc > 1 ? atoi(argv[1]) : DEFAULT_INTERVAL;
+    float gridRes = argc > 2 ? atof(argv[2]) : DEFAULT_GRID_RES;
     
-    // setup gCamera1 (left camera)
-    gCamera1.setPosition(glm::vec3(TERRAIN_WIDTH / 2, 10, 0));
-    gCamera1.setViewportAspectRatio(gLeftCameraFullscreen ? 2 : 1);
-    gCamera1.setNearAndFarPlanes(0.5f, 1000.0f);
-    gCamera1.lookAt(glm::vec3(TERRAIN_WIDTH / 2, 0, -TERRAIN_DEPTH / 2));
-    
-    // setup gCamera2 (right camera)
-    gCamera2.setPosition(glm::vec3(TERRAIN_WIDTH / 2, 100, -TERRAIN_DEPTH / 2));
-    gCamera2.setOrtho(-TERRAIN_WIDTH / 2 - TERRAIN_WIDTH * ORTHO_RELATIVE_MARGIN,
-                      TERRAIN_WIDTH / 2 + TERRAIN_WIDTH * ORTHO_RELATIVE_MARGIN,
-                      -TERRAIN_DEPTH / 2 - TERRAIN_WIDTH * ORTHO_RELATIVE_MARGIN,
-                      TERRAIN_DEPTH / 2 + TERRAIN_WIDTH * ORTHO_RELATIVE_MARGIN,
-                      0.5f,
-                      200.0f);
-    gCamera2.SetAboveMode(true);
+    // initialise the terrain assets and everything depending on the terrain size
+    gFlatTileAsset.shaders = LoadShaders("terrain-vertex-shader.txt", "fragment-shader.txt");
+    gFlatTileAsset.texture = LoadTexture("grass.png", GL_REPEAT); // texture coordinates are sample coordinates
+    ResizeTerrain(interval, gridRes);
+    SetHeightColors(gTerrain.HeightColors().minHeight, gTerrain.HeightColors().maxHeight, false);
     
     // setup gLight
-    gLightPosition = glm::vec3(TERRAIN_WIDTH / 2, 50, -TERRAIN_DEPTH / 2);
     gLightIntensities = glm::vec3(1,1,1); //white
     gLightAttenuation = 0.00001f;
     gLightAmbientCoefficient = 0.080f;
@@ -21,7 +21,8 @@
  - a texture
  - a VBO
  - a VAO
- - the parameters to glDrawArrays (drawType, drawStart, drawCount)
+ - an IBO (optional, 0 if the asset isn't indexed)
+ - the parameters to glDrawArrays/glDrawElements (drawType, drawStart, drawCount)
  */
 struct ModelAsset {
     tdogl::Program* shaders;
@@ -30,6 +31,7 @@ struct ModelAsset {
     tdogl::Texture* skyboxTextures[6];
     GLuint vbo;
     GLuint vao;
+    GLuint ibo;
     GLenum drawType;
     GLint drawStart;
     GLint drawCount;
@@ -41,6 +43,7 @@ struct ModelAsset {
     texture(NULL),
     vbo(0),
     vao(0),
+    ibo(0),
     drawType(GL_TRIANGLES),
     drawStart(0),
     drawCount(0),
@@ -0,0 +1,218 @@
+//
+//  noisekernels.cpp
+//  DGIProject
+//
+//  Single precision version of PerlinNoise::GetHeights(), evaluating a vector of samples
+//  of a row at a time (8 with AVX2 or NEON, 4 with SSE2, see simdvec.h). The rows are built
+//  once more for AVX2 by noisekernels_avx2.cpp.
+//
+
+#include "perlinnoise.h"
+#include "simdvec.h"
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace SIMD_NAMESPACE {
+
+// PerlinNoise::GenNoise() for a vector of lattice points n = x + y * 57
+static inline VecF NoiseVec(const VecI &n0)
+{
+    VecI n = (n0 << 13) ^ n0;
+    VecI t = (n * (n * n * VecI(15731) + VecI(789221)) + VecI(1376312589)) & VecI(0x7fffffff);
+    return VecF(1.0f) - VecI::ToFloat(t) * VecF(0.931322574615478515625e-9f);
+}
+
+static inline VecF Lerp(const VecF &a, const VecF &b, const VecF &mu)
+{
+    return a + (b - a) * mu;
+}
+
+// The rows of GetHeightsFloat(), given the lattice cells and weights along a row (padded per
+// octave) and across it (per row and octave), summing the octaves of a row in heights
+void NoiseRows(const int32_t* Yint, const float* Ymu, const int32_t* Xint, const float* Xmu, const float* amps,
+               int octaves, int padded, int width, int height, float amplitude, float* heights, float* out)
+{
+    for(int r = 0; r < height; r++)
+    {
+        for(int c = 0; c < padded; c++)
+            heights[c] = 0.0f;
+    
+        for(int i = 0; i < octaves; i++)
+        {
+            VecI X(Xint[r * octaves + i]);
+            VecF mu(Xmu[r * octaves + i]);
+            VecF amp(amps[i]);
+    
+            for(int c = 0; c < padded; c += SIMD_WIDTH)
+            {
+                // noise of the 4 x 4 lattice points around the cell, as in GetValue()
+                VecI n = X + VecI::Load(&Yint[i * padded + c]) * VecI(57);
+                VecF g[4][4];
+                for(int dx = 0; dx < 4; dx++)
+                    for(int dy = 0; dy < 4; dy++)
+                        g[dx][dy] = NoiseVec(n + VecI((dx - 1) + (dy - 1) * 57));
+    
+                // smoothed noise of the four corners
+                VecF s[2][2];
+                for(int a = 0; a < 2; a++)
+                    for(int b = 0; b < 2; b++)
+                        s[a][b] = VecF(0.0625f) * (g[a][b] + g[a+2][b] + g[a][b+2] + g[a+2][b+2])
+                                + VecF(0.125f) * (g[a][b+1] + g[a+2][b+1] + g[a+1][b] + g[a+1][b+2])
+                                + VecF(0.25f) * g[a+1][b+1];
+    
+                VecF row1 = Lerp(s[0][0], s[1][0], mu);
+                VecF row2 = Lerp(s[0][1], s[1][1], mu);
+                VecF value = Lerp(row1, row2, VecF::Load(&Ymu[i * padded + c]));
+                (VecF::Load(&heights[c]) + value * amp).Store(&heights[c]);
+            }
+        }
+    
+        for(int c = 0; c < width; c++)
+            out[r * width + c] = heights[c] * amplitude;
+    }
+}
+
+}
+
+#if !defined(SIMD_KERNELS_ONLY)
+
+#if defined(SIMD_AVX2_DISPATCH)
+namespace simd_avx2
+{
+    void NoiseRows(const int32_t* Yint, const float* Ymu, const int32_t* Xint, const float* Xmu, const float* amps,
+                   int octaves, int padded, int width, int height, float amplitude, float* heights, float* out);
+}
+#endif
+
+void PerlinNoise::GetHeightsFloat(int x0, int y0, int width, int height, float* out, NoiseEngine engine) const
+{
+    /*
+     The lattice cell and interpolation weight along a row are the same for every row, and are
+     computed once per octave, as is the weight across the row for every row. Both in double
+     precision like GetHeight(), so only the noise, smoothing and interpolation are in single
+     precision. Rows are padded to whole vectors of any width by repeating the last sample.
+     */
+    const int padded = (width + SIMD_MAX_WIDTH - 1) / SIMD_MAX_WIDTH * SIMD_MAX_WIDTH;
+    
+    auto Weight = [&] (double mu) -> float
+    {
+        switch (engine)
+        {
+            case NOISE_FLOAT_SMOOTHSTEP:  return mu * mu * (3 - 2 * mu);
+            case NOISE_FLOAT_QUINTIC:     return mu * mu * mu * (mu * (mu * 6 - 15) + 10);
+            default:                        return CosineWeight(mu);
+        }
+    };
+    
+    vector<double> freqs(octaves);
+    vector<float> amps(octaves);
+    vector<int32_t> Yint(octaves * padded);
+    vector<float> Ymu(octaves * padded);
+    double _changing_amp = 1;
+    double _freq = frequency;
+    for(int i = 0; i < octaves; i++)
+    {
+        freqs[i] = _freq;
+        amps[i] = _changing_amp;
+        for(int c = 0; c < padded; c++)
+        {
+            double v = (x0 + std::min(c, width - 1)) * _freq + seed;
+            Yint[i * padded + c] = (int)v;
+            Ymu[i * padded + c] = Weight(v - (int)v);
+        }
+        _changing_amp *= persistence;
+        _freq *= 2;
+    }
+    
+    vector<int32_t> Xint(height * octaves);
+    vector<float> Xmu(height * octaves);
+    for(int r = 0; r < height; r++)
+    {
+        for(int i = 0; i < octaves; i++)
+        {
+            double u = (y0 + r) * freqs[i] + seed;
+            Xint[r * octaves + i] = (int)u;
+            Xmu[r * octaves + i] = Weight(u - (int)u);
+        }
+    }
+    
+    vector<float> heights(padded);
+#if defined(SIMD_AVX2_DISPATCH)
+    if (SimdAVX2())
+    {
+        simd_avx2::NoiseRows(Yint.data(), Ymu.data(), Xint.data(), Xmu.data(), amps.data(), octaves, padded, width, height, (float)amplitude, heights.data(), out);
+        return;
+    }
+#endif
+    SIMD_NAMESPACE::NoiseRows(Yint.data(), Ymu.data(), Xint.data(), Xmu.data(), amps.data(), octaves, padded, width, height, (float)amplitude, heights.data(), out);
+}
+
+void TestNoiseEngines()
+{
+    const char* names[] = { "double cosine", "float cosine", "float smoothstep", "float quintic" };
+    const int width = 512, height = 512;
+    
+    cout << "Noise engines (" << SimdISA() << "), " << width << "x" << height << " samples" << endl;
+    
+    // typical settings of the Noise bar, and a few octaves more
+    PerlinNoise pn(0.3, 0.05, 15, 10, 12345);
+    
+    vector<float> reference(width * height), result(width * height);
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int y = 0; y < height; y++)
+        for(int x = 0; x < width; x++)
+            reference[y * width + x] = pn.GetHeight(x, y);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    cout << "  GetHeight() per sample: " << (width * height) / ms / 1000 << " M samples/s" << endl;
+    
+    for(int e = NOISE_DOUBLE_COSINE; e <= NOISE_FLOAT_QUINTIC; e++)
+    {
+        start = std::chrono::high_resolution_clock::now();
+        pn.GetHeights(0, 0, width, height, &result[0], (NoiseEngine)e);
+        ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    
+        // errors relative to the amplitude
+        double max_error = 0, sum_sq = 0;
+        for(int i = 0; i < width * height; i++)
+        {
+            double error = abs(result[i] - reference[i]) / pn.Amplitude();
+            max_error = std::max(max_error, error);
+            sum_sq += error * error;
+        }
+    
+        cout << "  " << names[e] << ": " << (width * height) / ms / 1000 << " M samples/s"
+             << ", error max " << max_error << " rms " << sqrt(sum_sq / (width * height)) << endl;
+    }
+    
+    // gradient noise is another surface, so its derivatives are checked against its own central
+    // differences instead, on smooth enough noise for these to be close
+    vector<float> dx(width * height), dy(width * height);
+    start = std::chrono::high_resolution_clock::now();
+    pn.GetGradientHeights(0, 0, width, height, &result[0], &dx[0], &dy[0]);
+    ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    cout << "  gradient, with derivatives: " << (width * height) / ms / 1000 << " M samples/s" << endl;
+    
+    PerlinNoise smooth(0.3, 0.01, 15, 4, 12345);
+    smooth.GetGradientHeights(0, 0, width, height, &result[0], &dx[0], &dy[0]);
+    double sum_sq = 0, sum_sq_gradient = 0;
+    for(int y = 1; y < height - 1; y++)
+    {
+        for(int x = 1; x < width - 1; x++)
+        {
+            const int i = y * width + x;
+            double ex = dx[i] - (result[i + 1] - result[i - 1]) / 2;
+            double ey = dy[i] - (result[i + width] - result[i - width]) / 2;
+            sum_sq += ex * ex + ey * ey;
+            sum_sq_gradient += dx[i] * dx[i] + dy[i] * dy[i];
+        }
+    }
+    cout << "  gradient derivatives differ from central differences by " << 100 * sqrt(sum_sq / sum_sq_gradient) << "% rms" << endl;
+}
+
+#endif
@@ -0,0 +1,14 @@
+//
+//  noisekernels_avx2.cpp
+//  DGIProject
+//
+//  The kernels of noisekernels.cpp, built for AVX2: the project enables it for this file alone,
+//  on x86-64 (SIMD_AVX2_FLAGS), and PerlinNoise::GetHeights() runs these when the processor has it.
+//
+
+#if defined(__AVX2__)
+#define SIMD_KERNELS_ONLY
+#include "noisekernels.cpp"
+#elif defined(__x86_64__)
+#error "built without -mavx2, see SIMD_AVX2_FLAGS in the project"
+#endif
@@ -0,0 +1,81 @@
+//
+//  noiselayercache.cpp
+//  DGIProject
+//
+
+#include "noiselayercache.h"
+
+static size_t LayerBytes(const NoiseLayerCache::Layer &layer) {
+    return layer->size() * sizeof(float);
+}
+
+NoiseLayerCache::NoiseLayerCache(const size_t &capacity) : capacity(capacity) {
+    hits        = 0;
+    misses      = 0;
+    evictions   = 0;
+    bytes       = 0;
+    useClock    = 0;
+}
+
+NoiseLayerCache::Layer NoiseLayerCache::Find(const NoiseLayerKey &key) {
+
+    lock_guard<mutex> lock(entriesMutex);
+
+    for ( Entry &entry : entries ) {
+        if (entry.key == key) {
+            entry.lastUse = ++useClock;
+            hits++;
+            return entry.layer;
+        }
+    }
+
+    misses++;
+    return NULL;
+}
+
+void NoiseLayerCache::Insert(const NoiseLayerKey &key, const Layer &layer) {
+
+    lock_guard<mutex> lock(entriesMutex);
+
+    const size_t size = LayerBytes(layer);
+    if (size > capacity)
+        return;
+
+    EvictUntil(capacity - size);
+
+    Entry entry = { key, layer, ++useClock };
+    entries.push_back(entry);
+    bytes += size;
+}
+
+void NoiseLayerCache::Clear() {
+    lock_guard<mutex> lock(entriesMutex);
+    entries.clear();
+    bytes = 0;
+}
+
+void NoiseLayerCache::SetCapacity(const size_t &bytes) {
+    lock_guard<mutex> lock(entriesMutex);
+    capacity = bytes;
+    EvictUntil(capacity);
+}
+
+size_t NoiseLayerCache::Bytes() const {
+    lock_guard<mutex> lock(entriesMutex);
+    return bytes;
+}
+
+void NoiseLayerCache::EvictUntil(const size_t &limit) {
+
+    // layers still in use by a caller stay alive through their shared_ptr
+    while (bytes > limit && !entries.empty()) {
+        auto oldest = entries.begin();
+        for ( auto it = entries.begin(); it != entries.end(); it++ )
+            if (it->lastUse < oldest->lastUse)
+                oldest = it;
+
+        bytes -= LayerBytes(oldest->layer);
+        entries.erase(oldest);
+        evictions++;
+    }
+}
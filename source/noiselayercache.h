@@ -0,0 +1,89 @@
+//
+//  noiselayercache.h
+//  DGIProject
+//
+
+#ifndef DGIProject_noiselayercache_h
+#define DGIProject_noiselayercache_h
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <stddef.h>
+#include "perlinnoise.h"
+
+using namespace std;
+
+#define DEFAULT_NOISE_CACHE_BYTES   (64 << 20)
+
+// Identifies one octave of noise over a whole field. Amplitude and persistence only weigh
+// the octaves, so they are not part of it.
+struct NoiseLayerKey {
+    double      frequency;      // Of the first octave
+    int         octave;
+    int         seed;
+    NoiseEngine engine;
+    int         width, height;
+
+    bool operator==(const NoiseLayerKey &other) const {
+        return frequency == other.frequency && octave == other.octave && seed == other.seed &&
+               engine == other.engine && width == other.width && height == other.height;
+    }
+};
+
+/**
+ Octaves of noise, each evaluated with unit amplitude over a width x height field, so the noise
+ for any amplitude and persistence is a weighted sum of them. Holds at most capacity bytes, and
+ drops the least recently used layers to make room for new ones. Safe to use from several threads.
+ */
+class NoiseLayerCache {
+public:
+
+    typedef shared_ptr<const vector<float>> Layer;
+
+    NoiseLayerCache(const size_t &capacity = DEFAULT_NOISE_CACHE_BYTES);
+
+    // The layer for key, or NULL (counted as a miss) if it isn't held
+    Layer Find(const NoiseLayerKey &key);
+
+    // Adds a layer, if it fits at all
+    void Insert(const NoiseLayerKey &key, const Layer &layer);
+
+    void Clear();
+    void SetCapacity(const size_t &bytes);
+
+    size_t Bytes() const;
+    size_t Capacity() const { return capacity; }
+
+    // Counters since the start
+    inline unsigned int Hits() const        { return hits; }
+    inline unsigned int Misses() const      { return misses; }
+    inline unsigned int Evictions() const   { return evictions; }
+
+    double HitRate() const {
+        const unsigned int h = hits, m = misses;
+        return h + m > 0 ? (double) h / (h + m) : 0;
+    }
+
+private:
+
+    struct Entry {
+        NoiseLayerKey   key;
+        Layer           layer;
+        unsigned int    lastUse;
+    };
+
+    mutable mutex           entriesMutex;   // Guards all but the counters
+    vector<Entry>           entries;
+    size_t                  bytes;
+    size_t                  capacity;
+    unsigned int            useClock;
+    atomic<unsigned int>    hits;
+    atomic<unsigned int>    misses;
+    atomic<unsigned int>    evictions;
+
+    void EvictUntil(const size_t &limit);   // Requires entriesMutex
+};
+
+#endif
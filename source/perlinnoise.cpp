@@ -10,6 +10,7 @@
 #include "perlinnoise.h"
 #include <iostream>
 #include <cmath>
+#include <vector>
 
 
 PerlinNoise::PerlinNoise()
@@ -57,6 +58,148 @@ double PerlinNoise::GetHeight(double x, double y) const
     return height * amplitude;
 }
 
+void PerlinNoise::GetHeights(int x0, int y0, int width, int height, float* out, NoiseEngine engine) const
+{
+    if (engine == NOISE_GRADIENT)
+    {
+        GetGradientHeights(x0, y0, width, height, out, NULL, NULL);
+        return;
+    }
+    if (engine != NOISE_DOUBLE_COSINE)
+    {
+        GetHeightsFloat(x0, y0, width, height, out, engine);
+        return;
+    }
+    
+    /*
+     GetValue(u, v) smooths the noise at the four lattice points around (u, v) and interpolates
+     between them. Along a row of samples u is the same, so for the octaves with less than one
+     lattice cell per sample, the smoothed values of lattice rows Xint and Xint+1 are kept (the
+     next rows mostly share them) and interpolated in u once per lattice point. Only the
+     interpolation in v is done per sample. Finer octaves are evaluated per sample, as there is
+     nothing to share. Either way the interpolation weights in v are the same for every row, and
+     computed once. The arithmetic is that of GetValue(), so the result is the same.
+     */
+    struct Octave
+    {
+        double freq, amp;
+        bool perSample;                 // at least one lattice cell per sample
+        std::vector<int> Yint;          // per sample of a row
+        std::vector<double> Ymu;        // interpolation weight per sample of a row
+        int Ymin, Ymax;                 // lattice range of a row
+        int Xkey;                       // lattice row held by X0 (X1 holds the next)
+        std::vector<double> X0, X1;     // smoothed noise, from Ymin to Ymax
+        std::vector<double> row;        // X0 and X1 interpolated in u, from Ymin to Ymax
+    };
+    
+    std::vector<Octave> octs(octaves);
+    double _changing_amp = 1;
+    double _freq = frequency;
+    for(int i = 0; i < octaves; i++)
+    {
+        Octave &o = octs[i];
+        o.freq = _freq;
+        o.amp = _changing_amp;
+        o.perSample = _freq >= 1;
+        o.Yint.resize(width);
+        o.Ymu.resize(width);
+        for(int c = 0; c < width; c++)
+        {
+            double v = (x0 + c) * _freq + seed;
+            o.Yint[c] = (int)v;
+            o.Ymu[c] = CosineWeight(v - o.Yint[c]);
+        }
+        o.Ymin = o.Yint[0];
+        o.Ymax = o.Yint[width - 1] + 1;
+        o.Xkey = 0;
+        if (!o.perSample)
+        {
+            o.X0.resize(o.Ymax - o.Ymin + 1);
+            o.X1.resize(o.Ymax - o.Ymin + 1);
+            o.row.resize(o.Ymax - o.Ymin + 1);
+        }
+        
+        _changing_amp *= persistence;
+        _freq *= 2;
+    }
+    
+    std::vector<double> heights(width);
+    for(int r = 0; r < height; r++)
+    {
+        std::fill(heights.begin(), heights.end(), 0.0);
+        
+        for(int i = 0; i < octaves; i++)
+        {
+            Octave &o = octs[i];
+            double u = (y0 + r) * o.freq + seed;
+            int Xint = (int)u;
+            double Xmu = CosineWeight(u - Xint);
+            
+            if (o.perSample)
+            {
+                for(int c = 0; c < width; c++)
+                    heights[c] += GetValue(Xint, o.Yint[c], Xmu, o.Ymu[c]) * o.amp;
+                continue;
+            }
+            
+            // smoothed noise of lattice rows Xint and Xint+1, reusing what the previous row had
+            bool haveX0 = r > 0 && Xint == o.Xkey;
+            bool haveX1 = haveX0;
+            if (r > 0 && Xint == o.Xkey + 1)
+            {
+                o.X0.swap(o.X1);
+                haveX0 = true;
+            }
+            for(int Y = o.Ymin; Y <= o.Ymax; Y++)
+            {
+                if (!haveX0) o.X0[Y - o.Ymin] = SmoothNoise(Xint, Y);
+                if (!haveX1) o.X1[Y - o.Ymin] = SmoothNoise(Xint+1, Y);
+            }
+            o.Xkey = Xint;
+            
+            for(int k = 0; k <= o.Ymax - o.Ymin; k++)
+                o.row[k] = Interpolate(o.X0[k], o.X1[k], Xmu);
+            
+            for(int c = 0; c < width; c++)
+            {
+                int k = o.Yint[c] - o.Ymin;
+                heights[c] += Interpolate(o.row[k], o.row[k+1], o.Ymu[c]) * o.amp;
+            }
+        }
+        
+        for(int c = 0; c < width; c++)
+            out[r * width + c] = heights[c] * amplitude;
+    }
+}
+
+void PerlinNoise::GetGradientHeights(int x0, int y0, int width, int height, float* out, float* outDx, float* outDy) const
+{
+    for(int r = 0; r < height; r++)
+    {
+        for(int c = 0; c < width; c++)
+        {
+            double h = 0, dx = 0, dy = 0;
+            double _changing_amp = 1;
+            double _freq = frequency;
+            
+            // an octave's derivatives are per lattice cell, and _freq cells per sample
+            for(int i = 0; i < octaves; i++)
+            {
+                double odx, ody;
+                h += GradientValue((x0 + c) * _freq + seed, (y0 + r) * _freq + seed, odx, ody) * _changing_amp;
+                dx += odx * _freq * _changing_amp;
+                dy += ody * _freq * _changing_amp;
+                _changing_amp *= persistence;
+                _freq *= 2;
+            }
+            
+            out[r * width + c] = h * amplitude;
+            if (outDx) outDx[r * width + c] = dx * amplitude;
+            if (outDy) outDy[r * width + c] = dy * amplitude;
+        }
+    }
+}
+
 double PerlinNoise::GetValue(double x, double y) const
 {
     int Xint = (int)x;
@@ -64,6 +207,11 @@ double PerlinNoise::GetValue(double x, double y) const
     double Xdif = x - Xint;
     double Ydif = y - Yint;
     
+    return GetValue(Xint, Yint, CosineWeight(Xdif), CosineWeight(Ydif));
+}
+
+double PerlinNoise::GetValue(int Xint, int Yint, double Xmu, double Ymu) const
+{
     //noise values from the surroundings
     double n01 = GenNoise(Xint-1, Yint-1);
     double n02 = GenNoise(Xint+1, Yint-1);
@@ -90,29 +238,82 @@ double PerlinNoise::GetValue(double x, double y) const
     double x1y1 = 0.0625*(n09+n12+n15+n16) + 0.125*(n08+n11+n06+n14) + 0.25*(n04);
     
     //interpolate between those values according to the x and y fractions
-    double row1 = Interpolate(x0y0, x1y0, Xdif); //interpolate in x direction (y)
-    double row2 = Interpolate(x0y1, x1y1, Xdif); //interpolate in x direction (y+1)
-    double value = Interpolate(row1, row2, Ydif);  //interpolate in y direction
+    double row1 = Interpolate(x0y0, x1y0, Xmu); //interpolate in x direction (y)
+    double row2 = Interpolate(x0y1, x1y1, Xmu); //interpolate in x direction (y+1)
+    double value = Interpolate(row1, row2, Ymu);  //interpolate in y direction
     
     return value;
 }
 
 // Cosine interpolation, for smooth interpolation
 // http://paulbourke.net/miscellaneous/interpolation/
-double PerlinNoise::Interpolate(double a, double b, double mu) const
+double PerlinNoise::CosineWeight(double mu) const
 {
     double PI = 3.1415927;
-    double mu2=(1.0-cos(mu*PI))* 0.5;
-    return a*(1.0-mu2)+b*mu2;
+    return (1.0-cos(mu*PI))* 0.5;
+}
 
+double PerlinNoise::Interpolate(double a, double b, double mu2) const
+{
+    return a*(1.0-mu2)+b*mu2;
 }
 
 // Base function for noise, seems to be a quite standardized way of generating the noise.
 // Basically a pseudo random generator with two inputs, returning a value between -1 and 1.
 double PerlinNoise::GenNoise(int x, int y) const
+{
+    return 1.0 - double(GenHash(x, y)) * 0.931322574615478515625e-9;
+}
+
+int PerlinNoise::GenHash(int x, int y) const
 {
     int n = x + y * 57;
     n = (n << 13) ^ n;
-    int t = (n * (n * n * 15731 + 789221) + 1376312589) & 0x7fffffff;
-    return 1.0 - double(t) * 0.931322574615478515625e-9;
-}
\ No newline at end of file
+    return (n * (n * n * 15731 + 789221) + 1376312589) & 0x7fffffff;
+}
+
+// The noise at (x, y) smoothed with its eight neighbours, as at the corners in GetValue()
+double PerlinNoise::SmoothNoise(int x, int y) const
+{
+    return 0.0625*(GenNoise(x-1, y-1)+GenNoise(x+1, y-1)+GenNoise(x-1, y+1)+GenNoise(x+1, y+1))
+         + 0.125*(GenNoise(x-1, y)+GenNoise(x+1, y)+GenNoise(x, y-1)+GenNoise(x, y+1))
+         + 0.25*(GenNoise(x, y));
+}
+
+// Gradient noise: the lattice points get one of eight unit gradients, and the surface is the
+// quintic interpolation of the planes through them. Returns values in about -0.7..0.7, and
+// the derivatives of the interpolation, so they match the surface exactly.
+// http://www.iquilezles.org/www/articles/gradientnoise/gradientnoise.htm
+double PerlinNoise::GradientValue(double x, double y, double &dx, double &dy) const
+{
+    static const double G[8][2] = {
+        {1, 0}, {-1, 0}, {0, 1}, {0, -1},
+        {0.70710678, 0.70710678}, {-0.70710678, 0.70710678}, {0.70710678, -0.70710678}, {-0.70710678, -0.70710678}
+    };
+    
+    int Xint = (int)floor(x);
+    int Yint = (int)floor(y);
+    double fx = x - Xint;
+    double fy = y - Yint;
+    
+    // the hash's low bits repeat quickly, so the gradient comes from higher ones
+    const double* ga = G[(GenHash(Xint, Yint) >> 13) & 7];
+    const double* gb = G[(GenHash(Xint+1, Yint) >> 13) & 7];
+    const double* gc = G[(GenHash(Xint, Yint+1) >> 13) & 7];
+    const double* gd = G[(GenHash(Xint+1, Yint+1) >> 13) & 7];
+    
+    double va = ga[0]*fx + ga[1]*fy;
+    double vb = gb[0]*(fx-1) + gb[1]*fy;
+    double vc = gc[0]*fx + gc[1]*(fy-1);
+    double vd = gd[0]*(fx-1) + gd[1]*(fy-1);
+    
+    double ux = fx*fx*fx*(fx*(fx*6-15)+10);
+    double uy = fy*fy*fy*(fy*(fy*6-15)+10);
+    double dux = 30*fx*fx*(fx*(fx-2)+1);
+    double duy = 30*fy*fy*(fy*(fy-2)+1);
+    
+    double k = va - vb - vc + vd;
+    dx = ga[0] + ux*(gb[0]-ga[0]) + uy*(gc[0]-ga[0]) + ux*uy*(ga[0]-gb[0]-gc[0]+gd[0]) + dux*(vb - va + uy*k);
+    dy = ga[1] + ux*(gb[1]-ga[1]) + uy*(gc[1]-ga[1]) + ux*uy*(ga[1]-gb[1]-gc[1]+gd[1]) + duy*(vc - va + ux*k);
+    return va + ux*(vb-va) + uy*(vc-va) + ux*uy*k;
+}
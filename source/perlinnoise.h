@@ -9,6 +9,16 @@
 #ifndef __DGIProject__perlinnoise__
 #define __DGIProject__perlinnoise__
 
+// How GetHeights() evaluates the noise
+enum NoiseEngine
+{
+    NOISE_DOUBLE_COSINE,        // Double precision, same as GetHeight()
+    NOISE_FLOAT_COSINE,         // Single precision and vectorized (see noisekernels.cpp), same interpolation
+    NOISE_FLOAT_SMOOTHSTEP,     // Single precision and vectorized, cheaper interpolation
+    NOISE_FLOAT_QUINTIC,        // Single precision and vectorized, smoother interpolation
+    NOISE_GRADIENT              // Gradient noise rather than value noise, with analytic derivatives
+};
+
 class PerlinNoise
 {
 public:
@@ -20,6 +30,14 @@ public:
     // Get Height
     double GetHeight(double x, double y) const;
     
+    // Same as GetHeight(x, y) for the samples x0 <= x < x0 + width, y0 <= y < y0 + height,
+    // written row by row to out, but sharing the work between neighbouring samples
+    void GetHeights(int x0, int y0, int width, int height, float* out, NoiseEngine engine = NOISE_DOUBLE_COSINE) const;
+    
+    // Gradient noise of the same samples, and its derivatives along x and y (per sample) if
+    // outDx and outDy aren't NULL. Same parameters as the value noise, but a different surface.
+    void GetGradientHeights(int x0, int y0, int width, int height, float* out, float* outDx, float* outDy) const;
+    
     // Set parameters
     void SetParams(double _persistence, double _frequency, double _amplitude, int _octaves, int _randomseed);
     
@@ -42,9 +60,19 @@ private:
     int octaves, seed;
     
     double GetValue(double x, double y) const;
-    double Interpolate(double x, double y, double a) const;
+    double GetValue(int Xint, int Yint, double Xmu, double Ymu) const;     // Given the lattice cell and interpolation weights
+    double CosineWeight(double mu) const;
+    double Interpolate(double x, double y, double mu2) const;
     double GenNoise(int x, int y) const;
+    int GenHash(int x, int y) const;
+    double SmoothNoise(int x, int y) const;
+    double GradientValue(double x, double y, double &dx, double &dy) const;  // One octave of gradient noise
+    
+    void GetHeightsFloat(int x0, int y0, int width, int height, float* out, NoiseEngine engine) const;
     
 };
 
+// Prints how far the single precision engines are from the double one, and how fast each is
+void TestNoiseEngines();
+
 #endif /* defined(__DGIProject__perlinnoise__) */
@@ -7,21 +7,26 @@
 //
 
 #include "rangedrawer.h"
+#include "difficultymap.h"
 
 RangeDrawer gRangeDrawer;
 
 RangeDrawer::RangeDrawer() {
     
-    for ( int y=0; y<Y_INTERVAL-1; y++ )
-        for ( int x=0; x<X_INTERVAL-1; x++ )
-            marked[y][x] = false;
+    quadsX = quadsY = 0;
     
     markChanged = false;
     
-    markedWithShift = new AreaMarkingManager(Y_INTERVAL - 1, X_INTERVAL - 1);
+    // sized in Resize(), as gTerrain might not be constructed yet
+    markedWithShift = NULL;
+    
+    teeMarked = false;
+    targetMarked = false;
     
     mouseIsDown = false;
     
+    difficultyMapShown = false;
+    
     markMode = NONE;
 }
 
@@ -29,18 +34,33 @@ RangeDrawer::~RangeDrawer() {
     delete markedWithShift;
 }
 
+void RangeDrawer::Resize() {
+    
+    quadsX = gTerrain.XInterval() - 1;
+    quadsY = gTerrain.YInterval() - 1;
+    
+    marked.assign(quadsX * quadsY, false);
+    currentlyMarked.clear();
+    
+    delete markedWithShift;
+    markedWithShift = new AreaMarkingManager(quadsX, quadsY);
+    
+    teeMarked = false;
+    targetMarked = false;
+    mouseIsDown = false;
+    
+    difficultyMapShown = false;
+    gDifficultyMap.Clear();
+    
+    SetMarkChanged();
+}
+
 void RangeDrawer::ColorQuad(const int&x, const int &y, const vec4 &c) {
-    // Using same methods as in RangeTerrain::UpdateVertexData() and RangeTerrain::SetVertexData()
-    int idx = (y  )*FLOATS_PER_ROW + (x  )*FLOATS_PER_TRIANGLE_PAIR;
-    
-    for ( int i=0; i<6; i++ ) {
-        gTerrain.changedVertexIndices.push_back( idx );
-        idx += 8; // Skip v, n, and t
-        gTerrain.vertexData[idx++] = c.r;
-        gTerrain.vertexData[idx++] = c.g;
-        gTerrain.vertexData[idx++] = c.b;
-        gTerrain.vertexData[idx++] = c.a;
-    }
+    // The mesh is indexed, so the corners are shared with the neighbouring quads
+    gTerrain.SetVertexColor( x  , y  , c );
+    gTerrain.SetVertexColor( x  , y+1, c );
+    gTerrain.SetVertexColor( x+1, y  , c );
+    gTerrain.SetVertexColor( x+1, y+1, c );
 }
 
 void RangeDrawer::MarkTerrain() {
@@ -65,6 +85,16 @@ void RangeDrawer::MarkTerrain() {
     ResetMarkChanged();
 }
 
+void RangeDrawer::ShowDifficultyMap(const bool &show) {
+    
+    // the terrain shader draws the cells over the vertex colors, which stay as they are
+    if (!show && difficultyMapShown)
+        gDifficultyMap.Clear();
+    
+    difficultyMapShown = show;
+    SetMarkChanged();
+}
+
 float RangeDrawer::GetAverageHeight(const set<xy, xy_comparator> &marking) {
     
     if (marking.empty())
@@ -72,7 +102,7 @@ float RangeDrawer::GetAverageHeight(const set<xy, xy_comparator> &marking) {
     
     float sum = 0;
     for (auto xy : marking)
-        sum += gTerrain.hmap[xy.y][xy.x];
+        sum += gTerrain.Height(xy.x, xy.y);
     return sum / marking.size();
 }
 
@@ -98,13 +128,13 @@ void RangeDrawer::LiftMarked(const float &lift, const float &spread, const Contr
         LiftVertex(x  , y  , lift, spread, functype);     // v1
         
         // For vertices 2-4, we need to check for other coordinates being marked to avoid multiple adjustments of same controlpoint
-        if (y == Y_INTERVAL - 2 || !marked[y+1][x  ])
+        if (y == quadsY - 1 || !IsMarked(x, y+1))
             LiftVertex(x  , y+1, lift, spread, functype); // v2
         
-        if (x == X_INTERVAL - 2 || (!marked[y  ][x+1] && (y == 0 || !marked[y-1][x+1])))
+        if (x == quadsX - 1 || (!IsMarked(x+1, y) && (y == 0 || !IsMarked(x+1, y-1))))
             LiftVertex(x+1, y  , lift, spread, functype); // v3
         
-        if ((y == Y_INTERVAL - 2 && x == X_INTERVAL - 2) || (!marked[y+1][x  ] && !marked[y  ][x+1] && !marked[y+1][x+1]))
+        if ((y == quadsY - 1 && x == quadsX - 1) || (!IsMarked(x, y+1) && !IsMarked(x+1, y) && !IsMarked(x+1, y+1)))
             LiftVertex(x+1, y+1, lift, spread, functype); // v4
     }
 }
@@ -122,24 +152,24 @@ void RangeDrawer::TiltMarked(const float &xtilt, const float &ytilt, const float
         y = xy.y;
         
         // v1
-        lift = (float(x  ) - cx) * float(GRID_RES) * tanx + (float(y  ) - cy) * float(GRID_RES) * tany;
+        lift = (float(x  ) - cx) * gTerrain.GridRes() * tanx + (float(y  ) - cy) * gTerrain.GridRes() * tany;
         LiftVertex(x  , y  , lift, spread, functype);
         
         
         // For vertices 2-4, we need to check for other coordinates being marked to avoid multiple adjustments of same controlpoint
-        if (y == Y_INTERVAL - 2 || !marked[y+1][x  ]) {
-            lift = ((x  ) - cx) * float(GRID_RES) * tanx + ((y+1) - cy) * float(GRID_RES) * tany;
+        if (y == quadsY - 1 || !IsMarked(x, y+1)) {
+            lift = ((x  ) - cx) * gTerrain.GridRes() * tanx + ((y+1) - cy) * gTerrain.GridRes() * tany;
             LiftVertex(x  , y+1, lift, spread, functype);
         }
         
-        if (x == X_INTERVAL - 2 || (!marked[y  ][x+1] && (y == 0 || !marked[y-1][x+1]))) {
-            lift = ((x+1) - cx) * float(GRID_RES) * tanx + ((y  ) - cy) * float(GRID_RES) * tany;
+        if (x == quadsX - 1 || (!IsMarked(x+1, y) && (y == 0 || !IsMarked(x+1, y-1)))) {
+            lift = ((x+1) - cx) * gTerrain.GridRes() * tanx + ((y  ) - cy) * gTerrain.GridRes() * tany;
             LiftVertex(x+1, y  , lift, spread, functype);
             
         }
         
-        if ((y == Y_INTERVAL - 2 && x == X_INTERVAL - 2) || (!marked[y+1][x  ] && !marked[y  ][x+1] && !marked[y+1][x+1])) {
-            lift = ((x+1) - cx) * float(GRID_RES) * tanx + ((y+1) - cy) * float(GRID_RES) * tany;
+        if ((y == quadsY - 1 && x == quadsX - 1) || (!IsMarked(x, y+1) && !IsMarked(x+1, y) && !IsMarked(x+1, y+1))) {
+            lift = ((x+1) - cx) * gTerrain.GridRes() * tanx + ((y+1) - cy) * gTerrain.GridRes() * tany;
             LiftVertex(x+1, y+1, lift, spread, functype);
             
         }
@@ -164,14 +194,14 @@ void RangeDrawer::FlattenMarked(const float &h, const float &spread, const Contr
 void RangeDrawer::Mark(const int &x, const int &y) {
     
     int _x = x, _y = y;
-    if (_x == X_INTERVAL - 1) { _x--; };
-    if (_y == X_INTERVAL - 1) { _y--; };
-    assert( 0 <= _x && _x < X_INTERVAL-1 && 0 <= _y && _y < Y_INTERVAL-1 );
+    if (_x == quadsX) { _x--; };
+    if (_y == quadsY) { _y--; };
+    assert( 0 <= _x && _x < quadsX && 0 <= _y && _y < quadsY );
     
-    if (marked[y][x])
+    if (IsMarked(x, y))
         return; // Already marked
     
-    marked[y][x] = true;
+    SetMarked(x, y, true);
     currentlyMarked.insert( { x, y } );
     SetMarkChanged();
     
@@ -184,14 +214,14 @@ void RangeDrawer::Mark(const int &x, const int &y) {
 void RangeDrawer::Unmark(const int &x, const int &y) {
     
     int _x = x, _y = y;
-    if (_x == X_INTERVAL - 1) { _x--; };
-    if (_y == X_INTERVAL - 1) { _y--; };
-    assert( 0 <= _x && _x < X_INTERVAL-1 && 0 <= _y && _y < Y_INTERVAL-1 );
+    if (_x == quadsX) { _x--; };
+    if (_y == quadsY) { _y--; };
+    assert( 0 <= _x && _x < quadsX && 0 <= _y && _y < quadsY );
     
-    if (!marked[y][x])
+    if (!IsMarked(x, y))
         return; // Already unmarked
     
-    marked[y][x] = false;
+    SetMarked(x, y, false);
     currentlyMarked.erase( { x, y } );
     SetMarkChanged();
     
@@ -202,7 +232,7 @@ void RangeDrawer::Unmark(const int &x, const int &y) {
 }
 
 void RangeDrawer::ToggleMarked(const int &x, const int &y) {
-    marked[y][x] ? Unmark(x, y) : Mark(x, y);
+    IsMarked(x, y) ? Unmark(x, y) : Mark(x, y);
 }
 
 void RangeDrawer::UnmarkAll() {
@@ -215,7 +245,7 @@ void RangeDrawer::UnmarkAll() {
         x = xy.x;
         y = xy.y;
         
-        marked[y][x] = false;
+        SetMarked(x, y, false);
         
         gTerrain.changedVertices->SetChanged( x  , y   );
         gTerrain.changedVertices->SetChanged( x  , y+1 );
@@ -246,7 +276,7 @@ void RangeDrawer::TerrainCoordClicked(const float &tx, const float &ty, const bo
     
         case MARK_CONTROL_POINT:
             if (!mouseIsDown) { // Mouse was recently pressed
-                mouseDownIsMarking = !marked[y][x]; // if (x,y) was marked, only mark until mouse release
+                mouseDownIsMarking = !IsMarked(x, y); // if (x,y) was marked, only mark until mouse release
                 markedWithShift->Reset();
             }
             mouseIsDown = true;
@@ -304,13 +334,13 @@ float RangeDrawer::GetHeight(float tx, float ty) {
     const int x = TerrainX2QuadX(tx), y = TerrainY2QuadY(ty);
     
     int _x = x, _y = y;
-    if (_x == X_INTERVAL - 1) { _x--; };
-    if (_y == X_INTERVAL - 1) { _y--; };
-    assert( 0 <= _x && _x < X_INTERVAL-1 && 0 <= _y && _y < Y_INTERVAL-1 );
-    
-    float hsum = gTerrain.hmap[y  ][x  ]
-               + gTerrain.hmap[y  ][x+1]
-               + gTerrain.hmap[y+1][x  ]
-               + gTerrain.hmap[y+1][x+1];
+    if (_x == quadsX) { _x--; };
+    if (_y == quadsY) { _y--; };
+    assert( 0 <= _x && _x < quadsX && 0 <= _y && _y < quadsY );
+    
+    float hsum = gTerrain.Height(x  , y  )
+               + gTerrain.Height(x+1, y  )
+               + gTerrain.Height(x  , y+1)
+               + gTerrain.Height(x+1, y+1);
     return hsum / 4.0f;
 }
\ No newline at end of file
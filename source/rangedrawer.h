@@ -26,7 +26,7 @@ enum MarkMode {
 
 struct xy_comparator {
     bool operator() (const xy &a, const xy &b) const {
-        return a.y * (X_INTERVAL-1) + a.x < b.y * (X_INTERVAL-1) + b.x;
+        return a.y < b.y || (a.y == b.y && a.x < b.x);
     }
 };
 
@@ -52,7 +52,7 @@ public:
     }
     
     ~AreaMarkingManager() {
-        delete identifierInVector;
+        delete[] identifierInVector;
     }
     
     void Mark(const int &x, const int &y) {
@@ -91,7 +91,8 @@ private:
     
     // Marking
     MarkMode                markMode;
-    bool                    marked[Y_INTERVAL-1][X_INTERVAL-1];
+    int                     quadsX, quadsY;
+    vector<bool>            marked;         // quadsY * quadsX
     bool                    markChanged;
     set<xy, xy_comparator>  currentlyMarked;
     
@@ -106,6 +107,9 @@ private:
     // Drawing
     AreaMarkingManager* markedWithShift;
     
+    // Difficulty map overlay, drawn by the terrain shader, see DifficultyMap
+    bool        difficultyMapShown;
+    
     // Mouse
     bool mouseIsDown;
     bool mouseDownIsMarking;     // true means mouse down for marking, false means unmarking
@@ -122,18 +126,21 @@ private:
     float GetHeight(float tx, float ty);
     
     inline void  LiftVertex(const int &x, const int &y, const float &lift, const float &spread, const ControlPointFuncType &functype) {
-        float h = gTerrain.controlPoints[y][x] ? gTerrain.controlPoints[y][x]->h : gTerrain.hmap[y][x];
+        ControlPointHandle cp = gTerrain.ControlPointAt(x, y);
+        float h = cp != NO_CONTROL_POINT ? gTerrain.GetControlPoint(cp).h : gTerrain.Height(x, y);
         gTerrain.SetControlPoint(x, y, h + lift, spread, functype);
     }
     
-    inline static int TerrainX2QuadX(const float &tx) {
-        assert(tx >= 0 && tx <= TERRAIN_WIDTH);
-        return int(floor((X_INTERVAL - 1) * tx / float(TERRAIN_WIDTH)));
+    inline void SetMarked(const int &x, const int &y, const bool &m) { marked[y * quadsX + x] = m; }
+    
+    inline int TerrainX2QuadX(const float &tx) const {
+        assert(tx >= 0 && tx <= gTerrain.Width());
+        return std::min(int(floor(tx / gTerrain.GridRes())), quadsX - 1);
     }
     
-    inline static int TerrainY2QuadY(const float &ty) {
-        assert(ty >= 0 && ty <= TERRAIN_DEPTH);
-        return int(floor((Y_INTERVAL - 1) * ty / float(TERRAIN_DEPTH)));
+    inline int TerrainY2QuadY(const float &ty) const {
+        assert(ty >= 0 && ty <= gTerrain.Depth());
+        return std::min(int(floor(ty / gTerrain.GridRes())), quadsY - 1);
     }
     
 public:
@@ -141,6 +148,8 @@ public:
     RangeDrawer();
     ~RangeDrawer();
     
+    void Resize();      // Adjust to the size of gTerrain, clears all marking
+    
     void MarkTerrain();
     void LiftMarked(const float &lift, const float &spread, const ControlPointFuncType &functype);
     void TiltMarked(const float &xtilt, const float &ytilt, const float &spread, const ControlPointFuncType &functype);
@@ -148,13 +157,17 @@ public:
     
     void UnmarkAll();
     
+    // Shows gDifficultyMap over the height colors, or clears it
+    void ShowDifficultyMap(const bool &show);
+    inline bool DifficultyMapShown() const { return difficultyMapShown; }
+    
     void MarkTerrainCoord(const float &tx, const float &ty);
     void UnmarkTerrainCoord(const float &tx, const float &ty);
     void ToggleMarkedTerrainCoord(const float &tx, const float &ty);
     void TerrainCoordClicked(const float &tx, const float &ty, const bool &shift_down);
     
     inline bool MarkChanged()                           { return markChanged; }
-    inline bool IsMarked(const int &x, const int &y)    { return marked[y][x]; }
+    inline bool IsMarked(const int &x, const int &y)    { return x < quadsX && y < quadsY && marked[y * quadsX + x]; }
     inline bool TeeMarked()                             { return teeMarked; };
     inline bool TargetMarked()                          { return targetMarked; }
     inline void SetMarkMode(const MarkMode &mode)       { markMode = mode; }
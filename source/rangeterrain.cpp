@@ -7,98 +7,276 @@
 //
 
 #include "rangeterrain.h"
+#include "workerpool.h"
 #include <iostream>
+#include <algorithm>
+#include <limits>
 #include <glm/glm.hpp>
 
 using glm::vec3;
 
 RangeTerrain gTerrain;
 
-RangeTerrain::RangeTerrain() {
+TerrainTile::TerrainTile(const int &tx, const int &ty, const TerrainVertex* initialVertexData, const GLushort* initialIndexData) : tx(tx), ty(ty) {
+    
+    memset(hmap, 0, sizeof(hmap));
+    memset(noise, 0, sizeof(noise));
+    memset(diagonalUp, 0, sizeof(diagonalUp));
+    for ( int y=0; y<TILE_SIZE; y++ )
+        for ( int x=0; x<TILE_SIZE; x++ )
+            normals[y][x] = vec3(0, 1, 0);
+    
+    vertexData = NULL;
+    indexData = NULL;
+    if (initialVertexData) {
+        vertexData = new TerrainVertex[VERTICES_PER_TILE];
+        memcpy(vertexData, initialVertexData, VERTICES_PER_TILE * sizeof(TerrainVertex));
+        indexData = new GLushort[INDICES_PER_TILE];
+        memcpy(indexData, initialIndexData, INDICES_PER_TILE * sizeof(GLushort));
+    }
+}
 
-    // right now, we only support quadratic terrain
-    assert(X_INTERVAL == Y_INTERVAL);
-    assert(TERRAIN_WIDTH == TERRAIN_DEPTH);
+TerrainTile::~TerrainTile() {
+    delete[] vertexData;
+    delete[] indexData;
+}
+
+RangeTerrain::RangeTerrain() {
     
-    // initially, we have no control points
-    memset(controlPoints, NULL, Y_INTERVAL*X_INTERVAL*sizeof(ControlPoint*));
+    selfCheck               = false;
+    parallelRegeneration    = true;
+    regenerations           = 0;
+    versionClock            = 0;
+    noiseEngine             = NOISE_DOUBLE_COSINE;
+    noiseRequest            = 0;
+    noiseGradients          = false;
+    pendingNoiseStep        = 1;
+    heightColorInShader     = false;
+    flatTileVertexData      = NULL;
+    flatTileIndexData       = NULL;
+    changedControlPoints    = NULL;
+    changedHMapCoords       = NULL;
+    changedFootprints       = NULL;
+    changedVertices         = NULL;
+    changedTiles            = NULL;
     
-    // initialize change manager to keep track of changes
-    changedControlPoints    = new ChangeManager(X_INTERVAL, Y_INTERVAL);
-    changedHMapCoords       = new ChangeManager(X_INTERVAL, Y_INTERVAL);
-    changedVertices         = new ChangeManager(X_INTERVAL, Y_INTERVAL);
+    // initial terrain (a flat surface, no tiles are allocated until something is written)
+    Resize(DEFAULT_INTERVAL, DEFAULT_INTERVAL, DEFAULT_GRID_RES);
+}
+
+RangeTerrain::~RangeTerrain() {
     
-    // reserve memory for vector to avoid reallocation during runtime
-    changedVertexIndices.reserve(Y_INTERVAL * X_INTERVAL * 6); // Each vertex appears in 6 different triangles
+    CancelNoise();
+    DeleteTiles();
     
-    // initial terrain generation (a flat surface)
-    FlattenHMap();
-    FlattenNoise();
-    Regenerate();
+    delete changedControlPoints;
+    delete changedHMapCoords;
+    delete changedFootprints;
+    delete changedVertices;
+    delete changedTiles;
     
-    // reset as there are now no pending changes to adjust to
-    changedVertexIndices.clear();
-    regenerationRequired = false;
+    delete[] flatTileVertexData;
+    delete[] flatTileIndexData;
 }
 
-RangeTerrain::~RangeTerrain() {
+void RangeTerrain::Resize(int xIntvl, int yIntvl, float res) {
     
+    // right now, we only support quadratic terrain
+    assert(xIntvl == yIntvl);
+    
+    // noise being generated is for the old size
+    CancelNoise();
+    
+    // the quads are split into whole tiles
+    xIntvl = std::max(2, std::min(xIntvl, MAX_INTERVAL));
+    yIntvl = std::max(2, std::min(yIntvl, MAX_INTERVAL));
+    quadTilesX = (xIntvl - 1 + TILE_SIZE - 1) / TILE_SIZE;
+    quadTilesY = (yIntvl - 1 + TILE_SIZE - 1) / TILE_SIZE;
+    xInterval = quadTilesX * TILE_SIZE + 1;
+    yInterval = quadTilesY * TILE_SIZE + 1;
+    tilesX = quadTilesX + 1;
+    tilesY = quadTilesY + 1;
+    gridRes = std::max(MIN_GRID_RES, std::min(res, MAX_GRID_RES));
+    
+    DeleteTiles();
+    tiles.assign(tilesX * tilesY, NULL);
+    controlPointPool.Clear();
+    controlPoints.Resize(xInterval, yInterval);
+    
+    // initialize change managers to keep track of changes
     delete changedControlPoints;
     delete changedHMapCoords;
+    delete changedFootprints;
     delete changedVertices;
+    delete changedTiles;
+    changedControlPoints    = new ChangeManager(xInterval, yInterval);
+    changedHMapCoords       = new ChangeManager(xInterval, yInterval);
+    changedFootprints       = new ChangeManager(xInterval, yInterval);
+    changedVertices         = new ChangeManager(xInterval, yInterval);
+    changedTiles            = new ChangeManager(quadTilesX, quadTilesY);
+    
+    GenerateFlatTileVertexData();
+    maxHeights.Resize(xInterval - 1, yInterval - 1);
+    triangles.Resize(xInterval - 1, yInterval - 1);
+    SetAllTilesChanged();
+    
+    noiseGradients = false;
+    regenerationRequired = false;
+}
+
+void RangeTerrain::DeleteTiles() {
+    
+    for ( TerrainTile* tile : allocatedTiles )
+        delete tile;
+    
+    allocatedTiles.clear();
+    tiles.clear();
+}
+
+void RangeTerrain::AllocateTiles(int min_x, int min_y, int max_x, int max_y) {
+    
+    int min_tx = std::max(min_x, 0) / TILE_SIZE;
+    int min_ty = std::max(min_y, 0) / TILE_SIZE;
+    int max_tx = std::min(max_x, xInterval - 1) / TILE_SIZE;
+    int max_ty = std::min(max_y, yInterval - 1) / TILE_SIZE;
+    
+    for ( int ty=min_ty; ty<=max_ty; ty++ ) {
+        for ( int tx=min_tx; tx<=max_tx; tx++ ) {
+            
+            TerrainTile* &tile = tiles[ty * tilesX + tx];
+            if (tile)
+                continue;
+            
+            // a new tile is flat, which is what the vertex data of the flat tile reflects
+            bool hasQuads = tx < quadTilesX && ty < quadTilesY;
+            tile = new TerrainTile(tx, ty, hasQuads ? flatTileVertexData : NULL, flatTileIndexData);
+            allocatedTiles.push_back(tile);
+            
+            if (hasQuads)
+                changedTiles->SetChanged(tx, ty);
+        }
+    }
+}
+
+TerrainTile* RangeTerrain::TileForWriting(const int &x, const int &y) {
+    
+    // Writing a sample affects the normals and quads of the samples around it. Those
+    // must not be in unallocated tiles, as these are assumed to be entirely flat.
+    const int lx = x % TILE_SIZE, ly = y % TILE_SIZE;
+    if (lx < TILE_HALO || lx >= TILE_SIZE - TILE_HALO || ly < TILE_HALO || ly >= TILE_SIZE - TILE_HALO || !GetTile(x, y))
+        AllocateTiles(x - TILE_HALO, y - TILE_HALO, x + TILE_HALO, y + TILE_HALO);
+    
+    return GetTile(x, y);
+}
+
+void RangeTerrain::GenerateFlatTileVertexData() {
+    
+    delete[] flatTileVertexData;
+    delete[] flatTileIndexData;
+    flatTileVertexData = new TerrainVertex[VERTICES_PER_TILE];
+    flatTileIndexData = new GLushort[INDICES_PER_TILE];
+    
+    // Same as written by UpdateVertexData() and UpdateDiagonal() for flat quads (diagonal down)
+    TerrainVertex flat;
+    flat.SetHeight(0);
+    flat.SetNormal(vec3(0, 1, 0));
+    flat.SetColor(ColorFromHeight(0));
+    flat.padding = 0;
+    for ( int i=0; i<VERTICES_PER_TILE; i++ )
+        flatTileVertexData[i] = flat;
+    
+    for ( int y=0; y<TILE_SIZE; y++ )
+        for ( int x=0; x<TILE_SIZE; x++ )
+            SetQuadIndices(flatTileIndexData, x, y, false);
+}
+
+int RangeTerrain::TilesSharingVertex(const int &x, const int &y, TerrainTile* sharing[4]) const {
+    
+    // a vertex on the west/south border of a tile is also the east/north border of the tiles before it
+    const int tx = x / TILE_SIZE, ty = y / TILE_SIZE;
+    const int min_tx = x % TILE_SIZE == 0 ? tx - 1 : tx;
+    const int min_ty = y % TILE_SIZE == 0 ? ty - 1 : ty;
+    
+    int count = 0;
+    for ( int sty=std::max(min_ty, 0); sty<=std::min(ty, quadTilesY - 1); sty++ )
+        for ( int stx=std::max(min_tx, 0); stx<=std::min(tx, quadTilesX - 1); stx++ )
+            if (TerrainTile* tile = TileAt(stx, sty))
+                sharing[count++] = tile;
+    
+    return count;
+}
+
+void RangeTerrain::SetVertexColor(const int &x, const int &y, const vec4 &c) {
+    
+    // The vertex needs vertex data of its own to be colored
+    TileForWriting(x, y);
     
-    for (int y=0; y<Y_INTERVAL; y++)
-        for (int x=0; x<X_INTERVAL; x++)
-            delete controlPoints[y][x];
+    TerrainTile* sharing[4];
+    int count = TilesSharingVertex(x, y, sharing);
+    for ( int i=0; i<count; i++ ) {
+        TerrainTile* tile = sharing[i];
+        int idx = TileVertex(x - tile->tx*TILE_SIZE, y - tile->ty*TILE_SIZE);
+        tile->changedVertexIndices.push_back( idx );
+        tile->vertexData[idx].SetColor(c);
+        changedTiles->SetChanged(tile->tx, tile->ty);
+    }
 }
 
 void RangeTerrain::SetControlPoint(int x, int y, float h, float spread, ControlPointFuncType functype) {
     
+    ControlPointHandle handle = controlPoints.Pinned(x, y);
+    ControlPoint cp(x, y, h, spread, functype);
+    
     // only do something if the control point exists
-    if (controlPoints[y][x]) {
+    if (handle != NO_CONTROL_POINT) {
         
         // old values for this control point
-        float old_h = controlPoints[y][x]->h;
-        float old_spread = controlPoints[y][x]->spread;
-        ControlPointFuncType old_functype = controlPoints[y][x]->functype;
+        ControlPoint old_cp = controlPointPool.Get(handle);
         
         // did control point change at all?
-        if (h == old_h && spread == old_spread && functype == old_functype)
+        if (h == old_cp.h && spread == old_cp.spread && functype == old_cp.functype)
             return;
         
-        // is hmap regeneration necessary
-        if(regenerationRequired || abs(h) < abs(old_h) || spread != old_spread || functype != old_functype)
-            regenerationRequired = true;
+        // the old lift is kept wherever it's larger than the new one, so its footprint must be evaluated from scratch
+        if(abs(h) < abs(old_cp.h) || h * old_cp.h < 0 || spread != old_cp.spread || functype != old_cp.functype)
+            SetFootprintChanged(old_cp);
+        
+        // perform change, in place so the handle stays valid
+        controlPointPool.Set(handle, cp);
+        controlPoints.Move(handle, Footprint(old_cp), Footprint(cp));
         
-        // delete old pointer
-        delete controlPoints[y][x];
+    } else {
+        
+        // add a new control point
+        TileForWriting(x, y);
+        handle = controlPointPool.Add(cp);
+        controlPoints.Insert(handle, x, y, Footprint(cp));
     }
     
-    // perform change
-    controlPoints[y][x] = new ControlPoint(x, y, h, spread, functype);
-    
     // remember change
     changedControlPoints->SetChanged(x, y);
 }
 
 void RangeTerrain::SetControlPointSpread(int x, int y, float spread) {
     
+    ControlPointHandle handle = controlPoints.Pinned(x, y);
+    
     // only do something if the control point exists
-    if (controlPoints[y][x]) {
+    if (handle != NO_CONTROL_POINT) {
 
         // old value
-        float old_spread = controlPoints[y][x]->spread;
+        ControlPoint old_cp = controlPointPool.Get(handle);
         
         // did control point change at all?
-        if (spread == old_spread)
+        if (spread == old_cp.spread)
             return;
         
-        // is hmap regeneration necessary
-        if(regenerationRequired || spread != old_spread )
-            regenerationRequired = true;
+        // the old footprint must be evaluated from scratch
+        SetFootprintChanged(old_cp);
         
         // perform the update
-        controlPoints[y][x]->spread = spread;
+        controlPointPool.spread[handle] = spread;
+        controlPoints.Move(handle, Footprint(old_cp), Footprint(controlPointPool.Get(handle)));
         
         // remember change
         changedControlPoints->SetChanged(x, y);
@@ -107,32 +285,71 @@ void RangeTerrain::SetControlPointSpread(int x, int y, float spread) {
 
 void RangeTerrain::SetControlPointFuncType(int x, int y, ControlPointFuncType functype) {
     
+    ControlPointHandle handle = controlPoints.Pinned(x, y);
+    
     // only do something if the control point exists
-    if (controlPoints[y][x]) {
-        
-        // old value
-        ControlPointFuncType old_functype = controlPoints[y][x]->functype;
+    if (handle != NO_CONTROL_POINT) {
         
         // did control point change at all?
-        if (functype == old_functype)
+        if (functype == controlPointPool.functype[handle])
             return;
         
-        // is hmap regeneration necessary
-        if(regenerationRequired || functype != old_functype )
-            regenerationRequired = true;
+        // the footprint must be evaluated from scratch
+        SetFootprintChanged(controlPointPool.Get(handle));
         
         // perform the update
-        controlPoints[y][x]->SetFuncType(functype);
+        controlPointPool.functype[handle] = functype;
         
         // remember change
         changedControlPoints->SetChanged(x, y);
     }
 }
 
+void RangeTerrain::RemoveControlPoint(int x, int y) {
+    
+    ControlPointHandle handle = controlPoints.Pinned(x, y);
+    
+    // only do something if the control point exists
+    if (handle != NO_CONTROL_POINT) {
+        
+        // everything the control point lifted, and its own sample, must be evaluated from scratch
+        ControlPoint cp = controlPointPool.Get(handle);
+        SetFootprintChanged(cp);
+        changedFootprints->SetChanged(x, y);
+        
+        // the slot is reused by the next control point added
+        controlPoints.Remove(handle, x, y, Footprint(cp));
+        controlPointPool.Remove(handle);
+        
+        // remember change
+        changedControlPoints->SetChanged(x, y);
+    }
+}
+
+rect RangeTerrain::Footprint(const ControlPoint &cp) const {
+    rect r;
+    r.min_x = ceil(std::max(cp.x - cp.spread / gridRes, 0.0f));
+    r.max_x = floor(std::min(cp.x + cp.spread / gridRes, float(xInterval - 1)));
+    r.min_y = ceil(std::max(cp.y - cp.spread / gridRes, 0.0f));
+    r.max_y = floor(std::min(cp.y + cp.spread / gridRes, float(yInterval - 1)));
+    return r;
+}
+
+void RangeTerrain::SetFootprintChanged(const ControlPoint &cp) {
+    
+    rect r = Footprint(cp);
+    for (int yy=r.min_y; yy<=r.max_y; yy++)
+        for (int xx=r.min_x; xx<=r.max_x; xx++)
+            changedFootprints->SetChanged(xx, yy);
+}
+
 void RangeTerrain::Reset() {
     
-    // clear control points
-    memset(controlPoints, NULL, Y_INTERVAL*X_INTERVAL*sizeof(ControlPoint*));
+    // clear control points (tiles are kept, as they still hold the noise)
+    controlPointPool.Clear();
+    controlPoints.Clear();
+    changedControlPoints->Reset();
+    changedFootprints->Reset();
 
     // flatten terrain
     FlattenHMap();
@@ -143,22 +360,39 @@ void RangeTerrain::Reset() {
 
 void RangeTerrain::FlattenHMap() {
     
-    for ( int y=0; y<Y_INTERVAL; y++ )
-        for ( int x=0; x<X_INTERVAL; x++ )
-            hmap[y][x] = 0;
+    for ( TerrainTile* tile : allocatedTiles )
+        memset(tile->hmap, 0, sizeof(tile->hmap));
 }
 
 void RangeTerrain::FlattenNoise() {
     
-    for ( int y=0; y<Y_INTERVAL; y++ )
-        for ( int x=0; x<X_INTERVAL; x++ )
-            noise[y][x] = 0;
+    CancelNoise();
+    
+    for ( TerrainTile* tile : allocatedTiles ) {
+        memset(tile->noise, 0, sizeof(tile->noise));
+        tile->noiseGradient.reset();
+    }
+    noiseGradients = false;
     
     regenerationRequired = true;
 }
 
+void RangeTerrain::SetHeightColors(float minHeight, float maxHeight, bool inShader) {
+    
+    bool vertexColorsChanged = !inShader || inShader != heightColorInShader;
+    colorRamp.Build(minHeight, maxHeight);
+    heightColorInShader = inShader;
+    
+    if (vertexColorsChanged) {
+        GenerateFlatTileVertexData();
+        regenerationRequired = true;
+    }
+}
+
 void RangeTerrain::Update() {
     
+    ApplyPendingNoise();
+    
     if (regenerationRequired) {
     
         Regenerate();
@@ -166,78 +400,299 @@ void RangeTerrain::Update() {
 
     } else if (ControlPointChanged()) {
     
+        // only the changed samples, and the samples whose normals depend on them, are updated
         UpdateHMap();
-        UpdateNormals();
         UpdateChangedVertices();
-//        UpdateVertexData();
-        GenerateVertexData();
+        UpdateNormals();
+        UpdateVertexData();
+        UpdateMaxHeights();
+        UpdateTriangles();
+        UpdateTileVersions();
 
         changedControlPoints->Reset();
         regenerationRequired = false;
+        
+        if (selfCheck)
+            CheckAgainstRegenerate();
     }
     
 }
 
 void RangeTerrain::Regenerate() {
     
+    changedFootprints->Reset();
     GenerateHMap();
     ApplyNoise();
     GenerateNormals();
     GenerateVertexData();
+    GenerateMaxHeights();
+    if (triangles.Built())
+        triangles.Build(*this);
     
     changedControlPoints->Reset();
     regenerationRequired = false;
+    regenerations++;
+    SetAllTilesChanged();
 }
 
 void RangeTerrain::UpdateHMap() { // Changes only away from y = 0
     
     changedHMapCoords->Reset();
-
-    for ( xy &xy : changedControlPoints->identifiers )
-        UpdateHMap(*controlPoints[xy.y][xy.x]);
+    
+    // Samples that a lowered control point was lifting, from the control points still influencing them
+    for ( xy &xy : changedFootprints->identifiers ) {
+        float h = EvaluateHeight(xy.x, xy.y);
+        if (h != Height(xy.x, xy.y)) {
+            TileForWriting(xy.x, xy.y)->hmap[xy.y % TILE_SIZE][xy.x % TILE_SIZE] = h;
+            changedHMapCoords->SetChanged(xy.x, xy.y);
+        }
+    }
+    changedFootprints->Reset();
+    
+    // Raised (or new) control points only lift the hmap
+    for ( xy &xy : changedControlPoints->identifiers ) {
+        ControlPointHandle handle = controlPoints.Pinned(xy.x, xy.y);
+        if (handle == NO_CONTROL_POINT)
+            continue; // removed
+        UpdateHMap(controlPointPool.Get(handle));
+        
+        // The control point sets its own sample regardless of the hmap, which
+        // Regenerate() follows by applying the noise
+        TerrainTile* tile = GetTile(xy.x, xy.y);
+        float &h = tile->hmap[xy.y % TILE_SIZE][xy.x % TILE_SIZE];
+        float noise = tile->noise[xy.y % TILE_SIZE][xy.x % TILE_SIZE];
+        if (abs(noise) > abs(h))
+            h = noise;
+    }
 }
 
 void RangeTerrain::GenerateHMap() {
     
     changedHMapCoords->Reset();
+    
+    if (parallelRegeneration) {
+        ParallelFor(tilesY, [this] (int ty) { GenerateHMapBand(ty); });
+        return;
+    }
+    
     FlattenHMap();
     
-    for ( int y=0; y<Y_INTERVAL; y++ )
-        for ( int x=0; x<X_INTERVAL; x++ )
-            if (controlPoints[y][x])
-                UpdateHMap(*controlPoints[y][x]);
+    for ( ControlPointHandle handle=0; handle<controlPointPool.Size(); handle++ )
+        if (controlPointPool.IsLive(handle))
+            UpdateHMap(controlPointPool.Get(handle));
+}
+
+void RangeTerrain::GenerateHMapBand(const int &ty) {
+    /*
+     Same as GenerateHMap(), for the samples in the tiles of row ty.
+     
+     The band is generated into a buffer of its own, applying the control points in the
+     same order, so each sample ends up the same. The tiles that GenerateHMap() would have
+     allocated (the halo around each written sample) are then allocated one band at a time,
+     and the band is copied into its tiles. Tiles allocated by other bands afterwards only
+     cover samples that are 0 in this band.
+     */
+    
+    const int y0 = ty * TILE_SIZE, y1 = std::min(y0 + TILE_SIZE, yInterval);
+    vector<float> band((y1 - y0) * xInterval, 0.0f);
+    vector<char> allocate(3 * tilesX, false);              // tile rows ty-1 to ty+1
+    vector<float> lifts;
+    
+    auto SetAllocate = [&] (const int &x, const int &y) {
+        const int max_tx = std::min(x + TILE_HALO, xInterval - 1) / TILE_SIZE;
+        const int max_ty = std::min(y + TILE_HALO, yInterval - 1) / TILE_SIZE;
+        for ( int aty=std::max(y - TILE_HALO, 0) / TILE_SIZE; aty<=max_ty; aty++ )
+            for ( int atx=std::max(x - TILE_HALO, 0) / TILE_SIZE; atx<=max_tx; atx++ )
+                allocate[(aty - ty + 1) * tilesX + atx] = true;
+    };
+    
+    vector<ControlPointHandle> handles, nearby;
+    vector<xyh> pinnedSamples;
+    controlPoints.Query( { 0, y0, xInterval - 1, y1 - 1 }, handles );
+    sort(handles.begin(), handles.end());
+    
+    for ( ControlPointHandle handle : handles ) {
+        const ControlPoint cp = controlPointPool.Get(handle);
+        
+        if (cp.y >= y0 && cp.y < y1) {
+            band[(cp.y - y0) * xInterval + cp.x] = cp.h;
+            SetAllocate(cp.x, cp.y);
+        }
+        
+        rect r = Footprint(cp);
+        r.min_y = std::max(r.min_y, y0);
+        r.max_y = std::min(r.max_y, y1 - 1);
+        
+        nearby.clear();
+        pinnedSamples.clear();
+        controlPoints.Query(r, nearby);
+        for ( ControlPointHandle other : nearby ) {
+            const int ox = controlPointPool.x[other], oy = controlPointPool.y[other];
+            if ((ox != cp.x || oy != cp.y) && ox >= r.min_x && ox <= r.max_x && oy >= r.min_y && oy <= r.max_y)
+                pinnedSamples.push_back( { ox, oy, band[(oy - y0) * xInterval + ox] } );
+        }
+        
+        lifts.resize(r.max_x - r.min_x + 1);
+        for (int yy=r.min_y; yy<=r.max_y; yy++) {
+            cp.lift_row(yy, r.min_x, (int) lifts.size(), gridRes, &lifts[0]);
+            float* row = &band[(yy - y0) * xInterval];
+            for (int xx=r.min_x; xx<=r.max_x; xx++) {
+                float h = lifts[xx - r.min_x];
+                if (abs(h) > abs(row[xx])) {
+                    if (row[xx] == 0)
+                        SetAllocate(xx, yy);
+                    row[xx] = h;
+                }
+            }
+        }
+        
+        for ( xyh &p : pinnedSamples )
+            band[(p.y - y0) * xInterval + p.x] = p.h;
+    }
+    
+    vector<TerrainTile*> bandTiles(tilesX);
+    {
+        lock_guard<mutex> lock(allocationMutex);
+        for ( int aty=std::max(ty - 1, 0); aty<=std::min(ty + 1, tilesY - 1); aty++ )
+            for ( int atx=0; atx<tilesX; atx++ )
+                if (allocate[(aty - ty + 1) * tilesX + atx])
+                    AllocateTiles(atx * TILE_SIZE, aty * TILE_SIZE, atx * TILE_SIZE, aty * TILE_SIZE);
+        for ( int tx=0; tx<tilesX; tx++ )
+            bandTiles[tx] = tiles[ty * tilesX + tx];
+    }
+    
+    for ( TerrainTile* tile : bandTiles ) {
+        if (!tile)
+            continue;
+        memset(tile->hmap, 0, sizeof(tile->hmap));
+        const int x0 = tile->tx * TILE_SIZE, x1 = std::min(x0 + TILE_SIZE, xInterval);
+        for ( int y=y0; y<y1; y++ )
+            memcpy(tile->hmap[y - y0], &band[(y - y0) * xInterval + x0], (x1 - x0) * sizeof(float));
+    }
 }
 
 void RangeTerrain::UpdateChangedVertices() {
     
     changedVertices->Reset();
     
+    // One vertex per sample, but the normals of the neighbours depend on it too (and
+    // the diagonals of the quads around each vertex are updated along with it)
     int x, y;
     for ( xy &xy : changedHMapCoords->identifiers ) {
-        // The grid of triangles is one less than the hmap, adjustment
-        // at boundary causes adjustment of the correct triangles
         x = xy.x;
         y = xy.y;
-        if (x == X_INTERVAL - 1) { x--; }
-        if (y == Y_INTERVAL - 1) { y--; }
         
-        changedVertices->SetChanged( x  , y   );
-        changedVertices->SetChanged( x  , y+1 );
-        changedVertices->SetChanged( x+1, y   );
-        changedVertices->SetChanged( x+1, y+1 );
+        changedVertices->SetChanged( x, y );
+        if (x > 0)              changedVertices->SetChanged( x-1, y   );
+        if (x < xInterval - 1)  changedVertices->SetChanged( x+1, y   );
+        if (y > 0)              changedVertices->SetChanged( x  , y-1 );
+        if (y < yInterval - 1)  changedVertices->SetChanged( x  , y+1 );
     }
 }
+
 void RangeTerrain::UpdateNormals() {
     
-    for ( xy &xy : changedHMapCoords->identifiers )
+    for ( xy &xy : changedVertices->identifiers )
         UpdateNormal(xy.x, xy.y);
 }
 
 void RangeTerrain::GenerateNormals() {
     
-    for ( int y=0; y<Y_INTERVAL; y++ )
-        for ( int x=0; x<X_INTERVAL; x++ )
-            UpdateNormal(x, y);
+    // a normal only reads the hmap, and is written to the tile of its sample
+    ParallelFor((int) allocatedTiles.size(), [this] (int i) {
+        const TerrainTile* tile = allocatedTiles[i];
+        const int x0 = tile->tx * TILE_SIZE, y0 = tile->ty * TILE_SIZE;
+        const int x1 = std::min(x0 + TILE_SIZE, xInterval), y1 = std::min(y0 + TILE_SIZE, yInterval);
+        for ( int y=y0; y<y1; y++ )
+            for ( int x=x0; x<x1; x++ )
+                UpdateNormal(x, y);
+    });
+}
+
+void RangeTerrain::GenerateMaxHeights() {
+    
+    maxHeights.SetAllQuads([this] (int x, int y) { return QuadMaxHeight(x, y); });
+}
+
+void RangeTerrain::UpdateMaxHeights() {
+    
+    // the quads around each changed sample
+    for ( xy &xy : changedHMapCoords->identifiers ) {
+        for ( int y=std::max(xy.y - 1, 0); y<=std::min(xy.y, yInterval - 2); y++ )
+            for ( int x=std::max(xy.x - 1, 0); x<=std::min(xy.x, xInterval - 2); x++ )
+                maxHeights.SetQuad(x, y, QuadMaxHeight(x, y));
+    }
+    maxHeights.Propagate();
+}
+
+void RangeTerrain::UpdateTriangles() {
+    
+    if (!triangles.Built())
+        return;
+    
+    // the quads around each changed vertex, whose positions or diagonals may have changed
+    for ( xy &xy : changedVertices->identifiers )
+        for ( int y=std::max(xy.y - 1, 0); y<=std::min(xy.y, yInterval - 2); y++ )
+            for ( int x=std::max(xy.x - 1, 0); x<=std::min(xy.x, xInterval - 2); x++ )
+                triangles.SetQuadChanged(x, y);
+    triangles.Refresh(*this);
+}
+
+void RangeTerrain::UpdateTileVersions() {
+    
+    // the tiles of the quads around each changed vertex, as for the triangles
+    versionClock++;
+    for ( xy &xy : changedVertices->identifiers )
+        for ( int y=std::max(xy.y - 1, 0); y<=std::min(xy.y, yInterval - 2); y++ )
+            for ( int x=std::max(xy.x - 1, 0); x<=std::min(xy.x, xInterval - 2); x++ )
+                tileVersions[(y / TILE_SIZE) * quadTilesX + x / TILE_SIZE] = versionClock;
+}
+
+void RangeTerrain::SetAllTilesChanged() {
+    
+    tileVersions.assign(quadTilesX * quadTilesY, ++versionClock);
+}
+
+float RangeTerrain::SurfaceHeight(const float &x, const float &z) const {
+    
+    // in samples, along x and -z
+    const float sx = x / gridRes, sy = -z / gridRes;
+    if (!(sx >= 0 && sy >= 0 && sx <= xInterval - 1 && sy <= yInterval - 1))
+        return -std::numeric_limits<float>::infinity();
+    
+    const int qx = std::min((int) sx, xInterval - 2), qy = std::min((int) sy, yInterval - 2);
+    const float u = sx - qx, v = sy - qy;
+    const float h1 = Height(qx  , qy  ), h2 = Height(qx  , qy+1);
+    const float h3 = Height(qx+1, qy  ), h4 = Height(qx+1, qy+1);
+    
+    // on the plane of the triangle of the quad the point is in, on either side of its diagonal
+    if (DiagonalUp(qx, qy))
+        return u + v <= 1 ? h1 + u * (h3 - h1) + v * (h2 - h1) : h4 + (1 - u) * (h2 - h4) + (1 - v) * (h3 - h4);
+    else
+        return v >= u ? h1 + u * (h4 - h2) + v * (h2 - h1) : h1 + u * (h3 - h1) + v * (h4 - h3);
+}
+
+unsigned int RangeTerrain::QuadsVersion(int x0, int y0, int x1, int y1) const {
+    
+    x0 = std::max(x0, 0);
+    y0 = std::max(y0, 0);
+    x1 = std::min(x1, xInterval - 2);
+    y1 = std::min(y1, yInterval - 2);
+    if (x0 > x1 || y0 > y1)
+        return 0;
+    
+    unsigned int version = 0;
+    for ( int ty=y0 / TILE_SIZE; ty<=y1 / TILE_SIZE; ty++ )
+        for ( int tx=x0 / TILE_SIZE; tx<=x1 / TILE_SIZE; tx++ )
+            version = std::max(version, tileVersions[ty * quadTilesX + tx]);
+    return version;
+}
+
+const TriangleCache& RangeTerrain::Triangles() {
+    
+    if (!triangles.Built())
+        triangles.Build(*this);
+    return triangles;
 }
 
 void RangeTerrain::UpdateVertexData() {
@@ -248,205 +703,505 @@ void RangeTerrain::UpdateVertexData() {
 
 void RangeTerrain::GenerateVertexData() {
     
-    for ( int y=0; y<Y_INTERVAL; y++ )
-        for ( int x=0; x<X_INTERVAL; x++ )
-            UpdateVertexData(x, y);
+    if (parallelRegeneration) {
+        // each tile writes its own copy of the vertices it shares with the tiles around it
+        ParallelFor((int) allocatedTiles.size(), [this] (int i) {
+            if (allocatedTiles[i]->vertexData)
+                GenerateVertexData(allocatedTiles[i]);
+        });
+        for ( TerrainTile* tile : allocatedTiles )
+            if (tile->vertexData)
+                changedTiles->SetChanged(tile->tx, tile->ty);
+        return;
+    }
+    
+    // samples in unallocated tiles are flat, as are the parts of quads touching them
+    for ( TerrainTile* tile : allocatedTiles ) {
+        const int x0 = tile->tx * TILE_SIZE, y0 = tile->ty * TILE_SIZE;
+        const int x1 = std::min(x0 + TILE_SIZE, xInterval), y1 = std::min(y0 + TILE_SIZE, yInterval);
+        for ( int y=y0; y<y1; y++ )
+            for ( int x=x0; x<x1; x++ )
+                UpdateVertexData(x, y);
+    }
+}
+
+void RangeTerrain::GenerateVertexData(TerrainTile* tile) {
+    
+    // the vertices UpdateVertexData() writes to the tile, from the samples in allocated tiles
+    const int x0 = tile->tx * TILE_SIZE, y0 = tile->ty * TILE_SIZE;
+    for ( int ly=0; ly<TILE_VERTICES_X; ly++ ) {
+        for ( int lx=0; lx<TILE_VERTICES_X; lx++ ) {
+            const int x = x0 + lx, y = y0 + ly;
+            if (!GetTile(x, y))
+                continue;
+            const float h = Height(x, y);
+            WriteVertexData(tile, TileVertex(lx, ly), h, Normal(x, y), ColorFromHeight(h));
+        }
+    }
+    
+    for ( int ly=0; ly<TILE_SIZE; ly++ )
+        for ( int lx=0; lx<TILE_SIZE; lx++ )
+            UpdateDiagonal(tile, lx, ly);
+}
+
+void RangeTerrain::ParallelFor(const int &count, const function<void (int)> &body) {
+    
+    if (parallelRegeneration) {
+        gWorkerPool.ParallelFor(count, body);
+    } else {
+        for ( int i=0; i<count; i++ )
+            body(i);
+    }
+}
+
+bool RangeTerrain::CheckAgainstRegenerate() {
+    
+    // Copy the incrementally updated state of every tile
+    struct TileState {
+        float hmap[TILE_SIZE][TILE_SIZE];
+        vec3 normals[TILE_SIZE][TILE_SIZE];
+        bool diagonalUp[TILE_SIZE][TILE_SIZE];
+        vector<TerrainVertex> vertices;
+    };
+    vector<TileState> states(allocatedTiles.size());
+    for ( int i=0; i<(int) allocatedTiles.size(); i++ ) {
+        const TerrainTile* tile = allocatedTiles[i];
+        memcpy(states[i].hmap, tile->hmap, sizeof(tile->hmap));
+        memcpy(states[i].normals, tile->normals, sizeof(tile->normals));
+        memcpy(states[i].diagonalUp, tile->diagonalUp, sizeof(tile->diagonalUp));
+        if (tile->vertexData)
+            states[i].vertices.assign(tile->vertexData, tile->vertexData + VERTICES_PER_TILE);
+    }
+    
+    const HeightPyramid maxHeightsState = maxHeights;
+    const TriangleCache trianglesState = triangles;
+    
+    // Regenerate() writes the same samples, so any tile it allocates is a difference in itself
+    Regenerate();
+    
+    const bool maxHeightsDiffer = !(maxHeightsState == maxHeights);
+    if (maxHeightsDiffer)
+        cout << "Self-check: max height pyramid differs from regeneration" << endl;
+    
+    const bool trianglesDiffer = !(trianglesState == triangles);
+    if (trianglesDiffer)
+        cout << "Self-check: triangle cache differs from regeneration" << endl;
+    
+    int differences = 0;
+    if (allocatedTiles.size() != states.size())
+        cout << "Self-check: regeneration allocated " << allocatedTiles.size() - states.size() << " more tiles" << endl;
+    
+    for ( int i=0; i<(int) states.size(); i++ ) {
+        const TerrainTile* tile = allocatedTiles[i];
+        const TileState &state = states[i];
+        
+        for ( int y=0; y<TILE_SIZE; y++ ) {
+            for ( int x=0; x<TILE_SIZE; x++ ) {
+                
+                bool differs = state.hmap[y][x] != tile->hmap[y][x] || state.normals[y][x] != tile->normals[y][x];
+                if (tile->vertexData) {
+                    differs |= state.diagonalUp[y][x] != tile->diagonalUp[y][x];
+                    differs |= memcmp(&state.vertices[TileVertex(x, y)], &tile->vertexData[TileVertex(x, y)], sizeof(TerrainVertex)) != 0;
+                }
+                
+                if (differs && differences++ < 10) {
+                    cout << "Self-check: (" << tile->tx * TILE_SIZE + x << ", " << tile->ty * TILE_SIZE + y << ") "
+                         << "hmap " << state.hmap[y][x] << " vs " << tile->hmap[y][x]
+                         << ", diagonal up " << state.diagonalUp[y][x] << " vs " << tile->diagonalUp[y][x] << endl;
+                }
+            }
+        }
+    }
+    
+    if (differences)
+        cout << "Self-check: incremental update differs from regeneration at " << differences << " samples" << endl;
+    
+    return differences == 0 && allocatedTiles.size() == states.size() && !maxHeightsDiffer && !trianglesDiffer;
+}
+
+// Planes of a noise field: the noise, and its derivatives along x and y if the engine has them
+static int NoisePlanes(const NoiseEngine &engine) {
+    return engine == NOISE_GRADIENT ? 3 : 1;
 }
 
 void RangeTerrain::SetNoise(double _persistence, double _frequency, double _amplitude, int _octaves, int _randomseed) {
+    
+    CancelNoise();
+    
     PerlinNoise pn(_persistence, _frequency, _amplitude, _octaves, _randomseed);
-    for( int x=0; x<X_INTERVAL; x++)
-        for( int y=0; y<Y_INTERVAL; y++)
-            noise[y][x] = pn.GetHeight(x, y);
+    vector<float> field(xInterval * yInterval * NoisePlanes(noiseEngine));
+    GenerateNoise(pn, noiseEngine, xInterval, yInterval, &field[0], [] { return false; });
+    SetNoiseField(field);
+}
+
+void RangeTerrain::RequestNoise(double _persistence, double _frequency, double _amplitude, int _octaves, int _randomseed) {
+    
+    CancelNoise();
+    
+    // the thread only reads what it is given, and the noise cache, which has its own lock
+    const int request = ++noiseRequest;
+    const PerlinNoise pn(_persistence, _frequency, _amplitude, _octaves, _randomseed);
+    const NoiseEngine engine = noiseEngine;
+    const int width = xInterval, height = yInterval;
+    
+    noiseThread = thread([this, request, pn, engine, width, height] {
+        auto cancelled = [this, request] { return noiseRequest != request; };
+        vector<float> field;
+        
+        // previews evaluated every 8, 4 and 2 samples (without derivatives), then the full noise
+        for ( int step=8; step>=1; step/=2 ) {
+            field.resize(width * height * (step > 1 ? 1 : NoisePlanes(engine)));
+            if (step > 1)
+                GenerateCoarseNoise(pn, engine, width, height, step, &field[0]);
+            else if (!GenerateNoise(pn, engine, width, height, &field[0], cancelled))
+                return;
+            
+            // replaces a preview Update() has not applied yet
+            lock_guard<mutex> lock(noiseMutex);
+            if (cancelled())
+                return;
+            pendingNoise.swap(field);
+            pendingNoiseStep = step;
+        }
+    });
+}
+
+void RangeTerrain::CancelNoise() {
+    
+    // the thread checks the request between rows of tiles, so this doesn't wait long
+    noiseRequest++;
+    if (noiseThread.joinable())
+        noiseThread.join();
+    
+    lock_guard<mutex> lock(noiseMutex);
+    pendingNoise.clear();
+}
+
+bool RangeTerrain::ApplyPendingNoise() {
+    
+    vector<float> field;
+    int step;
+    {
+        lock_guard<mutex> lock(noiseMutex);
+        if (pendingNoise.empty())
+            return false;
+        field.swap(pendingNoise);
+        step = pendingNoiseStep;
+    }
+    
+    SetNoiseField(field);
+    
+    // the full noise is the last the thread publishes
+    if (step == 1)
+        noiseThread.join();
+    
+    return true;
+}
+
+void RangeTerrain::SetNoiseField(const vector<float> &field) {
+    
+    const int samples = xInterval * yInterval;
+    assert((int) field.size() == samples || (int) field.size() == 3 * samples);
+    noiseGradients = (int) field.size() == 3 * samples;
+    
+    // noise covers every sample
+    AllocateTiles(0, 0, xInterval - 1, yInterval - 1);
+    ParallelFor(tilesY, [&] (int ty) {
+        const int y0 = ty * TILE_SIZE, y1 = std::min(y0 + TILE_SIZE, yInterval);
+        for ( int tx=0; tx<tilesX; tx++ ) {
+            TerrainTile* tile = TileAt(tx, ty);
+            const int x0 = tx * TILE_SIZE, x1 = std::min(x0 + TILE_SIZE, xInterval);
+            if (!noiseGradients)
+                tile->noiseGradient.reset();
+            else if (!tile->noiseGradient)
+                tile->noiseGradient.reset(new vec2[TILE_SIZE * TILE_SIZE]);
+            for ( int y=y0; y<y1; y++ ) {
+                memcpy(tile->noise[y - y0], &field[y * xInterval + x0], (x1 - x0) * sizeof(float));
+                if (noiseGradients)
+                    for ( int x=x0; x<x1; x++ )
+                        tile->noiseGradient[(y - y0) * TILE_SIZE + x - x0] = vec2(field[samples + y * xInterval + x], field[2 * samples + y * xInterval + x]);
+            }
+        }
+    });
     
     regenerationRequired = true;
 }
 
-void RangeTerrain::ApplyNoise() {
-    for( int x=0; x<X_INTERVAL; x++) {
-        for( int y=0; y<Y_INTERVAL; y++) {
-            if (abs(noise[y][x]) > abs(hmap[y][x]))
-                hmap[y][x] = noise[y][x];
+bool RangeTerrain::GenerateNoise(const PerlinNoise &pn, NoiseEngine engine, int width, int height, float* field, const function<bool ()> &cancelled) {
+    
+    // every octave of the noise, with unit amplitude, from the cache or evaluated now
+    const int octaves = pn.Octaves();
+    vector<NoiseLayerCache::Layer> layers(octaves);
+    vector<double> weights(octaves);
+    double _changing_amp = 1;
+    double _freq = pn.Frequency();
+    for ( int i=0; i<octaves; i++ ) {
+        NoiseLayerKey key = { pn.Frequency(), i, pn.RandomSeed(), engine, width, height };
+        layers[i] = noiseLayers.Find(key);
+        if (!layers[i]) {
+            layers[i] = GenerateNoiseLayer(key, _freq, cancelled);
+            if (!layers[i])
+                return false;
+            noiseLayers.Insert(key, layers[i]);
+        }
+        weights[i] = _changing_amp;
+        _changing_amp *= pn.Persistence();
+        _freq *= 2;
+    }
+    
+    // the weighted sum of the layers, as in PerlinNoise::GetHeight(), a row of tiles at a time.
+    // The derivatives add up the same way.
+    const int planes = NoisePlanes(engine);
+    ParallelFor((height + TILE_SIZE - 1) / TILE_SIZE, [&] (int band) {
+        vector<double> row(width);
+        for ( int p=0; p<planes; p++ ) {
+            for ( int y=band * TILE_SIZE; y<std::min((band + 1) * TILE_SIZE, height); y++ ) {
+                const int offset = (p * height + y) * width;
+                std::fill(row.begin(), row.end(), 0.0);
+                for ( int i=0; i<octaves; i++ ) {
+                    const float* layer = &(*layers[i])[offset];
+                    for ( int x=0; x<width; x++ )
+                        row[x] += layer[x] * weights[i];
+                }
+                for ( int x=0; x<width; x++ )
+                    field[offset + x] = row[x] * pn.Amplitude();
+            }
+        }
+    });
+    
+    return true;
+}
+
+void RangeTerrain::GenerateCoarseNoise(const PerlinNoise &pn, NoiseEngine engine, int width, int height, int step, float* field) {
+    
+    // noise at every step samples is the noise at every sample, step times the frequency
+    PerlinNoise coarse = pn;
+    coarse.SetFrequency(pn.Frequency() * step);
+    const int coarseWidth = (width - 1) / step + 2, coarseHeight = (height - 1) / step + 2;
+    vector<float> samples(coarseWidth * coarseHeight);
+    coarse.GetHeights(0, 0, coarseWidth, coarseHeight, &samples[0], engine);
+    
+    for ( int y=0; y<height; y++ ) {
+        const int cy = y / step;
+        const float fy = float(y % step) / step;
+        for ( int x=0; x<width; x++ ) {
+            const int cx = x / step;
+            const float fx = float(x % step) / step;
+            const float* s = &samples[cy * coarseWidth + cx];
+            field[y * width + x] = mix(mix(s[0], s[1], fx), mix(s[coarseWidth], s[coarseWidth + 1], fx), fy);
         }
     }
 }
 
+NoiseLayerCache::Layer RangeTerrain::GenerateNoiseLayer(const NoiseLayerKey &key, double frequency, const function<bool ()> &cancelled) {
+    
+    // a single octave with unit amplitude, a row of tiles at a time
+    PerlinNoise pn(1, frequency, 1, 1, key.seed);
+    const int samples = key.width * key.height;
+    shared_ptr<vector<float>> layer = make_shared<vector<float>>(samples * NoisePlanes(key.engine));
+    ParallelFor((key.height + TILE_SIZE - 1) / TILE_SIZE, [&] (int band) {
+        if (cancelled())
+            return;
+        const int y0 = band * TILE_SIZE, y1 = std::min(y0 + TILE_SIZE, key.height);
+        float* out = &(*layer)[y0 * key.width];
+        if (key.engine == NOISE_GRADIENT)
+            pn.GetGradientHeights(0, y0, key.width, y1 - y0, out, out + samples, out + 2 * samples);
+        else
+            pn.GetHeights(0, y0, key.width, y1 - y0, out, key.engine);
+    });
+    
+    return cancelled() ? NULL : layer;
+}
+
+void RangeTerrain::ApplyNoise() {
+    ParallelFor((int) allocatedTiles.size(), [this] (int i) {
+        TerrainTile* tile = allocatedTiles[i];
+        for( int y=0; y<TILE_SIZE; y++) {
+            for( int x=0; x<TILE_SIZE; x++) {
+                if (abs(tile->noise[y][x]) > abs(tile->hmap[y][x]))
+                    tile->hmap[y][x] = tile->noise[y][x];
+            }
+        }
+    });
+}
+
 void RangeTerrain::UpdateHMap(const ControlPoint &cp) {
 
     // Height of control point itself
-    hmap[cp.y][cp.x] = cp.h;
+    TileForWriting(cp.x, cp.y)->hmap[cp.y % TILE_SIZE][cp.x % TILE_SIZE] = cp.h;
     changedHMapCoords->SetChanged(cp.x, cp.y);
     
-    // Height of surrounding points
-    int min_x = ceil(std::max(cp.x - cp.spread / GRID_RES, 0.0f));
-    int max_x = floor(std::min(cp.x + cp.spread / GRID_RES, float(X_INTERVAL - 1)));
-    int min_y = ceil(std::max(cp.y - cp.spread / GRID_RES, 0.0f));
-    int max_y = floor(std::min(cp.y + cp.spread / GRID_RES, float(Y_INTERVAL - 1)));
-    for (int yy=min_y; yy<=max_y; yy++) {
-        for (int xx=min_x; xx<=max_x; xx++) {
-            float h = cp.lift(xx, yy);
-            if (!controlPoints[yy][xx] && abs(h) > abs(hmap[yy][xx])) {
-                hmap[yy][xx] = h;
+    // Samples pinned by other control points keep their height, which is restored afterwards
+    rect r = Footprint(cp);
+    vector<ControlPointHandle> nearby;
+    vector<xyh> pinnedSamples;
+    controlPoints.Query(r, nearby);
+    for ( ControlPointHandle other : nearby ) {
+        const int ox = controlPointPool.x[other], oy = controlPointPool.y[other];
+        if ((ox != cp.x || oy != cp.y) && ox >= r.min_x && ox <= r.max_x && oy >= r.min_y && oy <= r.max_y)
+            pinnedSamples.push_back( { ox, oy, Height(ox, oy) } );
+    }
+    
+    // Height of surrounding points, a row at a time
+    liftBuffer.resize(r.max_x - r.min_x + 1);
+    for (int yy=r.min_y; yy<=r.max_y; yy++) {
+        cp.lift_row(yy, r.min_x, (int) liftBuffer.size(), gridRes, &liftBuffer[0]);
+        for (int xx=r.min_x; xx<=r.max_x; xx++) {
+            float h = liftBuffer[xx - r.min_x];
+            if (abs(h) > abs(Height(xx, yy))) {
+                TileForWriting(xx, yy)->hmap[yy % TILE_SIZE][xx % TILE_SIZE] = h;
                 changedHMapCoords->SetChanged(xx, yy);
             }
         }
     }
+    
+    for ( xyh &p : pinnedSamples )
+        GetTile(p.x, p.y)->hmap[p.y % TILE_SIZE][p.x % TILE_SIZE] = p.h;
 }
 
-void RangeTerrain::UpdateNormal(const int &x, const int &y) {
+float RangeTerrain::EvaluateHeight(const int &x, const int &y) const {
+    
+    // Same as GenerateHMap() followed by ApplyNoise(), for a single sample
+    const TerrainTile* tile = GetTile(x, y);
+    const ControlPointHandle pinned = controlPoints.Pinned(x, y);
+    
+    float h = 0;
+    if (pinned != NO_CONTROL_POINT) {
+        h = controlPointPool.h[pinned];
+    } else {
+        for ( const ControlPointIndex::Entry &e : controlPoints.Near(x, y) ) {
+            if (x < e.footprint.min_x || x > e.footprint.max_x || y < e.footprint.min_y || y > e.footprint.max_y)
+                continue;
+            float lift = controlPointPool.Lift(e.cp, x, y, gridRes);
+            if (abs(lift) > abs(h))
+                h = lift;
+        }
+    }
+    
+    float noise = tile ? tile->noise[y % TILE_SIZE][x % TILE_SIZE] : 0;
+    if (abs(noise) > abs(h))
+        h = noise;
+    
+    return h;
+}
+
+bool RangeTerrain::IsNoise(const int &x, const int &y) const {
+    const TerrainTile* tile = GetTile(x, y);
+    return tile && tile->hmap[y % TILE_SIZE][x % TILE_SIZE] == tile->noise[y % TILE_SIZE][x % TILE_SIZE];
+}
 
-    float hs = (y == 0 ?              2*hmap[y][x]-hmap[y+1][x] : hmap[y-1][x]); // North
-    float hn = (y == Y_INTERVAL - 1 ? 2*hmap[y][x]-hmap[y-1][x] : hmap[y+1][x]); // South
-    float hw = (x == 0 ?              2*hmap[y][x]-hmap[y][x+1] : hmap[y][x-1]); // West
-    float he = (x == X_INTERVAL - 1 ? 2*hmap[y][x]-hmap[y][x-1] : hmap[y][x+1]); // East
+void RangeTerrain::UpdateNormal(const int &x, const int &y) {
+    
+    // samples in unallocated tiles keep pointing straight up
+    TerrainTile* tile = GetTile(x, y);
+    if (!tile)
+        return;
+    
+    // where the height is the noise, its derivatives give the normal, unless a neighbour the
+    // differences below read is lifted, which would leave a seam around the lift
+    const int lx = x % TILE_SIZE, ly = y % TILE_SIZE;
+    if (noiseGradients && tile->noiseGradient && IsNoise(x, y) &&
+        (x == 0 || IsNoise(x-1, y)) && (x == xInterval - 1 || IsNoise(x+1, y)) &&
+        (y == 0 || IsNoise(x, y-1)) && (y == yInterval - 1 || IsNoise(x, y+1))) {
+        const vec2 d = tile->noiseGradient[ly * TILE_SIZE + lx];
+        tile->normals[ly][lx] = glm::normalize(vec3(-d.x, gridRes, d.y));
+        return;
+    }
     
-    normals[y][x] = glm::normalize(vec3(hw - he, 2 * GRID_RES, hn - hs));
+    float h  = Height(x, y);
+    float hs = (y == 0 ?             2*h-Height(x, y+1) : Height(x, y-1)); // North
+    float hn = (y == yInterval - 1 ? 2*h-Height(x, y-1) : Height(x, y+1)); // South
+    float hw = (x == 0 ?             2*h-Height(x+1, y) : Height(x-1, y)); // West
+    float he = (x == xInterval - 1 ? 2*h-Height(x-1, y) : Height(x+1, y)); // East
+    
+    tile->normals[ly][lx] = glm::normalize(vec3(hw - he, 2 * gridRes, hn - hs));
 }
 
 void RangeTerrain::UpdateVertexData(const int &x, const int &y) {
     /*
      x,y are vertex coordinates.
      
-     Vertex order in memory of TrianglePairs:
-     diagonalUp == True:    v1  v2  v3  v4  v3  v2
-     diagonalUp == False:   v1  v4  v2  v4  v3  v1
+     The vertex is written to every tile sharing it (its position there is implicit
+     in the vertex index). Tiles that aren't allocated are skipped as they're flat.
      
-     Orientation:
-     North =  z
-     South = -z
-     East  =  x
-     West  = -x
+     The diagonals of the (up to) four quads around the vertex depend on its height,
+     so these are updated as well.
      */
     
-    int idx;
-    vec3 v = vec3(x * GRID_RES, hmap[y][x], -y * GRID_RES);
-    vec3 n = normals[y][x];
-    vec4 c = ColorFromHeight(hmap[y][x]);
+    const float h = Height(x, y);
+    const vec3 n = Normal(x, y);
+    const vec4 c = ColorFromHeight(h);
     
-    // v1 in South East triangle pair
-    if (x < X_INTERVAL - 1 && y < Y_INTERVAL - 1) {
-        
-        bool diagonalUp = abs(hmap[y][x] - hmap[y+1][x+1]) > abs(hmap[y+1][x] - hmap[y][x+1]);
-        
-        if (diagonalUp) {
-            idx = (y  )*FLOATS_PER_ROW + (x  )*FLOATS_PER_TRIANGLE_PAIR + 0*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(0, 0), n, c);
-        } else {
-            idx = (y  )*FLOATS_PER_ROW + (x  )*FLOATS_PER_TRIANGLE_PAIR + 0*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(0, 0), n, c);
-            
-            idx = (y  )*FLOATS_PER_ROW + (x  )*FLOATS_PER_TRIANGLE_PAIR + 5*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(0, 0), n, c);
-        }
+    TerrainTile* sharing[4];
+    int count = TilesSharingVertex(x, y, sharing);
+    for ( int i=0; i<count; i++ ) {
+        TerrainTile* tile = sharing[i];
+        SetVertexData(tile, TileVertex(x - tile->tx*TILE_SIZE, y - tile->ty*TILE_SIZE), h, n, c);
     }
     
-    // v2 in North East triangle pair
-    if (x < X_INTERVAL - 1 && y > 0) {
-        
-        bool diagonalUp = abs(hmap[y-1][x] - hmap[y][x+1]) > abs(hmap[y][x] - hmap[y-1][x+1]);
-        
-        if (diagonalUp) {
-            idx = (y-1)*FLOATS_PER_ROW + (x  )*FLOATS_PER_TRIANGLE_PAIR + 1*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(0, 1), n, c);
-            
-            idx = (y-1)*FLOATS_PER_ROW + (x  )*FLOATS_PER_TRIANGLE_PAIR + 5*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(0, 1), n, c);
-        } else {
-            idx = (y-1)*FLOATS_PER_ROW + (x  )*FLOATS_PER_TRIANGLE_PAIR + 2*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(0, 1), n, c);
-        }
-    }
+    for ( int qy=std::max(y - 1, 0); qy<=std::min(y, yInterval - 2); qy++ )
+        for ( int qx=std::max(x - 1, 0); qx<=std::min(x, xInterval - 2); qx++ )
+            UpdateDiagonal(qx, qy);
+}
+
+void RangeTerrain::UpdateDiagonal(const int &x, const int &y) {
     
-    // v3 in South West triangle pair
-    if (x > 0 && y < Y_INTERVAL - 1) {
-        
-        bool diagonalUp = abs(hmap[y][x-1] - hmap[y+1][x]) > abs(hmap[y+1][x-1] - hmap[y][x]);
-        
-        if (diagonalUp) {
-            idx = (y  )*FLOATS_PER_ROW + (x-1)*FLOATS_PER_TRIANGLE_PAIR + 2*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(1, 0), n, c);
-            
-            idx = (y  )*FLOATS_PER_ROW + (x-1)*FLOATS_PER_TRIANGLE_PAIR + 4*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(1, 0), n, c);
-        } else {
-            idx = (y  )*FLOATS_PER_ROW + (x-1)*FLOATS_PER_TRIANGLE_PAIR + 4*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(1, 0), n, c);
-        }
-    }
+    // quads in unallocated tiles are flat, and keep the diagonal down
+    TerrainTile* tile = GetTile(x, y);
+    if (!tile)
+        return;
     
+    if (UpdateDiagonal(tile, x % TILE_SIZE, y % TILE_SIZE))
+        changedTiles->SetChanged(tile->tx, tile->ty);
+}
+
+bool RangeTerrain::UpdateDiagonal(TerrainTile* tile, const int &lx, const int &ly) {
     
-    // v4 in North West triangle pair
-    if (x > 0 && y > 0) {
-        
-        bool diagonalUp = abs(hmap[y-1][x-1] - hmap[y][x]) > abs(hmap[y][x-1] - hmap[y-1][x]);
-        
-        if (diagonalUp) {
-            idx = (y-1)*FLOATS_PER_ROW + (x-1)*FLOATS_PER_TRIANGLE_PAIR + 3*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(1, 1), n, c);
-        } else {
-            idx = (y-1)*FLOATS_PER_ROW + (x-1)*FLOATS_PER_TRIANGLE_PAIR + 1*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(1, 1), n, c);
-            
-            idx = (y-1)*FLOATS_PER_ROW + (x-1)*FLOATS_PER_TRIANGLE_PAIR + 3*FLOATS_PER_VERTEX;
-            changedVertexIndices.push_back( idx );
-            SetVertexData(idx, v, vec2(1, 1), n, c);
-        }
+    const int x = tile->tx * TILE_SIZE + lx, y = tile->ty * TILE_SIZE + ly;
+    bool diagonalUp = abs(Height(x, y) - Height(x+1, y+1)) > abs(Height(x, y+1) - Height(x+1, y));
+    if (diagonalUp == tile->diagonalUp[ly][lx])
+        return false;
+    
+    tile->diagonalUp[ly][lx] = diagonalUp;
+    SetQuadIndices(tile->indexData, lx, ly, diagonalUp);
+    tile->changedQuadIndices.push_back( (ly * TILE_SIZE + lx) * INDICES_PER_QUAD );
+    return true;
+}
+
+void RangeTerrain::SetQuadIndices(GLushort* data, const int &lx, const int &ly, const bool &diagonalUp) {
+    
+    const GLushort v1 = TileVertex(lx  , ly  );
+    const GLushort v2 = TileVertex(lx  , ly+1);
+    const GLushort v3 = TileVertex(lx+1, ly  );
+    const GLushort v4 = TileVertex(lx+1, ly+1);
+    
+    int idx = (ly * TILE_SIZE + lx) * INDICES_PER_QUAD;
+    if (diagonalUp) {
+        data[idx++] = v1;   data[idx++] = v2;   data[idx++] = v3;
+        data[idx++] = v4;   data[idx++] = v3;   data[idx++] = v2;
+    } else {
+        data[idx++] = v1;   data[idx++] = v4;   data[idx++] = v2;
+        data[idx++] = v4;   data[idx++] = v3;   data[idx++] = v1;
     }
 }
 
-inline void RangeTerrain::SetVertexData(int idx, const vec3 &v, const vec2 &t, const vec3 &n, const vec4 &c) {
-    vertexData[idx++] = v.x;
-    vertexData[idx++] = v.y;
-    vertexData[idx++] = v.z;
-    vertexData[idx++] = t.x;
-    vertexData[idx++] = t.y;
-    vertexData[idx++] = n.x;
-    vertexData[idx++] = n.y;
-    vertexData[idx++] = n.z;
-    vertexData[idx++] = c.r;
-    vertexData[idx++] = c.g;
-    vertexData[idx++] = c.b;
-    vertexData[idx++] = c.a;
+inline void RangeTerrain::SetVertexData(TerrainTile* tile, int idx, const float &h, const vec3 &n, const vec4 &c) {
+    changedTiles->SetChanged(tile->tx, tile->ty);
+    WriteVertexData(tile, idx, h, n, c);
+}
+
+inline void RangeTerrain::WriteVertexData(TerrainTile* tile, int idx, const float &h, const vec3 &n, const vec4 &c) {
+    tile->changedVertexIndices.push_back( idx );
+    TerrainVertex &vertex = tile->vertexData[idx];
+    vertex.SetHeight(h);
+    vertex.SetNormal(n);
+    vertex.SetColor(c);
 }
 
 vec4 RangeTerrain::ColorFromHeight(const float &h) const {
-    vector<vec4> levels;
-    levels.push_back( vec4( 0.5,      0,      0,      1) ); // dark red
-    levels.push_back( vec4(   1,      0,      0,      1) ); // red
-    levels.push_back( vec4(   1,    0.5,      0,      1) ); // orange
-    levels.push_back( vec4(   1,      1,      0,      1) ); // yellow
-    levels.push_back( vec4(   0,      1,      0,      1) ); // green
-    levels.push_back( vec4(   0,      1,      1,      1) ); // cyan
-    levels.push_back( vec4(   0,      0,      1,      1) ); // blue
-    levels.push_back( vec4( 0.5,    0.5,      1,      1) ); // light blue
-    
-    float h_min = -5, h_max = 5;
-    
-    if (h <= h_min)
-        return levels.front();
-    
-    if (h >= h_max)
-        return levels.back();
-    
-    float idx = (levels.size() - 1) * (h - h_min) / (h_max - h_min);
-    float idx_low = floor( idx );
-    float idx_high = ceil( idx );
-    
-    vec4 level_low = levels[idx_low];
-    vec4 level_high = levels[idx_high];
-    
-    return level_low + (idx - idx_low) * (level_high - level_low);
+    // with the colors in the shader, the vertices only keep the color of markings. The alpha is how
+    // much a vertex color covers the difficulty map the shader draws, only markings do.
+    return heightColorInShader ? vec4(0) : vec4(vec3(colorRamp.Color(h)), 0);
 }
 
 
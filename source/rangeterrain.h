@@ -10,22 +10,37 @@
 #define DGIProject_rangeterrain_h
 
 #include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
 #include <math.h>
 #include <glm/glm.hpp>
 #include <GL/glfw.h>
 #include "perlinnoise.h"
+#include "noiselayercache.h"
+#include "heightpyramid.h"
+#include "trianglecache.h"
 
 #define PI                  3.14159265359
-#define X_INTERVAL          256
-#define Y_INTERVAL          256
-#define GRID_RES            1.0f // 0.5 meter between points
-#define TERRAIN_WIDTH       (X_INTERVAL - 1) * GRID_RES
-#define TERRAIN_DEPTH       (Y_INTERVAL - 1) * GRID_RES
+#define TILE_SIZE           64          // samples (and quads) along each side of a tile
+#define TILE_HALO           2           // samples this close to a written sample affect its normal or quads
+#define MAX_INTERVAL        (64 * TILE_SIZE + 1)
+#define DEFAULT_INTERVAL    (4 * TILE_SIZE + 1)
+#define DEFAULT_GRID_RES    1.0f        // meters between points
+#define MIN_GRID_RES        0.25f       // as the tweakbar allows
+#define MAX_GRID_RES        4.0f
+#define CP_BUCKET_SIZE      16          // samples along each side of a bucket of the ControlPointIndex
 
-#define FLOATS_PER_VERTEX           12
-#define FLOATS_PER_TRIANGLE         3*FLOATS_PER_VERTEX
-#define FLOATS_PER_TRIANGLE_PAIR    2*FLOATS_PER_TRIANGLE
-#define FLOATS_PER_ROW              (X_INTERVAL - 1)*FLOATS_PER_TRIANGLE_PAIR
+#define HEIGHT_QUANTUM              (1.0f / 128)        // meters per step of TerrainVertex::height, gives +-256 m
+#define TILE_VERTICES_X             (TILE_SIZE + 1)     // a tile's vertices include the first row/column of the next tiles
+#define VERTICES_PER_TILE           (TILE_VERTICES_X * TILE_VERTICES_X)
+#define INDICES_PER_QUAD            6
+#define INDICES_PER_TILE            (TILE_SIZE * TILE_SIZE * INDICES_PER_QUAD)
+#define COLOR_RAMP_SIZE             1024                // entries of the height color lookup table
 
 using namespace std;
 using namespace glm;
@@ -39,6 +54,10 @@ struct xyh {
     float h;
 };
 
+struct rect {
+    int min_x, min_y, max_x, max_y;     // inclusive
+};
+
 enum ControlPointFuncType {
     FUNC_LINEAR,
     FUNC_COS,
@@ -52,32 +71,13 @@ public:
     float h;
     float spread;
     ControlPointFuncType functype;
-    float (*liftfunc)(float, float, float);
     
     ControlPoint(int x, int y, float h, float spread, ControlPointFuncType functype) {
         this->x = x;
         this->y = y;
         this->h = h;
         this->spread = spread;
-        SetFuncType(functype);
-    }
-    
-    inline void SetFuncType(ControlPointFuncType functype) {
         this->functype = functype;
-        
-        switch (functype) {
-            case FUNC_LINEAR:
-                this->liftfunc = lift_linear;
-                break;
-                
-            case FUNC_COS:
-                this->liftfunc = lift_cos;
-                break;
-                
-            case FUNC_SIN:
-                this->liftfunc = lift_sin;
-                break;
-        }
     }
     
     inline static float lift_linear(float h, float spread, float dist) {
@@ -92,24 +92,113 @@ public:
         return dist <= spread ? h * (1 - sin((dist * PI) / (spread * 2))) : 0;
     }
     
-    float lift(int x, int y) const {
+    inline static float lift(ControlPointFuncType functype, float h, float spread, float dist) {
+        switch (functype) {
+            case FUNC_LINEAR:   return lift_linear(h, spread, dist);
+            case FUNC_COS:      return lift_cos(h, spread, dist);
+            case FUNC_SIN:      return lift_sin(h, spread, dist);
+        }
+        return 0;
+    }
+    
+    float lift(int x, int y, float gridRes) const {
         float dx = this->x - x;
         float dy = this->y - y;
-        float dist = sqrt(dx * dx + dy * dy) * GRID_RES;
-        return this->liftfunc(this->h, this->spread, dist);
+        float dist = sqrt(dx * dx + dy * dy) * gridRes;
+        return lift(this->functype, this->h, this->spread, dist);
     }
+    
+    // Same as lift() for the samples (min_x..min_x+count-1, y), in a batch (see liftkernels.cpp)
+    void lift_row(int y, int min_x, int count, float gridRes, float* out) const;
 };
 
-/*struct Triangle {
- vec3 v0, v1, v2;
- vec3 n0, n1, n2;
- vec3 c0, c1, c2;
- vec2 t0, t1, t2;
- };*/
+// Prints the largest deviation of lift_row() from lift(), and how long both take
+void TestLiftKernels();
+
+typedef int ControlPointHandle;
+#define NO_CONTROL_POINT    (-1)
 
 /**
- Two triangles making up a square with side GRID_RES.
- The vertices are assumed to be at descrete positions in the grid.
+ Pooled storage for the control points, as a structure of arrays.
+ 
+ A control point is identified by its handle, an index into the arrays which stays
+ valid until the control point is removed. Removed slots are kept on a free list and
+ reused by the next Add(), so once the pool has grown to the number of control points
+ in use, editing them doesn't allocate.
+ */
+struct ControlPointPool {
+    vector<int> x;
+    vector<int> y;
+    vector<float> h;
+    vector<float> spread;
+    vector<ControlPointFuncType> functype;
+    vector<char> live;
+    
+private:
+    vector<ControlPointHandle> freeList;
+    
+public:
+    ControlPointHandle Add(const ControlPoint &cp) {
+        ControlPointHandle handle;
+        if (!freeList.empty()) {
+            handle = freeList.back();
+            freeList.pop_back();
+        } else {
+            handle = (ControlPointHandle) live.size();
+            x.push_back(0);
+            y.push_back(0);
+            h.push_back(0);
+            spread.push_back(0);
+            functype.push_back(FUNC_LINEAR);
+            live.push_back(false);
+        }
+        Set(handle, cp);
+        live[handle] = true;
+        return handle;
+    }
+    
+    inline void Set(const ControlPointHandle &handle, const ControlPoint &cp) {
+        x[handle] = cp.x;
+        y[handle] = cp.y;
+        h[handle] = cp.h;
+        spread[handle] = cp.spread;
+        functype[handle] = cp.functype;
+    }
+    
+    void Remove(const ControlPointHandle &handle) {
+        live[handle] = false;
+        freeList.push_back(handle);
+    }
+    
+    // Removes all control points, but keeps the memory
+    void Clear() {
+        x.clear();
+        y.clear();
+        h.clear();
+        spread.clear();
+        functype.clear();
+        live.clear();
+        freeList.clear();
+    }
+    
+    inline ControlPoint Get(const ControlPointHandle &handle) const {
+        return ControlPoint(x[handle], y[handle], h[handle], spread[handle], functype[handle]);
+    }
+    
+    // Same as Get(handle).lift_row() for the single sample (px, py)
+    inline float Lift(const ControlPointHandle &handle, const int &px, const int &py, const float &gridRes) const {
+        float lift;
+        Get(handle).lift_row(py, px, 1, gridRes, &lift);
+        return lift;
+    }
+    
+    inline int Size() const { return (int) live.size(); }      // Number of slots, handles are below this
+    inline bool IsLive(const ControlPointHandle &handle) const { return live[handle]; }
+};
+
+/**
+ The two triangles of a terrain quad, a square with side GRID_RES between four
+ neighbouring samples of the grid.
  
  The coordinate system for the figures:
  
@@ -144,61 +233,91 @@ public:
  | /   |            |   \ |
  +-----+            +-----+
  */
-/*struct TrianglePair {
- bool diagonalUp;
- Triangle t1, t2;
- 
- void SetVertices(vec3 &v1, vec3 &v2, vec3 & v3, vec3 &v4) {
- diagonalUp = true; // [TODO: Set appropriate condition on this]
- vec2 t00(0,0), t01(0,1), t10(1,0), t11(1,1);
- if (diagonalUp) {
- t1.v0 = v1;     t1.v1 = v2;     t1.v2 = v3;     // vertices
- t2.v0 = v4;     t2.v1 = v3;     t2.v2 = v2;
- 
- t1.t0 = t00;    t1.t1 = t01;    t1.t2 = t10;    // texture coordinates
- t2.t0 = t11;    t2.t1 = t10;    t2.t2 = t01;
- } else {
- t1.v0 = v1;     t1.v1 = v4;     t1.v2 = v3;
- t2.v0 = v4;     t2.v1 = v1;     t2.v2 = v2;
- 
- t1.t0 = t00;    t1.t1 = t11;    t1.t2 = t10;
- t2.t0 = t11;    t2.t1 = t00;    t2.t2 = t01;
- 
- }
- }
- 
- 
- void SetNormals(vec3 &n1, vec3 &n2, vec3 & n3, vec3 &n4) {
- if (diagonalUp) {
- t1.n0 = n1;     t1.n1 = n2;     t1.n2 = n3;     // normals
- t2.n0 = n4;     t2.n1 = n3;     t2.n2 = n2;
- } else {
- t1.n0 = n1;     t1.n1 = n4;     t1.n2 = n3;
- t2.n0 = n4;     t2.n1 = n1;     t2.n2 = n2;
- }
- }
- 
- void SetColors(vec3 &c1, vec3 &c2, vec3 & c3, vec3 &c4) {
- if (diagonalUp) {
- t1.c0 = c1;     t1.c1 = c2;     t1.c2 = c3;     // colors
- t2.c0 = c4;     t2.c1 = c3;     t2.c2 = c2;
- } else {
- t1.c0 = c1;     t1.c1 = c4;     t1.c2 = c3;
- t2.c0 = c4;     t2.c1 = c1;     t2.c2 = c2;
- }
- }
- 
- // [TODO: The following functions assumes diagonalUp]
- void SetV1(vec3 v1, vec3 n1, vec3 c1) { t1.v0 = v1;     t1.n0 = n1;     t1.c0 = c1; }
- 
- void SetV2(vec3 v2, vec3 n2, vec3 c2) { t1.v1 = v2;     t1.n1 = n2;     t1.c1 = c2;
- t2.v2 = v2;     t2.n2 = n2;     t2.c2 = c2; }
+
+/**
+ Packed vertex of the terrain mesh, 12 bytes instead of 12 floats.
  
- void SetV3(vec3 v3, vec3 n3, vec3 c3) { t1.v2 = v3;     t1.n2 = n3;     t1.c2 = c3;
- t2.v1 = v3;     t2.n1 = n3;     t2.c1 = c3; }
+ The position within the tile and the texture coordinates are implicit in the
+ index of the vertex (see RangeTerrain::TileVertex()), and are reconstructed in
+ terrain-vertex-shader.txt together with the grid resolution. What remains is:
  
- void SetV4(vec3 v4, vec3 n4, vec3 c4) { t2.v0 = v4;     t2.n0 = n4;     t2.c0 = c4; }
- };*/
+ height:    16 bit, in steps of HEIGHT_QUANTUM over the grid
+ normal:    octahedron encoded in 2 x 16 bit (normalized)
+ color:     RGBA8 (normalized)
+ */
+struct TerrainVertex {
+    GLshort normal[2];
+    GLubyte color[4];
+    GLshort height;
+    GLshort padding;        // keeps the attributes 4 byte aligned
+    
+    inline void SetHeight(const float &h) {
+        height = (GLshort) glm::clamp(round(h / HEIGHT_QUANTUM), -32767.0f, 32767.0f);
+    }
+    
+    inline void SetNormal(const vec3 &n) {
+        // project onto the octahedron |x| + |y| + |z| = 1, and fold the lower half over the upper
+        vec2 p = vec2(n.x, n.y) / (abs(n.x) + abs(n.y) + abs(n.z));
+        if (n.z < 0)
+            p = (1.0f - abs(vec2(p.y, p.x))) * vec2(p.x >= 0 ? 1 : -1, p.y >= 0 ? 1 : -1);
+        normal[0] = (GLshort) round(glm::clamp(p.x, -1.0f, 1.0f) * 32767);
+        normal[1] = (GLshort) round(glm::clamp(p.y, -1.0f, 1.0f) * 32767);
+    }
+    
+    inline void SetColor(const vec4 &c) {
+        color[0] = (GLubyte) round(glm::clamp(c.r, 0.0f, 1.0f) * 255);
+        color[1] = (GLubyte) round(glm::clamp(c.g, 0.0f, 1.0f) * 255);
+        color[2] = (GLubyte) round(glm::clamp(c.b, 0.0f, 1.0f) * 255);
+        color[3] = (GLubyte) round(glm::clamp(c.a, 0.0f, 1.0f) * 255);
+    }
+};
+
+static_assert(sizeof(TerrainVertex) == 12, "TerrainVertex must be tightly packed");
+
+/**
+ Lookup table from height to color, interpolated between evenly spaced color stops
+ from minHeight to maxHeight. Heights outside the range get the first/last stop.
+ */
+struct ColorRamp {
+private:
+    float scale;                            // table entries per meter
+    
+public:
+    vector<vec4> stops;
+    float minHeight, maxHeight;
+    vec4 table[COLOR_RAMP_SIZE];
+    
+    ColorRamp() {
+        stops.push_back( vec4( 0.5,      0,      0,      1) ); // dark red
+        stops.push_back( vec4(   1,      0,      0,      1) ); // red
+        stops.push_back( vec4(   1,    0.5,      0,      1) ); // orange
+        stops.push_back( vec4(   1,      1,      0,      1) ); // yellow
+        stops.push_back( vec4(   0,      1,      0,      1) ); // green
+        stops.push_back( vec4(   0,      1,      1,      1) ); // cyan
+        stops.push_back( vec4(   0,      0,      1,      1) ); // blue
+        stops.push_back( vec4( 0.5,    0.5,      1,      1) ); // light blue
+        Build(-5, 5);
+    }
+    
+    void Build(const float &min_h, const float &max_h) {
+        assert(stops.size() >= 2 && min_h < max_h);
+        minHeight = min_h;
+        maxHeight = max_h;
+        scale = (COLOR_RAMP_SIZE - 1) / (max_h - min_h);
+        
+        for ( int i=0; i<COLOR_RAMP_SIZE; i++ ) {
+            float idx = (stops.size() - 1) * i / float(COLOR_RAMP_SIZE - 1);
+            int idx_low = std::min((int) idx, (int) stops.size() - 2);
+            table[i] = stops[idx_low] + (idx - idx_low) * (stops[idx_low + 1] - stops[idx_low]);
+        }
+    }
+    
+    // Nearest table entry, clamped to the table
+    inline const vec4& Color(const float &h) const {
+        float idx = glm::clamp((h - minHeight) * scale, 0.0f, COLOR_RAMP_SIZE - 1.0f);
+        return table[(int) (idx + 0.5f)];
+    }
+};
 
 struct ChangeManager {
 private:
@@ -214,11 +333,11 @@ public:
     x_interval(x_intvl) {
         identifiers.reserve(size);
         identifierInVector = new bool[size];
-        Reset();
+        memset(identifierInVector, 0, size * sizeof(bool));
     }
     
     ~ChangeManager() {
-        delete identifierInVector;
+        delete[] identifierInVector;
     }
     
     void SetChanged(const int &x, const int &y) {
@@ -234,8 +353,10 @@ public:
     }
     
     void Reset() {
+        // Only the changed identifiers are set, so this is proportional to the number of changes rather than the grid size
+        for ( xy &xy : identifiers )
+            identifierInVector[xy2idx(xy.x, xy.y)] = false;
         identifiers.clear();
-        memset(identifierInVector, 0, size * sizeof(bool)); // Reset to zeros (false) [TODO: Potential speed up - iterate over identifiers and set one at a time]
     }
     
     inline int xy2idx(const int &x, const int &y) {
@@ -243,34 +364,212 @@ public:
     }
 };
 
+/**
+ Spatial index of the control points (stored in a ControlPointPool).
+ 
+ The grid is split into buckets of CP_BUCKET_SIZE x CP_BUCKET_SIZE samples, each listing
+ the control points whose footprint (the samples they may lift, see RangeTerrain::Footprint())
+ overlaps it. Pinned samples, the ones with a control point on them, are kept in a hash
+ map. Neither depends on the grid being dense, so the cost follows the number of control
+ points rather than the grid size.
+ */
+struct ControlPointIndex {
+    
+    struct Entry {
+        ControlPointHandle cp;
+        rect footprint;
+    };
+    
+private:
+    int x_interval;
+    int bucketsX, bucketsY;
+    vector< vector<Entry> > buckets;
+    unordered_map<int, ControlPointHandle> pinned;
+    
+public:
+    ControlPointIndex() : x_interval(0), bucketsX(0), bucketsY(0) {}
+    
+    void Resize(const int &x_intvl, const int &y_intvl) {
+        x_interval = x_intvl;
+        bucketsX = (x_intvl + CP_BUCKET_SIZE - 1) / CP_BUCKET_SIZE;
+        bucketsY = (y_intvl + CP_BUCKET_SIZE - 1) / CP_BUCKET_SIZE;
+        buckets.assign(bucketsX * bucketsY, vector<Entry>());
+        pinned.clear();
+    }
+    
+    void Clear() {
+        pinned.clear();
+        for ( vector<Entry> &bucket : buckets )
+            bucket.clear();
+    }
+    
+    void Insert(const ControlPointHandle &cp, const int &x, const int &y, const rect &footprint) {
+        pinned[y * x_interval + x] = cp;
+        AddToBuckets(cp, footprint);
+    }
+    
+    void Remove(const ControlPointHandle &cp, const int &x, const int &y, const rect &footprint) {
+        pinned.erase(y * x_interval + x);
+        RemoveFromBuckets(cp, footprint);
+    }
+    
+    // Call when the footprint of cp changed (with its spread)
+    void Move(const ControlPointHandle &cp, const rect &old_footprint, const rect &new_footprint) {
+        RemoveFromBuckets(cp, old_footprint);
+        AddToBuckets(cp, new_footprint);
+    }
+    
+    // The control point on sample (x, y), NO_CONTROL_POINT if not pinned
+    inline ControlPointHandle Pinned(const int &x, const int &y) const {
+        auto it = pinned.find(y * x_interval + x);
+        return it == pinned.end() ? NO_CONTROL_POINT : it->second;
+    }
+    
+    // The control points whose footprint may cover sample (x, y) (a superset)
+    inline const vector<Entry>& Near(const int &x, const int &y) const {
+        return buckets[(y / CP_BUCKET_SIZE) * bucketsX + x / CP_BUCKET_SIZE];
+    }
+    
+    // The control points whose footprint overlaps r, each once
+    void Query(const rect &r, vector<ControlPointHandle> &result) const {
+        for ( int by=r.min_y / CP_BUCKET_SIZE; by<=r.max_y / CP_BUCKET_SIZE; by++ ) {
+            for ( int bx=r.min_x / CP_BUCKET_SIZE; bx<=r.max_x / CP_BUCKET_SIZE; bx++ ) {
+                for ( const Entry &e : buckets[by * bucketsX + bx] ) {
+                    const rect &f = e.footprint;
+                    if (f.max_x < r.min_x || f.min_x > r.max_x || f.max_y < r.min_y || f.min_y > r.max_y)
+                        continue;
+                    
+                    // only report it from the first bucket where the two overlap
+                    if (std::max(f.min_x, r.min_x) / CP_BUCKET_SIZE == bx && std::max(f.min_y, r.min_y) / CP_BUCKET_SIZE == by)
+                        result.push_back(e.cp);
+                }
+            }
+        }
+    }
+    
+private:
+    void AddToBuckets(const ControlPointHandle &cp, const rect &footprint) {
+        for ( int by=footprint.min_y / CP_BUCKET_SIZE; by<=footprint.max_y / CP_BUCKET_SIZE; by++ )
+            for ( int bx=footprint.min_x / CP_BUCKET_SIZE; bx<=footprint.max_x / CP_BUCKET_SIZE; bx++ )
+                buckets[by * bucketsX + bx].push_back( { cp, footprint } );
+    }
+    
+    void RemoveFromBuckets(const ControlPointHandle &cp, const rect &footprint) {
+        for ( int by=footprint.min_y / CP_BUCKET_SIZE; by<=footprint.max_y / CP_BUCKET_SIZE; by++ ) {
+            for ( int bx=footprint.min_x / CP_BUCKET_SIZE; bx<=footprint.max_x / CP_BUCKET_SIZE; bx++ ) {
+                vector<Entry> &bucket = buckets[by * bucketsX + bx];
+                for ( int i=0; i<(int) bucket.size(); i++ ) {
+                    if (bucket[i].cp == cp) {
+                        bucket.erase(bucket.begin() + i);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+};
+
+/**
+ A square block of TILE_SIZE x TILE_SIZE grid samples. Tiles are allocated the first
+ time anything is written to them, an unallocated tile is flat (height 0).
+ 
+ Tile (tx, ty) holds the samples x in [tx * TILE_SIZE, (tx + 1) * TILE_SIZE) and
+ y in [ty * TILE_SIZE, (ty + 1) * TILE_SIZE), and the mesh of the quads whose v1 is
+ one of those samples. The mesh is indexed: one vertex per sample (including the
+ samples on the first row/column of the next tiles, which these quads share) and
+ INDICES_PER_QUAD indices per quad, so flipping the diagonal of a quad only rewrites
+ its indices. Vertex positions are relative to the tile origin, see
+ RangeTerrain::TileOrigin(), and texture coordinates are the sample coordinates
+ within the tile (the texture is expected to repeat). Both are implicit in the
+ vertex index, see TerrainVertex.
+ 
+ Index order of a quad, two triangles of the vertices numbered as in the quad
+ figure above (1 and 3 along the top, 2 and 4 below them):
+ diagonalUp == True:    v1  v2  v3  v4  v3  v2
+ diagonalUp == False:   v1  v4  v2  v4  v3  v1
+ */
+struct TerrainTile {
+    const int tx, ty;
+    
+    float hmap[TILE_SIZE][TILE_SIZE];
+    float noise[TILE_SIZE][TILE_SIZE];
+    unique_ptr<vec2[]> noiseGradient;   // Derivatives of noise along x and y, y * TILE_SIZE + x, while RangeTerrain has them
+    vec3 normals[TILE_SIZE][TILE_SIZE];
+    
+    bool diagonalUp[TILE_SIZE][TILE_SIZE];
+    
+    TerrainVertex* vertexData;          // NULL for the last row/column of tiles, which has no quads
+    GLushort* indexData;                // NULL when vertexData is
+    vector<int> changedVertexIndices;   // Indices into vertexData
+    vector<int> changedQuadIndices;     // Offsets into indexData
+    
+    TerrainTile(const int &tx, const int &ty, const TerrainVertex* initialVertexData, const GLushort* initialIndexData);
+    ~TerrainTile();
+};
+
 class RangeTerrain {
     
     friend class RangeDrawer;
     
 private:
     
-    ControlPoint*   controlPoints[Y_INTERVAL][X_INTERVAL];
-    bool            regenerationRequired;
-    PerlinNoise     perlinNoise;
+    int             xInterval, yInterval;       // Number of grid samples along x and y
+    float           gridRes;                    // Meters between grid samples
+    int             tilesX, tilesY;             // Number of tiles holding samples
+    int             quadTilesX, quadTilesY;     // Number of tiles holding quads (one less than the above)
+    
+    vector<TerrainTile*>    tiles;              // tilesY * tilesX, NULL until allocated
+    vector<TerrainTile*>    allocatedTiles;     // The non-NULL entries of tiles
+    TerrainVertex*          flatTileVertexData; // Vertex data of a tile with height 0 everywhere
+    GLushort*               flatTileIndexData;  // Index data of the same tile (all diagonals down)
+    
+    bool                regenerationRequired;
+    int                 regenerations;          // Regenerate() calls so far
+    unsigned int        versionClock;           // Bumped by every change of the terrain's shape
+    vector<unsigned int> tileVersions;          // quadTilesY * quadTilesX, versionClock when the quads of each tile last changed
+    PerlinNoise         perlinNoise;
+    ControlPointPool    controlPointPool;
+    ControlPointIndex   controlPoints;
+    vector<float>       liftBuffer;         // One row of lifts in UpdateHMap(const ControlPoint&)
+    ColorRamp           colorRamp;
+    HeightPyramid       maxHeights;             // Highest corner of every quad, and of blocks of quads
+    TriangleCache       triangles;              // Every triangle, once something has asked for them
+    bool                heightColorInShader;    // The vertices are uncolored, and the shader colors by height
+    mutex               allocationMutex;        // Held while allocating tiles in parallel regeneration
+    
+    thread              noiseThread;            // Generates the noise of RequestNoise()
+    atomic<int>         noiseRequest;           // Bumped by every request, so the thread can tell it is outdated
+    mutex               noiseMutex;             // Guards the fields below
+    vector<float>       pendingNoise;           // Noise field of the current request, not yet applied by Update()
+    int                 pendingNoiseStep;       // Sample spacing pendingNoise was evaluated at
+    bool                noiseGradients;         // The tiles hold the noise's derivatives, for normals where it is the height
+
     
     ChangeManager*  changedControlPoints;
     ChangeManager*  changedHMapCoords;
+    ChangeManager*  changedFootprints;          // Samples to evaluate from scratch, as a control point lifting them was lowered
     ChangeManager*  changedVertices;
-    
+    ChangeManager*  changedTiles;               // Quad tiles with changed vertex data
+
 public:
-    
-    float hmap[Y_INTERVAL][X_INTERVAL];
-    float noise[Y_INTERVAL][X_INTERVAL];
-    vec3 normals[X_INTERVAL][Y_INTERVAL];
-    
-    //    TrianglePair trianglePairs[(Y_INTERVAL - 1)][(X_INTERVAL - 1)];
-    
-    GLfloat vertexData[(X_INTERVAL - 1) * (Y_INTERVAL - 1) * 2 * 3 * FLOATS_PER_VERTEX];
-    vector<int> changedVertexIndices;
 
+    bool            selfCheck;                  // Compare every incremental update against Regenerate()
+    bool            parallelRegeneration;       // Regenerate() on gWorkerPool, with the same result as without
+    NoiseEngine     noiseEngine;                // How SetNoise() evaluates the noise
+    NoiseLayerCache noiseLayers;                // Octaves of noise SetNoise() has evaluated
+    
     void SetNoise(double _persistence, double _frequency, double _amplitude, int _octaves, int _randomseed);
     void FlattenNoise();
     
+    // Same as SetNoise(), but on a background thread: Update() applies a coarse preview first, then
+    // finer ones, and the full noise when it is done. Cancels any noise still being generated.
+    void RequestNoise(double _persistence, double _frequency, double _amplitude, int _octaves, int _randomseed);
+    void CancelNoise();
+    
+    void SetHeightColors(float minHeight, float maxHeight, bool inShader);  // Regenerates vertex data if they are in it
+    inline const ColorRamp& HeightColors() const { return colorRamp; }
+    inline bool HeightColorInShader() const { return heightColorInShader; }
+    
 private:
     
     void FlattenHMap();                         // Flatten the hmap
@@ -278,23 +577,56 @@ private:
     void Regenerate();                          // Generate everything from control points
     
     void UpdateHMap();                          // Update from changed control points
-    void UpdateNormals();                       // Requires hmap
-    void UpdateChangedVertices();               // Requires hmap (and should be ran after UpdateNormals() too)
-    void UpdateVertexData();                    // Requires hmap and normals (and for the moment that changedVertices is updated by running UpdateTrianglePairs)
+    void UpdateChangedVertices();               // Requires hmap, the changed samples and their neighbours
+    void UpdateNormals();                       // Requires hmap and changedVertices
+    void UpdateVertexData();                    // Requires hmap, normals and changedVertices
+    bool CheckAgainstRegenerate();              // Regenerates, and reports where it differs from the current state
     
     void GenerateHMap();                        // Generate from control points
     void GenerateNormals();                     // Requires hmap
     void GenerateVertexData();                  // Requires hmap and normals
+    void GenerateMaxHeights();                  // Requires hmap
+    void UpdateMaxHeights();                    // Requires hmap and changedHMapCoords
+    void UpdateTriangles();                     // Requires hmap, diagonals and changedVertices
+    void UpdateTileVersions();                  // Requires changedVertices
+    void SetAllTilesChanged();                  // Bumps the version of every tile
     
     void ApplyNoise();
     
+    // Noise fields of width x height samples, row by row, followed by the derivatives along x and y
+    // if the engine has them. False if cancelled() turned true on the way.
+    bool GenerateNoise(const PerlinNoise &pn, NoiseEngine engine, int width, int height, float* field, const function<bool ()> &cancelled);
+    void GenerateCoarseNoise(const PerlinNoise &pn, NoiseEngine engine, int width, int height, int step, float* field);   // Interpolated from every step samples
+    NoiseLayerCache::Layer GenerateNoiseLayer(const NoiseLayerKey &key, double frequency, const function<bool ()> &cancelled);   // One octave with unit amplitude
+    void SetNoiseField(const vector<float> &field);       // Requires a field of every sample, with or without derivatives
+    bool ApplyPendingNoise();                               // True if there was noise to apply
+    
+    void ParallelFor(const int &count, const function<void (int)> &body);  // On gWorkerPool if parallelRegeneration
+    void GenerateHMapBand(const int &ty);                   // GenerateHMap() for the samples of a row of tiles
+    void GenerateVertexData(TerrainTile* tile);             // GenerateVertexData() for the vertices and quads of a tile
+    
     void UpdateHMap(const ControlPoint &cp);                // Updates hmap from the given control point
+    float EvaluateHeight(const int &x, const int &y) const; // Height from the control points influencing (x, y), and the noise
+    
+    rect Footprint(const ControlPoint &cp) const;           // Samples the control point may lift
+    void SetFootprintChanged(const ControlPoint &cp);
     void UpdateNormal(const int &x, const int &y);          // Requires hmap
-    void UpdateTrianglePair(const int &x, const int &y);    // Requires hmap and normal
+    bool IsNoise(const int &x, const int &y) const;         // The height of the sample is its noise, no control point lifts it
     void UpdateVertexData(const int &x, const int &y);      // Requires hmap and normal
+    void UpdateDiagonal(const int &x, const int &y);        // Requires hmap, x, y are quad coordinates
+    bool UpdateDiagonal(TerrainTile* tile, const int &lx, const int &ly);  // Only writes to the tile, true if changed
+    
+    void AllocateTiles(int min_x, int min_y, int max_x, int max_y);     // Allocates the tiles covering the given samples
+    TerrainTile* TileForWriting(const int &x, const int &y);            // Allocates the tile (and its halo) if necessary
+    void DeleteTiles();
+    void GenerateFlatTileVertexData();
+    int TilesSharingVertex(const int &x, const int &y, TerrainTile* sharing[4]) const;   // Allocated tiles with the vertex in their mesh
+    void SetVertexColor(const int &x, const int &y, const vec4 &c);     // In every tile sharing the vertex
 
     inline bool ControlPointChanged() const { return !changedControlPoints->identifiers.empty(); }
-    inline void SetVertexData(int idx, const vec3 &v, const vec2 &t, const vec3 &n, const vec4 &c);
+    inline void SetVertexData(TerrainTile* tile, int idx, const float &h, const vec3 &n, const vec4 &c);
+    inline void WriteVertexData(TerrainTile* tile, int idx, const float &h, const vec3 &n, const vec4 &c);  // Only writes to the tile
+    static void SetQuadIndices(GLushort* data, const int &lx, const int &ly, const bool &diagonalUp);
     vec4 ColorFromHeight(const float &h) const;
     
 public:
@@ -302,14 +634,109 @@ public:
     RangeTerrain();
     ~RangeTerrain();
     
+    void Resize(int xIntvl, int yIntvl, float res);  // Rounded up to whole tiles, deletes everything
     void Reset();       // Delete control points and flatten hmap
     void Update();      // Update everything from changed control points
     
     void SetControlPoint(int x, int y, float h, float spread, ControlPointFuncType func);
     void SetControlPointSpread(int x, int y, float spread);
     void SetControlPointFuncType(int x, int y, ControlPointFuncType functype);
+    void RemoveControlPoint(int x, int y);
+    
+    inline int   XInterval()    const { return xInterval; }
+    inline int   YInterval()    const { return yInterval; }
+    inline float GridRes()      const { return gridRes; }
+    inline float Width()        const { return (xInterval - 1) * gridRes; }
+    inline float Depth()        const { return (yInterval - 1) * gridRes; }
+    inline int   QuadTilesX()   const { return quadTilesX; }
+    inline int   QuadTilesY()   const { return quadTilesY; }
+    
+    // Highest points over the quads, see HeightPyramid. Kept up to date by Update().
+    inline const HeightPyramid& MaxHeights() const { return maxHeights; }
+    
+    // Every triangle of the terrain, built on the first call and kept up to date by Update() after that
+    const TriangleCache& Triangles();
+    
+    // The tile holding sample (x, y), NULL if not allocated
+    inline TerrainTile* GetTile(const int &x, const int &y) const {
+        return tiles[(y / TILE_SIZE) * tilesX + x / TILE_SIZE];
+    }
+    
+    // The tile with tile coordinates (tx, ty), NULL if not allocated
+    inline TerrainTile* TileAt(const int &tx, const int &ty) const {
+        return tiles[ty * tilesX + tx];
+    }
+    
+    // Index of the vertex at tile local sample (lx, ly), lx, ly in [0, TILE_SIZE]
+    static inline int TileVertex(const int &lx, const int &ly) {
+        return ly * TILE_VERTICES_X + lx;
+    }
+    
+    // World position of vertex idx of tile (tx, ty), taken from the hmap as the vertex data is quantized
+    inline vec3 TileVertexPosition(const int &tx, const int &ty, const int &idx) const {
+        const int x = tx * TILE_SIZE + idx % TILE_VERTICES_X, y = ty * TILE_SIZE + idx / TILE_VERTICES_X;
+        return vec3(x * gridRes, Height(x, y), -y * gridRes);
+    }
+    
+    // World position of sample (x, y)
+    inline vec3 SamplePosition(const int &x, const int &y) const {
+        return vec3(x * gridRes, Height(x, y), -y * gridRes);
+    }
+    
+    // Height of the terrain triangles at world (x, z), -infinity off the terrain
+    float SurfaceHeight(const float &x, const float &z) const;
+    
+    // Whether quad (x, y) is split from (x, y+1) to (x+1, y), see TerrainTile
+    inline bool DiagonalUp(const int &x, const int &y) const {
+        const TerrainTile* tile = GetTile(x, y);
+        return tile ? tile->diagonalUp[y % TILE_SIZE][x % TILE_SIZE] : false;
+    }
+    
+    inline vec3 TileOrigin(const int &tx, const int &ty) const {
+        return vec3(tx * TILE_SIZE * gridRes, 0, -ty * TILE_SIZE * gridRes);
+    }
+    
+    inline float Height(const int &x, const int &y) const {
+        const TerrainTile* tile = GetTile(x, y);
+        return tile ? tile->hmap[y % TILE_SIZE][x % TILE_SIZE] : 0;
+    }
+    
+    // Height of the highest corner of quad (x, y)
+    inline float QuadMaxHeight(const int &x, const int &y) const {
+        return std::max(std::max(Height(x, y), Height(x+1, y)), std::max(Height(x, y+1), Height(x+1, y+1)));
+    }
+    
+    inline vec3 Normal(const int &x, const int &y) const {
+        const TerrainTile* tile = GetTile(x, y);
+        return tile ? tile->normals[y % TILE_SIZE][x % TILE_SIZE] : vec3(0, 1, 0);
+    }
+    
+    // The control point on sample (x, y), NO_CONTROL_POINT if there is none
+    inline ControlPointHandle ControlPointAt(const int &x, const int &y) const {
+        return controlPoints.Pinned(x, y);
+    }
+    
+    inline ControlPoint GetControlPoint(const ControlPointHandle &cp) const {
+        return controlPointPool.Get(cp);
+    }
+    
+    inline const TerrainVertex* FlatTileVertexData() const { return flatTileVertexData; }
+    inline const GLushort* FlatTileIndexData() const { return flatTileIndexData; }
+    
+    inline const vector<xy>& ChangedTiles() const { return changedTiles->identifiers; }
+    inline const vector<xy>& ChangedVertices() const { return changedVertices->identifiers; }   // Until RangeDrawer::MarkTerrain()
+    inline void ResetChangedTiles() { changedTiles->Reset(); }
+    inline bool VertexChanged() const { return !changedTiles->identifiers.empty(); }
+    
+    // Changes whenever Regenerate() has rewritten every vertex
+    inline int Regenerations() const { return regenerations; }
+    
+    // Grows whenever the heights or diagonals of any quads change
+    inline unsigned int Version() const { return versionClock; }
     
-    inline bool VertexChanged() const { return !changedVertexIndices.empty(); }
+    // The Version() at which any of quads [x0, x1] x [y0, y1] last changed, by whole tiles. Quads
+    // outside the terrain never change.
+    unsigned int QuadsVersion(int x0, int y0, int x1, int y1) const;
 };
 
 extern RangeTerrain gTerrain;
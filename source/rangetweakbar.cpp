@@ -7,6 +7,7 @@
 //
 
 #include "difficultyanalyzer.h"
+#include "difficultymap.h"
 #include "rangetweakbar.h"
 #include "protracerinputhandler.h"
 #include "tdogl/Camera.h"
@@ -28,16 +29,27 @@ float       ytilt       = 0,    ytiltPrev       = 0;
 float       spread      = 5,    spreadPrev      = 5;
 ControlPointFuncType functype = FUNC_LINEAR, functypePrev = FUNC_LINEAR;
 
+// terrain size parameters
+int         terrainSize = DEFAULT_INTERVAL;
+float       gridRes     = DEFAULT_GRID_RES;
+
+// height color parameters
+float       heightColorMin      = -5;
+float       heightColorMax      = 5;
+bool        heightColorInShader = false;
+
 // noise parameters
 float       persistance = 0.3;
 float       frequency   = 0.05;
 float       amplitude   = 15;
 float       octaves     = 10;
+int         noiseSeed   = 0;
 
 // difficulty parameters
 string shotDistance = "";
 string difficulty = "";
 string difficultyReadable = "";
+int    difficultyMapStep = 4;
 
 RangeTweakBar::RangeTweakBar() {
     objectCounter = 0;
@@ -100,6 +112,28 @@ void RangeTweakBar::Init(const int &screenWidth, const int &screenHeight) {
                 NULL,
                 "key=2 help='Toggle the color mode of the right view.' ");
     
+    // We need this function (defined in main.mm)
+    extern void SetHeightColors(const float &minHeight, const float &maxHeight, const bool &inShader);
+    
+    TwAddVarRW(generalBar, "Color min height", TW_TYPE_FLOAT, &heightColorMin,
+               "step=0.5 help='Height getting the first color of the color mode.' ");
+    
+    TwAddVarRW(generalBar, "Color max height", TW_TYPE_FLOAT, &heightColorMax,
+               "step=0.5 help='Height getting the last color of the color mode.' ");
+    
+    TwAddVarRW(generalBar, "Color in shader", TW_TYPE_BOOLCPP, &heightColorInShader,
+               "help='Color by height in the fragment shader, so the vertex data only holds the markings.' ");
+    
+    TwAddButton(generalBar,
+                "Apply colors",
+                (TwButtonCallback) [] (void* clientData) {
+                    if (heightColorMax <= heightColorMin)
+                        heightColorMax = heightColorMin + 0.5f;
+                    SetHeightColors(heightColorMin, heightColorMax, heightColorInShader);
+                },
+                NULL,
+                "help='Use the given heights and color mode.' ");
+    
     TwAddSeparator(generalBar, NULL, NULL);
     
     TwAddButton(generalBar,
@@ -131,13 +165,54 @@ void RangeTweakBar::Init(const int &screenWidth, const int &screenHeight) {
                 NULL,
                 "key=T help='Position the camera at the tee looking at the target. Both tee and target must be set.' ");
     
+    TwAddSeparator(generalBar, NULL, NULL);
+    
+    // We need this function (defined in main.mm)
+    extern void ResizeTerrain(const int &interval, const float &gridRes);
+    
+    TwAddVarRW(generalBar, "Terrain size", TW_TYPE_INT32, &terrainSize,
+               "min=65 max=4097 step=64 help='Number of grid points along each side of the terrain.' ");
+    
+    TwAddVarRW(generalBar, "Grid resolution", TW_TYPE_FLOAT, &gridRes,
+               "min=0.25 max=4 step=0.25 help='Meters between grid points.' ");
+    
+    TwAddButton(generalBar,
+                "Resize terrain",
+                (TwButtonCallback) [] (void* clientData) {
+                    
+                    // the greens refer to grid points that might no longer exist
+                    while (!gTweakBar.objects.empty())
+                        gTweakBar.RemoveTerrainObject(gTweakBar.objects.back());
+                    gTweakBar.currentObject = NULL;
+                    gTweakBar.SelectObject(NULL);
+                    
+                    ResizeTerrain(terrainSize, gridRes);
+                    terrainSize = gTerrain.XInterval();
+                },
+                NULL,
+                "help='Resize the terrain to the given size and resolution. This flattens the terrain and removes all greens.' ");
+    
+    TwAddVarRW(generalBar, "Self-check updates", TW_TYPE_BOOLCPP, &gTerrain.selfCheck,
+               "help='Compare every incremental terrain update against a full regeneration, and print any difference.' ");
+    
+    TwAddVarRW(generalBar, "Parallel regeneration", TW_TYPE_BOOLCPP, &gTerrain.parallelRegeneration,
+               "help='Regenerate the terrain on all cores.' ");
+    
+    TwAddButton(generalBar,
+                "Test lift kernels",
+                (TwButtonCallback) [] (void* clientData) {
+                    TestLiftKernels();
+                },
+                NULL,
+                "help='Print the accuracy and speed of the batch control point lift, compared to the plain one.' ");
+
     //----------------------------------------------------
     // The Noise Bar
     //----------------------------------------------------
     noiseBar = TwNewBar("Noise");
     TwDefine("Noise label=NOISE");
     TwDefine("Noise position='205 0'");
-    TwDefine("Noise size='205 256'");
+    TwDefine("Noise size='205 300'");
     TwDefine("Noise resizable=false");
     TwDefine("Noise movable=false");
     TwDefine("Noise fontresizable=false");
@@ -156,16 +231,30 @@ void RangeTweakBar::Init(const int &screenWidth, const int &screenHeight) {
     TwAddVarRW(noiseBar, "Octaves", TW_TYPE_FLOAT, &octaves,
                "min=0 max=20 step=1 keyIncr=+ keyDecr=- help='Set the octaves of perlin noise' ");
     
+    TwType twNoiseEngine = TwDefineEnum("NoiseEngine", NULL, 0);
+    
+    TwAddVarRW(noiseBar, "Noise engine", twNoiseEngine, &gTerrain.noiseEngine,
+               "enum='0 {Double cosine}, 1 {Float cosine}, 2 {Float smoothstep}, 3 {Float quintic}, 4 {Gradient}' help='Evaluate the noise in double precision as before, or in single precision vectors with a choice of interpolation. Gradient noise is a different surface, whose derivatives give the normals.' ");
+    
     
     TwAddSeparator(noiseBar, NULL, NULL);
     
     TwAddButton(noiseBar,
                 "Generate perlin noise",
                 (TwButtonCallback) [] (void* clientData) {
-                    gTerrain.SetNoise(persistance, frequency, amplitude, octaves, rand() % 100000);
+                    noiseSeed = rand() % 100000;
+                    gTerrain.RequestNoise(persistance, frequency, amplitude, octaves, noiseSeed);
                 },
                 NULL,
-                "key=V help='Apply perlin noise to terrain.'");
+                "key=V help='Apply perlin noise to terrain. It is generated in the background, and shown coarse first.'");
+    
+    TwAddButton(noiseBar,
+                "Update perlin noise",
+                (TwButtonCallback) [] (void* clientData) {
+                    gTerrain.RequestNoise(persistance, frequency, amplitude, octaves, noiseSeed);
+                },
+                NULL,
+                "help='Apply the current parameters to the last generated noise. Changing only amplitude, persistance or octaves reuses the octaves already evaluated.'");
     
     TwAddButton(noiseBar,
                 "Remove noise",
@@ -175,6 +264,28 @@ void RangeTweakBar::Init(const int &screenWidth, const int &screenHeight) {
                 NULL,
                 "help='Remove the noise' ");
     
+    TwAddButton(noiseBar,
+                "Test noise engines",
+                (TwButtonCallback) [] (void* clientData) {
+                    TestNoiseEngines();
+                },
+                NULL,
+                "help='Print the speed of each noise engine, and how far it is from the double precision noise.' ");
+    
+    TwAddVarCB(noiseBar, "Cached octave hits", TW_TYPE_UINT32, NULL,
+               (TwGetVarCallback) [] (void* value, void* clientData) {
+                   *(unsigned int*) value = gTerrain.noiseLayers.Hits();
+               },
+               NULL,
+               "help='Octaves of noise found in the cache.' ");
+    
+    TwAddVarCB(noiseBar, "Cached octave misses", TW_TYPE_UINT32, NULL,
+               (TwGetVarCallback) [] (void* value, void* clientData) {
+                   *(unsigned int*) value = gTerrain.noiseLayers.Misses();
+               },
+               NULL,
+               "help='Octaves of noise evaluated, as the cache did not hold them.' ");
+    
     //----------------------------------------------------
     // The Control Bar
     //----------------------------------------------------
@@ -332,7 +443,7 @@ void RangeTweakBar::Init(const int &screenWidth, const int &screenHeight) {
     difficultyBar = TwNewBar("Difficulty");
     TwDefine("Difficulty label=DIFFICULTY");
     TwDefine("Difficulty position='820 0'");
-    TwDefine("Difficulty size='205 256'");
+    TwDefine("Difficulty size='205 552'");
     TwDefine("Difficulty resizable=false");
     TwDefine("Difficulty movable=false");
     TwDefine("Difficulty fontresizable=false");
@@ -385,6 +496,119 @@ void RangeTweakBar::Init(const int &screenWidth, const int &screenHeight) {
                 },
                 NULL,
                 "key=RETURN help='Calculate the difficulty from the current tee and target.' ");
+    
+    TwAddButton(difficultyBar,
+                "Difficulty map",
+                (TwButtonCallback) [] (void* clientData) {
+                    if (gRangeDrawer.DifficultyMapShown()) {
+                        gRangeDrawer.ShowDifficultyMap(false);
+                    } else if (gRangeDrawer.TeeMarked()) {
+                        gDifficultyMap.Compute(gRangeDrawer.TeeTerrainPos(), difficultyMapStep);
+                        gRangeDrawer.ShowDifficultyMap(true);
+                    }
+                },
+                NULL,
+                "key=M help='Show (or hide) the difficulty of shots from the current tee to everywhere on the terrain. It follows changes to the terrain and tee.' ");
+    
+    TwAddVarRW(difficultyBar, "Map step", TW_TYPE_INT32, &difficultyMapStep,
+               "min=1 max=32 help='Samples between the targets of the difficulty map.' ");
+    
+    TwAddVarRO(difficultyBar, "Map update", TW_TYPE_INT32, &gDifficultyMap.lastComputedCells,
+               "help='Targets of the difficulty map computed again after the last change.' ");
+    
+    TwAddButton(difficultyBar,
+                "Test traversal",
+                (TwButtonCallback) [] (void* clientData) {
+                    DifficultyAnalyzer::TestTraversal();
+                },
+                NULL,
+                "help='Print how the quad traversal used for shot paths compares to testing every terrain triangle.' ");
+    
+    TwAddVarRW(difficultyBar, "Ball radius", TW_TYPE_FLOAT, &DifficultyAnalyzer::clearanceRadius,
+               "min=0 max=5 step=0.05 help='Distance shot paths keep from the terrain, or 0 to only keep the path itself above it.' ");
+    
+    TwAddVarRW(difficultyBar, "Curved paths", TW_TYPE_BOOLCPP, &DifficultyAnalyzer::curvedPaths,
+               "help='Shots follow a smooth curve shaped by the straight segments, instead of the segments.' ");
+    
+    TwAddButton(difficultyBar,
+                "Test curved paths",
+                (TwButtonCallback) [] (void* clientData) {
+                    DifficultyAnalyzer::TestCurvedPaths();
+                },
+                NULL,
+                "help='Print how long random shots take and how many segments they test along curves and along straight segments.' ");
+    
+    TwAddVarRW(difficultyBar, "Minimal clearance", TW_TYPE_BOOLCPP, &DifficultyAnalyzer::minimalClearance,
+               "help='Bisect for the lowest clear shot height instead of raising it a meter at a time.' ");
+    
+    TwAddButton(difficultyBar,
+                "Test clearance",
+                (TwButtonCallback) [] (void* clientData) {
+                    DifficultyAnalyzer::TestMinimalClearance();
+                },
+                NULL,
+                "help='Print how long random shots take and how many segments they test with and without minimal clearance.' ");
+    
+    TwAddVarRW(difficultyBar, "Cache segments", TW_TYPE_BOOLCPP, &DifficultyAnalyzer::cacheSegments,
+               "help='Remember which shot path segments hit the terrain until the terrain under them changes.' ");
+    
+    TwAddButton(difficultyBar,
+                "Test segment cache",
+                (TwButtonCallback) [] (void* clientData) {
+                    DifficultyAnalyzer::TestSegmentCache();
+                },
+                NULL,
+                "help='Print how long random shots take without the segment cache, and the first and second time with it.' ");
+    
+    TwAddVarCB(difficultyBar, "Segment cache MB", TW_TYPE_INT32,
+               (TwSetVarCallback) [] (const void* value, void* clientData) {
+                   DifficultyAnalyzer::segmentCache.SetCapacity((size_t) *(const int*) value << 20);
+               },
+               (TwGetVarCallback) [] (void* value, void* clientData) {
+                   *(int*) value = (int) (DifficultyAnalyzer::segmentCache.Capacity() >> 20);
+               },
+               NULL,
+               "min=0 max=1024 help='Memory for cached shot path segments, taken when the first segment is cached. Changing it empties the cache.' ");
+    
+    TwAddVarCB(difficultyBar, "Cached segment hits", TW_TYPE_UINT32, NULL,
+               (TwGetVarCallback) [] (void* value, void* clientData) {
+                   *(unsigned int*) value = DifficultyAnalyzer::segmentCache.Hits();
+               },
+               NULL,
+               "help='Shot path segments found in the cache.' ");
+    
+    TwAddVarCB(difficultyBar, "Cached segment misses", TW_TYPE_UINT32, NULL,
+               (TwGetVarCallback) [] (void* value, void* clientData) {
+                   *(unsigned int*) value = DifficultyAnalyzer::segmentCache.Misses();
+               },
+               NULL,
+               "help='Shot path segments tested against the terrain, as the cache did not hold them.' ");
+    
+    TwAddVarRW(difficultyBar, "Parallel candidates", TW_TYPE_INT32, &DifficultyAnalyzer::candidateWindow,
+               "min=1 max=256 help='Shot paths tested at once on all cores, or 1 to test one at a time.' ");
+    
+    TwAddButton(difficultyBar,
+                "Test parallel search",
+                (TwButtonCallback) [] (void* clientData) {
+                    DifficultyAnalyzer::TestCandidateWindow();
+                },
+                NULL,
+                "help='Print how long random shots take with and without parallel candidates, and whether the results differ.' ");
+    
+    TwAddButton(difficultyBar,
+                "Test batch",
+                (TwButtonCallback) [] (void* clientData) {
+                    // random tees to the greens of input.txt
+                    vector<vec3> targets;
+                    for (const GreenInfo &green : ProtracerInputHandler::LoadFromFile("input.txt")) {
+                        int x = glm::clamp((int) round(green.targetPos.x / gTerrain.GridRes()), 0, gTerrain.XInterval() - 1);
+                        int y = glm::clamp((int) round(-green.targetPos.z / gTerrain.GridRes()), 0, gTerrain.YInterval() - 1);
+                        targets.push_back(gTerrain.SamplePosition(x, y));
+                    }
+                    DifficultyAnalyzer::TestDifficultyBatch(targets);
+                },
+                NULL,
+                "help='Print how many shots per second are rated at once from random tees to the greens of input.txt.' ");
 
     TwAddSeparator(difficultyBar, NULL, NULL);
     
@@ -513,22 +737,25 @@ void RangeTweakBar::TerrainFromFile() {
     
     for (GreenInfo &green : greens) {
         
+        // the file is in meters, the control points in samples
+        const float g = gTerrain.GridRes();
         const vec3 pivotPoint = green.targetPos + green.targetCenterOffset;
-        const float &cx = pivotPoint.x, &cy = -pivotPoint.z;
+        const float cx = pivotPoint.x / g, cy = -pivotPoint.z / g;
         const float tanx = tan(DEG2RAD(green.xtilt)), tany = tan(DEG2RAD(green.ytilt));
         
-        float x = green.targetPos.x;
-        float y = -green.targetPos.z;
+        float x = green.targetPos.x / g;
+        float y = -green.targetPos.z / g;
+        float r = green.radius / g;
         
-        int min_x = floor(std::max(green.targetPos.x - green.radius, 0.0f));
-        int max_x = ceil(std::min(green.targetPos.x + green.radius, float(X_INTERVAL)));
-        int min_y = floor(std::max(-green.targetPos.z - green.radius, 0.0f));
-        int max_y = ceil(std::min(-green.targetPos.z + green.radius, float(Y_INTERVAL)));
+        int min_x = floor(std::max(x - r, 0.0f));
+        int max_x = ceil(std::min(x + r, float(gTerrain.XInterval() - 1)));
+        int min_y = floor(std::max(y - r, 0.0f));
+        int max_y = ceil(std::min(y + r, float(gTerrain.YInterval() - 1)));
         
         for (int yy=min_y; yy<=max_y; yy++) {
             for (int xx=min_x; xx<=max_x; xx++) {
-                if (dist(x, y, xx, yy) < green.radius) {
-                    float lift = (xx - cx) * float(GRID_RES) * tanx + (yy - cy) * float(GRID_RES) * tany;
+                if (dist(x, y, xx, yy) < r) {
+                    float lift = (xx - cx) * g * tanx + (yy - cy) * g * tany;
                     gTerrain.SetControlPoint(xx  , yy  , pivotPoint.y + lift, green.slopeSpread, green.slopeFunc);
                 }
             }
@@ -0,0 +1,122 @@
+//
+//  segmentcache.cpp
+//  DGIProject
+//
+
+#include "segmentcache.h"
+#include "rangeterrain.h"
+#include <cstring>
+
+SegmentCache::SegmentCache(const size_t &capacity) : capacity(capacity) {
+    hits    = 0;
+    misses  = 0;
+}
+
+uint32_t SegmentCache::Hash(const vec3 &start, const vec3 &end, const float &radius) {
+
+    // FNV-1a over the bits of the endpoints and radius
+    uint32_t bits[7];
+    memcpy(&bits[0], &start[0], sizeof(vec3));
+    memcpy(&bits[3], &end[0], sizeof(vec3));
+    memcpy(&bits[6], &radius, sizeof(float));
+    uint32_t hash = 2166136261u;
+    for ( int i=0; i<7; i++ )
+        hash = (hash ^ bits[i]) * 16777619u;
+    return hash ^ (hash >> 16);
+}
+
+unsigned int SegmentCache::TerrainVersion(const vec3 &start, const vec3 &end, const float &radius) {
+
+    // quads x along world x and y along world -z, see IntersectBlock()
+    const float res = gTerrain.GridRes();
+    return gTerrain.QuadsVersion((int) floor((std::min(start.x, end.x) - radius) / res), (int) floor((std::min(-start.z, -end.z) - radius) / res),
+                                 (int) floor((std::max(start.x, end.x) + radius) / res), (int) floor((std::max(-start.z, -end.z) + radius) / res));
+}
+
+bool SegmentCache::Find(const vec3 &start, const vec3 &end, const float &radius, bool &intersects) {
+
+    const uint32_t hash = Hash(start, end, radius);
+    {
+        lock_guard<mutex> lock(locks[hash % SEGMENT_CACHE_LOCKS]);
+        if (entries.empty()) {
+            misses++;
+            return false;
+        }
+        const Entry &entry = entries[hash & (entries.size() - 1)];
+        if (entry.used && entry.start == start && entry.end == end && entry.radius == radius &&
+            TerrainVersion(start, end, radius) <= entry.version) {
+            intersects = entry.intersects;
+            hits++;
+            return true;
+        }
+    }
+    misses++;
+    return false;
+}
+
+void SegmentCache::Insert(const vec3 &start, const vec3 &end, const float &radius, const bool &intersects, const unsigned int &version) {
+
+    Allocate();
+
+    const uint32_t hash = Hash(start, end, radius);
+    lock_guard<mutex> lock(locks[hash % SEGMENT_CACHE_LOCKS]);
+    if (entries.empty())
+        return;     // freed by SetCapacity() since, or too small for the slots
+    Entry &entry = entries[hash & (entries.size() - 1)];
+    entry.start         = start;
+    entry.end           = end;
+    entry.radius        = radius;
+    entry.version       = version;
+    entry.intersects    = intersects;
+    entry.used          = true;
+}
+
+void SegmentCache::Clear() {
+
+    LockAll();
+    for ( Entry &entry : entries )
+        entry.used = false;
+    UnlockAll();
+}
+
+void SegmentCache::SetCapacity(const size_t &bytes) {
+
+    LockAll();
+    capacity = bytes;
+    vector<Entry>().swap(entries);
+    UnlockAll();
+}
+
+void SegmentCache::LockAll() {
+    for ( int i=0; i<SEGMENT_CACHE_LOCKS; i++ )
+        locks[i].lock();
+}
+
+void SegmentCache::UnlockAll() {
+    for ( int i=0; i<SEGMENT_CACHE_LOCKS; i++ )
+        locks[i].unlock();
+}
+
+void SegmentCache::Allocate() {
+
+    // at least a slot per lock, so the hashes sharing a slot share its lock
+    const size_t least = SEGMENT_CACHE_LOCKS * sizeof(Entry);
+
+    // checked under one lock first, as every insert but the first finds the slots there
+    {
+        lock_guard<mutex> lock(locks[0]);
+        if (!entries.empty() || capacity < least)
+            return;
+    }
+
+    LockAll();
+    if (entries.empty() && capacity >= least) {
+        size_t slots = SEGMENT_CACHE_LOCKS;
+        while (slots * 2 * sizeof(Entry) <= capacity)
+            slots *= 2;
+        entries.resize(slots);
+        for ( Entry &entry : entries )
+            entry.used = false;
+    }
+    UnlockAll();
+}
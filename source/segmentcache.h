@@ -0,0 +1,76 @@
+//
+//  segmentcache.h
+//  DGIProject
+//
+
+#ifndef DGIProject_segmentcache_h
+#define DGIProject_segmentcache_h
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+#define DEFAULT_SEGMENT_CACHE_BYTES (8 << 20)
+#define SEGMENT_CACHE_LOCKS         64          // Slots are guarded by one of these many mutexes, a power of two
+
+/**
+ Whether segments, or balls of a radius moving along them, hit the terrain, so searches that
+ try the same paths again (the same shot, or the cells of a difficulty map around an edit) don't
+ test them again. A segment is held in the slot its exact endpoints and radius hash to, replacing
+ what was there. A result is stamped with gTerrain.Version() from before it was found, and is
+ dropped once any tile under the xz bounding box of the segment, widened by the radius, has
+ changed since, see RangeTerrain::QuadsVersion(). Holds as many slots as fit in capacity bytes
+ (rounded down to a power of two), allocated on the first Insert(). Safe to use from several threads.
+ */
+class SegmentCache {
+public:
+
+    SegmentCache(const size_t &capacity = DEFAULT_SEGMENT_CACHE_BYTES);
+
+    // Whether the result for start, end, radius is held (counted as a hit, or else a miss), and if
+    // so whether it hits the terrain
+    bool Find(const vec3 &start, const vec3 &end, const float &radius, bool &intersects);
+
+    // The result for start, end, radius, found on terrain version
+    void Insert(const vec3 &start, const vec3 &end, const float &radius, const bool &intersects, const unsigned int &version);
+
+    void Clear();
+    void SetCapacity(const size_t &bytes);     // Frees the slots until the next Insert()
+
+    size_t Capacity() const { return capacity; }
+
+    // Counters since the start
+    inline unsigned int Hits() const    { return hits; }
+    inline unsigned int Misses() const  { return misses; }
+
+private:
+
+    struct Entry {
+        vec3            start, end;
+        float           radius;
+        unsigned int    version;
+        bool            intersects;
+        bool            used;
+    };
+
+    vector<Entry>           entries;                        // Resized only while holding every lock
+    mutex                   locks[SEGMENT_CACHE_LOCKS];     // A hash is guarded by locks[hash % SEGMENT_CACHE_LOCKS]
+    size_t                  capacity;
+    atomic<unsigned int>    hits;
+    atomic<unsigned int>    misses;
+
+    void LockAll();
+    void UnlockAll();
+    void Allocate();        // The slots for capacity, unless there are some
+
+    static uint32_t Hash(const vec3 &start, const vec3 &end, const float &radius);
+    static unsigned int TerrainVersion(const vec3 &start, const vec3 &end, const float &radius);   // Of the quads the ball can touch
+};
+
+#endif
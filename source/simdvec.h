@@ -0,0 +1,239 @@
+//
+//  simdvec.h
+//  DGIProject
+//
+//  The few vector operations the batch kernels need, for the widest instruction set the
+//  compiler targets (AVX2, SSE2, NEON, or one value at a time). A lane gets the same result
+//  whatever vector it is evaluated in.
+//
+
+#ifndef DGIProject_simdvec_h
+#define DGIProject_simdvec_h
+
+#include <math.h>
+#include <stdint.h>
+
+// Each instruction set has its own namespace, so the AVX2 and SSE2 builds of a kernel can be
+// linked into the same program
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_ISA        "AVX2"
+#define SIMD_WIDTH      8
+#define SIMD_NAMESPACE  simd_avx2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#define SIMD_ISA        "SSE2"
+#define SIMD_WIDTH      4
+#define SIMD_NAMESPACE  simd_sse2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SIMD_ISA        "NEON"
+#define SIMD_WIDTH      8
+#define SIMD_NAMESPACE  simd_neon
+#else
+#define SIMD_ISA        "scalar"
+#define SIMD_WIDTH      1
+#define SIMD_NAMESPACE  simd_scalar
+#endif
+
+#define SIMD_MAX_WIDTH  8       // Of any of them, for data laid out once for whichever build runs
+
+namespace SIMD_NAMESPACE {
+
+#if defined(__AVX2__)
+
+struct VecF {
+    __m256 v;
+    VecF() {}
+    VecF(__m256 v) : v(v) {}
+    VecF(float f) : v(_mm256_set1_ps(f)) {}
+    static VecF Ramp()                                  { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+    static VecF Load(const float* in)                   { return _mm256_loadu_ps(in); }
+    static VecF Sqrt(const VecF &a)                     { return _mm256_sqrt_ps(a.v); }
+    static VecF LessEqual(const VecF &a, const VecF &b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+    static VecF Less(const VecF &a, const VecF &b)      { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    static VecF Min(const VecF &a, const VecF &b)       { return _mm256_min_ps(a.v, b.v); }
+    static VecF Select(const VecF &mask, const VecF &a) { return _mm256_and_ps(mask.v, a.v); } // a where mask, else 0
+    static VecF Blend(const VecF &mask, const VecF &a, const VecF &b) { return _mm256_blendv_ps(b.v, a.v, mask.v); } // a where mask, else b
+    static bool None(const VecF &mask)                  { return _mm256_movemask_ps(mask.v) == 0; }
+    void Store(float* out) const                        { _mm256_storeu_ps(out, v); }
+};
+inline VecF operator+(const VecF &a, const VecF &b) { return _mm256_add_ps(a.v, b.v); }
+inline VecF operator-(const VecF &a, const VecF &b) { return _mm256_sub_ps(a.v, b.v); }
+inline VecF operator*(const VecF &a, const VecF &b) { return _mm256_mul_ps(a.v, b.v); }
+inline VecF operator/(const VecF &a, const VecF &b) { return _mm256_div_ps(a.v, b.v); }
+inline VecF operator&(const VecF &a, const VecF &b) { return _mm256_and_ps(a.v, b.v); }   // of masks
+
+struct VecI {
+    __m256i v;
+    VecI() {}
+    VecI(__m256i v) : v(v) {}
+    VecI(int32_t i) : v(_mm256_set1_epi32(i)) {}
+    static VecI Load(const int32_t* in)                 { return _mm256_loadu_si256((const __m256i*) in); }
+    static VecF ToFloat(const VecI &a)                  { return _mm256_cvtepi32_ps(a.v); }
+};
+inline VecI operator+(const VecI &a, const VecI &b) { return _mm256_add_epi32(a.v, b.v); }
+inline VecI operator*(const VecI &a, const VecI &b) { return _mm256_mullo_epi32(a.v, b.v); }
+inline VecI operator^(const VecI &a, const VecI &b) { return _mm256_xor_si256(a.v, b.v); }
+inline VecI operator&(const VecI &a, const VecI &b) { return _mm256_and_si256(a.v, b.v); }
+inline VecI operator<<(const VecI &a, const int &n) { return _mm256_slli_epi32(a.v, n); }
+
+#elif defined(__SSE2__)
+
+struct VecF {
+    __m128 v;
+    VecF() {}
+    VecF(__m128 v) : v(v) {}
+    VecF(float f) : v(_mm_set1_ps(f)) {}
+    static VecF Ramp()                                  { return _mm_setr_ps(0, 1, 2, 3); }
+    static VecF Load(const float* in)                   { return _mm_loadu_ps(in); }
+    static VecF Sqrt(const VecF &a)                     { return _mm_sqrt_ps(a.v); }
+    static VecF LessEqual(const VecF &a, const VecF &b) { return _mm_cmple_ps(a.v, b.v); }
+    static VecF Less(const VecF &a, const VecF &b)      { return _mm_cmplt_ps(a.v, b.v); }
+    static VecF Min(const VecF &a, const VecF &b)       { return _mm_min_ps(a.v, b.v); }
+    static VecF Select(const VecF &mask, const VecF &a) { return _mm_and_ps(mask.v, a.v); }
+    static VecF Blend(const VecF &mask, const VecF &a, const VecF &b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+    static bool None(const VecF &mask)                  { return _mm_movemask_ps(mask.v) == 0; }
+    void Store(float* out) const                        { _mm_storeu_ps(out, v); }
+};
+inline VecF operator+(const VecF &a, const VecF &b) { return _mm_add_ps(a.v, b.v); }
+inline VecF operator-(const VecF &a, const VecF &b) { return _mm_sub_ps(a.v, b.v); }
+inline VecF operator*(const VecF &a, const VecF &b) { return _mm_mul_ps(a.v, b.v); }
+inline VecF operator/(const VecF &a, const VecF &b) { return _mm_div_ps(a.v, b.v); }
+inline VecF operator&(const VecF &a, const VecF &b) { return _mm_and_ps(a.v, b.v); }
+
+struct VecI {
+    __m128i v;
+    VecI() {}
+    VecI(__m128i v) : v(v) {}
+    VecI(int32_t i) : v(_mm_set1_epi32(i)) {}
+    static VecI Load(const int32_t* in)                 { return _mm_loadu_si128((const __m128i*) in); }
+    static VecF ToFloat(const VecI &a)                  { return _mm_cvtepi32_ps(a.v); }
+};
+inline VecI operator+(const VecI &a, const VecI &b) { return _mm_add_epi32(a.v, b.v); }
+inline VecI operator^(const VecI &a, const VecI &b) { return _mm_xor_si128(a.v, b.v); }
+inline VecI operator&(const VecI &a, const VecI &b) { return _mm_and_si128(a.v, b.v); }
+inline VecI operator<<(const VecI &a, const int &n) { return _mm_slli_epi32(a.v, n); }
+inline VecI operator*(const VecI &a, const VecI &b) {
+#if defined(__SSE4_1__)
+    return _mm_mullo_epi32(a.v, b.v);
+#else
+    // low 32 bits of the products of lanes 0, 2 and of lanes 1, 3, interleaved back
+    __m128i even = _mm_mul_epu32(a.v, b.v);
+    __m128i odd = _mm_mul_epu32(_mm_srli_si128(a.v, 4), _mm_srli_si128(b.v, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+#endif
+}
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+// two registers of four lanes, so a vector holds as many values as with AVX2
+struct VecF {
+    float32x4_t lo, hi;
+    VecF() {}
+    VecF(float32x4_t lo, float32x4_t hi) : lo(lo), hi(hi) {}
+    VecF(float f) : lo(vdupq_n_f32(f)), hi(vdupq_n_f32(f)) {}
+    static VecF Ramp()                                  { const float r[8] = { 0, 1, 2, 3, 4, 5, 6, 7 }; return Load(r); }
+    static VecF Load(const float* in)                   { return VecF(vld1q_f32(in), vld1q_f32(in + 4)); }
+    static VecF Sqrt(const VecF &a)                     { return VecF(vsqrtq_f32(a.lo), vsqrtq_f32(a.hi)); }
+    static VecF LessEqual(const VecF &a, const VecF &b) { return Mask(vcleq_f32(a.lo, b.lo), vcleq_f32(a.hi, b.hi)); }
+    static VecF Less(const VecF &a, const VecF &b)      { return Mask(vcltq_f32(a.lo, b.lo), vcltq_f32(a.hi, b.hi)); }
+    static VecF Min(const VecF &a, const VecF &b)       { return VecF(vminq_f32(a.lo, b.lo), vminq_f32(a.hi, b.hi)); }
+    static VecF Select(const VecF &mask, const VecF &a) { return Mask(vandq_u32(Bits(mask.lo), Bits(a.lo)), vandq_u32(Bits(mask.hi), Bits(a.hi))); }
+    static VecF Blend(const VecF &mask, const VecF &a, const VecF &b) { return VecF(vbslq_f32(Bits(mask.lo), a.lo, b.lo), vbslq_f32(Bits(mask.hi), a.hi, b.hi)); }
+    static bool None(const VecF &mask)                  { return vmaxvq_u32(vorrq_u32(Bits(mask.lo), Bits(mask.hi))) == 0; }
+    void Store(float* out) const                        { vst1q_f32(out, lo); vst1q_f32(out + 4, hi); }
+    static uint32x4_t Bits(const float32x4_t &a)        { return vreinterpretq_u32_f32(a); }
+    static VecF Mask(const uint32x4_t &lo, const uint32x4_t &hi) { return VecF(vreinterpretq_f32_u32(lo), vreinterpretq_f32_u32(hi)); }
+};
+inline VecF operator+(const VecF &a, const VecF &b) { return VecF(vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi)); }
+inline VecF operator-(const VecF &a, const VecF &b) { return VecF(vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi)); }
+inline VecF operator*(const VecF &a, const VecF &b) { return VecF(vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi)); }
+inline VecF operator/(const VecF &a, const VecF &b) { return VecF(vdivq_f32(a.lo, b.lo), vdivq_f32(a.hi, b.hi)); }
+inline VecF operator&(const VecF &a, const VecF &b) { return VecF::Mask(vandq_u32(VecF::Bits(a.lo), VecF::Bits(b.lo)), vandq_u32(VecF::Bits(a.hi), VecF::Bits(b.hi))); }
+
+struct VecI {
+    int32x4_t lo, hi;
+    VecI() {}
+    VecI(int32x4_t lo, int32x4_t hi) : lo(lo), hi(hi) {}
+    VecI(int32_t i) : lo(vdupq_n_s32(i)), hi(vdupq_n_s32(i)) {}
+    static VecI Load(const int32_t* in)                 { return VecI(vld1q_s32(in), vld1q_s32(in + 4)); }
+    static VecF ToFloat(const VecI &a)                  { return VecF(vcvtq_f32_s32(a.lo), vcvtq_f32_s32(a.hi)); }
+};
+inline VecI operator+(const VecI &a, const VecI &b) { return VecI(vaddq_s32(a.lo, b.lo), vaddq_s32(a.hi, b.hi)); }
+inline VecI operator*(const VecI &a, const VecI &b) { return VecI(vmulq_s32(a.lo, b.lo), vmulq_s32(a.hi, b.hi)); }
+inline VecI operator^(const VecI &a, const VecI &b) { return VecI(veorq_s32(a.lo, b.lo), veorq_s32(a.hi, b.hi)); }
+inline VecI operator&(const VecI &a, const VecI &b) { return VecI(vandq_s32(a.lo, b.lo), vandq_s32(a.hi, b.hi)); }
+inline VecI operator<<(const VecI &a, const int &n) { return VecI(vshlq_s32(a.lo, vdupq_n_s32(n)), vshlq_s32(a.hi, vdupq_n_s32(n))); }
+
+#else
+
+struct VecF {
+    float v;
+    VecF() {}
+    VecF(float f) : v(f) {}
+    static VecF Ramp()                                  { return 0.0f; }
+    static VecF Load(const float* in)                   { return *in; }
+    static VecF Sqrt(const VecF &a)                     { return sqrtf(a.v); }
+    static VecF LessEqual(const VecF &a, const VecF &b) { return a.v <= b.v ? 1.0f : 0.0f; }
+    static VecF Less(const VecF &a, const VecF &b)      { return a.v < b.v ? 1.0f : 0.0f; }
+    static VecF Min(const VecF &a, const VecF &b)       { return a.v < b.v ? a.v : b.v; }
+    static VecF Select(const VecF &mask, const VecF &a) { return mask.v != 0 ? a.v : 0.0f; }
+    static VecF Blend(const VecF &mask, const VecF &a, const VecF &b) { return mask.v != 0 ? a.v : b.v; }
+    static bool None(const VecF &mask)                  { return mask.v == 0; }
+    void Store(float* out) const                        { *out = v; }
+};
+inline VecF operator+(const VecF &a, const VecF &b) { return a.v + b.v; }
+inline VecF operator-(const VecF &a, const VecF &b) { return a.v - b.v; }
+inline VecF operator*(const VecF &a, const VecF &b) { return a.v * b.v; }
+inline VecF operator/(const VecF &a, const VecF &b) { return a.v / b.v; }
+inline VecF operator&(const VecF &a, const VecF &b) { return a.v != 0 && b.v != 0 ? 1.0f : 0.0f; }
+
+// wraps around on overflow, like the vector versions
+struct VecI {
+    int32_t v;
+    VecI() {}
+    VecI(int32_t i) : v(i) {}
+    static VecI Load(const int32_t* in)                 { return *in; }
+    static VecF ToFloat(const VecI &a)                  { return (float) a.v; }
+};
+inline VecI operator+(const VecI &a, const VecI &b) { return (int32_t) ((uint32_t) a.v + (uint32_t) b.v); }
+inline VecI operator*(const VecI &a, const VecI &b) { return (int32_t) ((uint32_t) a.v * (uint32_t) b.v); }
+inline VecI operator^(const VecI &a, const VecI &b) { return a.v ^ b.v; }
+inline VecI operator&(const VecI &a, const VecI &b) { return a.v & b.v; }
+inline VecI operator<<(const VecI &a, const int &n) { return (int32_t) ((uint32_t) a.v << n); }
+
+#endif
+
+}
+
+#if !defined(SIMD_KERNELS_ONLY)
+
+// On x86-64 the project is built for SSE2, and the kernels once more for AVX2 (the *_avx2.cpp
+// files), which their entry points run instead when the processor has it. The kernels call
+// nothing inline from other headers (std::min, vector), as the linker could pick the AVX2
+// build of it for the rest of the program.
+#if defined(__x86_64__) && !defined(__AVX2__)
+#define SIMD_AVX2_DISPATCH
+
+inline bool SimdAVX2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+// The instruction set the kernels run with on this processor
+inline const char* SimdISA() {
+#if defined(SIMD_AVX2_DISPATCH)
+    return SimdAVX2() ? "AVX2" : SIMD_ISA;
+#else
+    return SIMD_ISA;
+#endif
+}
+
+#endif
+
+#endif
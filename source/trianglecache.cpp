@@ -0,0 +1,217 @@
+//
+//  trianglecache.cpp
+//  DGIProject
+//
+//  The kernels at the end are built once more for AVX2 by trianglecache_avx2.cpp.
+//
+
+#include "trianglecache.h"
+#include "rangeterrain.h"
+#include "simdvec.h"
+#include <limits>
+
+#if !defined(SIMD_KERNELS_ONLY)
+
+TriangleCache::TriangleCache() {
+    quadsX = 0;
+    quadsY = 0;
+    built = false;
+}
+
+void TriangleCache::Resize(const int &quadsX, const int &quadsY) {
+    this->quadsX = quadsX;
+    this->quadsY = quadsY;
+    Clear();
+}
+
+void TriangleCache::Clear() {
+    
+    for ( vector<float>* a : { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z } )
+        vector<float>().swap(*a);
+    changedQuads.clear();
+    built = false;
+}
+
+void TriangleCache::Build(const RangeTerrain &terrain) {
+    
+    const int padded = (Triangles() + SIMD_MAX_WIDTH - 1) / SIMD_MAX_WIDTH * SIMD_MAX_WIDTH;
+    for ( vector<float>* a : { &v0x, &v0y, &v0z, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z } )
+        a->assign(padded, 0.0f);
+    
+    for ( int y=0; y<quadsY; y++ )
+        for ( int x=0; x<quadsX; x++ )
+            SetQuad(terrain, x, y);
+    
+    changedQuads.clear();
+    built = true;
+}
+
+void TriangleCache::SetQuadChanged(const int &x, const int &y) {
+    if (built)
+        changedQuads.push_back(y * quadsX + x);
+}
+
+void TriangleCache::Refresh(const RangeTerrain &terrain) {
+    
+    // a quad may be listed more than once, but setting it again is harmless
+    for ( int i : changedQuads )
+        SetQuad(terrain, i % quadsX, i / quadsX);
+    changedQuads.clear();
+}
+
+void TriangleCache::SetQuad(const RangeTerrain &terrain, const int &x, const int &y) {
+    
+    const vec3 v1 = terrain.SamplePosition(x  , y  );
+    const vec3 v2 = terrain.SamplePosition(x  , y+1);
+    const vec3 v3 = terrain.SamplePosition(x+1, y  );
+    const vec3 v4 = terrain.SamplePosition(x+1, y+1);
+    
+    // same triangles as the index data, see TerrainTile
+    const int i = 2 * (y * quadsX + x);
+    if (terrain.DiagonalUp(x, y)) {
+        SetTriangle(i  , v1, v2, v3);
+        SetTriangle(i+1, v4, v3, v2);
+    } else {
+        SetTriangle(i  , v1, v4, v2);
+        SetTriangle(i+1, v4, v3, v1);
+    }
+}
+
+void TriangleCache::SetTriangle(const int &i, const vec3 &v0, const vec3 &v1, const vec3 &v2) {
+    
+    const vec3 e1 = v1 - v0, e2 = v2 - v0;
+    v0x[i] = v0.x;  v0y[i] = v0.y;  v0z[i] = v0.z;
+    e1x[i] = e1.x;  e1y[i] = e1.y;  e1z[i] = e1.z;
+    e2x[i] = e2.x;  e2y[i] = e2.y;  e2z[i] = e2.z;
+}
+
+#endif
+
+namespace SIMD_NAMESPACE {
+
+/*
+ Möller–Trumbore for a ray against the SIMD_WIDTH triangles from i on, the same arithmetic as
+ the scalar test in difficultyanalyzer.cpp. Returns t where a triangle is hit within (tMin,
+ tMax), and tMax elsewhere. Degenerate (padding) triangles have det 0, and never hit.
+ */
+struct RayVec {
+    VecF sx, sy, sz, dx, dy, dz, tMin, tMax;
+    RayVec() {}
+    RayVec(const vec3 &start, const vec3 &dir, const float &tMin, const float &tMax)
+        : sx(start.x), sy(start.y), sz(start.z), dx(dir.x), dy(dir.y), dz(dir.z), tMin(tMin), tMax(tMax) {}
+};
+
+static inline VecF IntersectVec(const RayVec &r, const float* const* a, const int &i) {
+    
+    const VecF ax = VecF::Load(a[3] + i), ay = VecF::Load(a[4] + i), az = VecF::Load(a[5] + i);
+    const VecF bx = VecF::Load(a[6] + i), by = VecF::Load(a[7] + i), bz = VecF::Load(a[8] + i);
+    
+    // p = dir x e2, det = e1 . p
+    const VecF px = r.dy * bz - r.dz * by;
+    const VecF py = r.dz * bx - r.dx * bz;
+    const VecF pz = r.dx * by - r.dy * bx;
+    const VecF invDet = VecF(1.0f) / (ax * px + ay * py + az * pz);
+    
+    // b = start - v0, u = b . p / det
+    const VecF sx = r.sx - VecF::Load(a[0] + i), sy = r.sy - VecF::Load(a[1] + i), sz = r.sz - VecF::Load(a[2] + i);
+    const VecF u = (sx * px + sy * py + sz * pz) * invDet;
+    
+    // q = b x e1, v = dir . q / det, t = e2 . q / det
+    const VecF qx = sy * az - sz * ay;
+    const VecF qy = sz * ax - sx * az;
+    const VecF qz = sx * ay - sy * ax;
+    const VecF v = (r.dx * qx + r.dy * qy + r.dz * qz) * invDet;
+    const VecF t = (bx * qx + by * qy + bz * qz) * invDet;
+    
+    const VecF zero(0.0f), one(1.0f);
+    const VecF hit = VecF::LessEqual(zero, u) & VecF::LessEqual(u, one) & VecF::LessEqual(zero, v) &
+                     VecF::LessEqual(u + v, one) & VecF::Less(r.tMin, t) & VecF::Less(t, r.tMax);
+    return VecF::Blend(hit, t, r.tMax);
+}
+
+static inline float HorizontalMin(const VecF &a) {
+    float lanes[SIMD_WIDTH];
+    a.Store(lanes);
+    float m = lanes[0];
+    for ( int i=1; i<SIMD_WIDTH; i++ )
+        m = lanes[i] < m ? lanes[i] : m;
+    return m;
+}
+
+// TriangleCache::Intersect() over the n triangles of the arrays a (v0x, v0y, v0z, e1x ... e2z)
+bool Intersect(const float* const* a, const int &n, const vec3 &start, const vec3 &dir, const float &tMin, const float &tMax, float &t, const bool &any) {
+    
+    const RayVec ray(start, dir, tMin, tMax);
+    VecF closest(tMax);
+    for ( int i=0; i<n; i+=SIMD_WIDTH ) {
+        const VecF ti = IntersectVec(ray, a, i);
+        closest = VecF::Min(closest, ti);
+        if (any && !VecF::None(VecF::Less(ti, ray.tMax)))
+            break;
+    }
+    
+    t = HorizontalMin(closest);
+    return t < tMax;
+}
+
+void IntersectBatch(const float* const* a, const int &n, const vec3* starts, const vec3* dirs, const int &count, const float &tMin, const float &tMax, float* t) {
+    
+    // a group of rays goes through the triangles together, so each vector of triangles is
+    // loaded once per group rather than once per ray
+    const int GROUP = 16;
+    for ( int first=0; first<count; first+=GROUP ) {
+        const int m = count - first < GROUP ? count - first : GROUP;
+        
+        // on the stack, as vectors need their alignment
+        RayVec rays[GROUP];
+        VecF closest[GROUP];
+        for ( int r=0; r<m; r++ ) {
+            rays[r] = RayVec(starts[first + r], dirs[first + r], tMin, tMax);
+            closest[r] = VecF(tMax);
+        }
+        
+        for ( int i=0; i<n; i+=SIMD_WIDTH )
+            for ( int r=0; r<m; r++ )
+                closest[r] = VecF::Min(closest[r], IntersectVec(rays[r], a, i));
+        
+        for ( int r=0; r<m; r++ ) {
+            const float m = HorizontalMin(closest[r]);
+            t[first + r] = m < tMax ? m : -1;
+        }
+    }
+}
+
+}
+
+#if !defined(SIMD_KERNELS_ONLY)
+
+#if defined(SIMD_AVX2_DISPATCH)
+namespace simd_avx2 {
+    bool Intersect(const float* const* a, const int &n, const vec3 &start, const vec3 &dir, const float &tMin, const float &tMax, float &t, const bool &any);
+    void IntersectBatch(const float* const* a, const int &n, const vec3* starts, const vec3* dirs, const int &count, const float &tMin, const float &tMax, float* t);
+}
+#endif
+
+bool TriangleCache::Intersect(const vec3 &start, const vec3 &dir, const float &tMin, const float &tMax, float &t, const bool &any) const {
+    
+    const float* a[] = { v0x.data(), v0y.data(), v0z.data(), e1x.data(), e1y.data(), e1z.data(), e2x.data(), e2y.data(), e2z.data() };
+#if defined(SIMD_AVX2_DISPATCH)
+    if (SimdAVX2())
+        return simd_avx2::Intersect(a, (int) v0x.size(), start, dir, tMin, tMax, t, any);
+#endif
+    return SIMD_NAMESPACE::Intersect(a, (int) v0x.size(), start, dir, tMin, tMax, t, any);
+}
+
+void TriangleCache::IntersectBatch(const vec3* starts, const vec3* dirs, const int &count, const float &tMin, const float &tMax, float* t) const {
+    
+    const float* a[] = { v0x.data(), v0y.data(), v0z.data(), e1x.data(), e1y.data(), e1z.data(), e2x.data(), e2y.data(), e2z.data() };
+#if defined(SIMD_AVX2_DISPATCH)
+    if (SimdAVX2()) {
+        simd_avx2::IntersectBatch(a, (int) v0x.size(), starts, dirs, count, tMin, tMax, t);
+        return;
+    }
+#endif
+    SIMD_NAMESPACE::IntersectBatch(a, (int) v0x.size(), starts, dirs, count, tMin, tMax, t);
+}
+
+#endif
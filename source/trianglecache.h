@@ -0,0 +1,63 @@
+//
+//  trianglecache.h
+//  DGIProject
+//
+
+#ifndef DGIProject_trianglecache_h
+#define DGIProject_trianglecache_h
+
+#include <vector>
+#include <glm/glm.hpp>
+
+using namespace std;
+using namespace glm;
+
+class RangeTerrain;
+
+/**
+ Every terrain triangle as a vertex and two edges, in separate arrays per coordinate, so a
+ vector of triangles is tested against a ray at a time: 8 with AVX2 or NEON, 4 with SSE2,
+ whichever the processor runs (see simdvec.h). Quad (x, y) holds
+ triangles 2 * (y * quadsX + x) and the one after, in index data order. Built on first use,
+ then kept up to date through SetQuadChanged() until the next Clear().
+ */
+class TriangleCache {
+public:
+    
+    TriangleCache();
+    
+    void Resize(const int &quadsX, const int &quadsY);     // Clears
+    void Clear();                                           // Frees the triangles until the next Build()
+    void Build(const RangeTerrain &terrain);
+    inline bool Built() const { return built; }
+    
+    void SetQuadChanged(const int &x, const int &y);       // Ignored unless built
+    void Refresh(const RangeTerrain &terrain);             // Rebuilds the triangles of the changed quads
+    
+    // The smallest t in (tMin, tMax) where start + t * dir hits a triangle, false if there is none.
+    // With any set, stops at the first hit found, which need not be the closest.
+    bool Intersect(const vec3 &start, const vec3 &dir, const float &tMin, const float &tMax, float &t, const bool &any = false) const;
+    
+    // Intersect() for count rays, t[i] = -1 for those hitting nothing in (tMin, tMax)
+    void IntersectBatch(const vec3* starts, const vec3* dirs, const int &count, const float &tMin, const float &tMax, float* t) const;
+    
+    int Triangles() const { return quadsX * quadsY * 2; }
+    
+    bool operator==(const TriangleCache &other) const {
+        return built == other.built && v0x == other.v0x && v0y == other.v0y && v0z == other.v0z &&
+               e1x == other.e1x && e1y == other.e1y && e1z == other.e1z &&
+               e2x == other.e2x && e2y == other.e2y && e2z == other.e2z;
+    }
+    
+private:
+    
+    int                 quadsX, quadsY;
+    bool                built;
+    vector<float>       v0x, v0y, v0z, e1x, e1y, e1z, e2x, e2y, e2z;   // Padded to whole vectors of any width with degenerate triangles
+    vector<int>         changedQuads;
+    
+    void SetQuad(const RangeTerrain &terrain, const int &x, const int &y);
+    void SetTriangle(const int &i, const vec3 &v0, const vec3 &v1, const vec3 &v2);
+};
+
+#endif
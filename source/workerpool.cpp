@@ -0,0 +1,102 @@
+//
+//  workerpool.cpp
+//  DGIProject
+//
+
+#include "workerpool.h"
+
+WorkerPool gWorkerPool;
+
+// set while the thread runs the body of a job, so nested calls don't wait for themselves
+static thread_local bool insideJob = false;
+
+WorkerPool::WorkerPool() {
+    job         = NULL;
+    jobCount    = 0;
+    nextIndex   = 0;
+    busyWorkers = 0;
+    generation  = 0;
+    quit        = false;
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        lock_guard<mutex> lock(stateMutex);
+        quit = true;
+    }
+    jobStarted.notify_all();
+
+    for ( thread &t : threads )
+        t.join();
+}
+
+int WorkerPool::Size() const {
+    return std::max(1, (int) thread::hardware_concurrency());
+}
+
+void WorkerPool::Start() {
+    // the calling thread is one of the workers
+    for ( int i=1; i<Size(); i++ )
+        threads.push_back(thread(&WorkerPool::WorkerLoop, this));
+}
+
+void WorkerPool::ParallelFor(const int &count, const function<void (int)> &body) {
+
+    unique_lock<mutex> jobLock(jobMutex, defer_lock);
+    if (insideJob || count <= 1 || Size() == 1 || !jobLock.try_lock()) {
+        for ( int i=0; i<count; i++ )
+            body(i);
+        return;
+    }
+
+    if (threads.empty())
+        Start();
+
+    {
+        lock_guard<mutex> lock(stateMutex);
+        job = &body;
+        jobCount = count;
+        nextIndex = 0;
+        busyWorkers = (int) threads.size();
+        generation++;
+    }
+    jobStarted.notify_all();
+
+    RunJob();
+
+    // the job (and body) must outlive every worker still on it
+    unique_lock<mutex> lock(stateMutex);
+    jobFinished.wait(lock, [this] { return busyWorkers == 0; });
+    job = NULL;
+}
+
+void WorkerPool::WorkerLoop() {
+
+    int seenGeneration = 0;
+    while (true) {
+        {
+            unique_lock<mutex> lock(stateMutex);
+            jobStarted.wait(lock, [&] { return quit || generation != seenGeneration; });
+            if (quit)
+                return;
+            seenGeneration = generation;
+        }
+
+        RunJob();
+
+        {
+            lock_guard<mutex> lock(stateMutex);
+            busyWorkers--;
+        }
+        jobFinished.notify_one();
+    }
+}
+
+void WorkerPool::RunJob() {
+
+    // indices are handed out one at a time, so uneven work evens out
+    insideJob = true;
+    for ( int i=nextIndex++; i<jobCount; i=nextIndex++ )
+        (*job)(i);
+    insideJob = false;
+}
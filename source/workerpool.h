@@ -0,0 +1,56 @@
+//
+//  workerpool.h
+//  DGIProject
+//
+
+#ifndef DGIProject_workerpool_h
+#define DGIProject_workerpool_h
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+using namespace std;
+
+/**
+ A fixed set of worker threads, started on first use, running one ParallelFor() at a time.
+ The calling thread takes part in the work. ParallelFor() called from inside a ParallelFor()
+ (or from another thread while one is running) runs on the calling thread alone.
+ */
+class WorkerPool {
+public:
+
+    WorkerPool();
+    ~WorkerPool();
+
+    // Calls body(i) for i = 0..count-1, spread over the workers, and returns when all are done
+    void ParallelFor(const int &count, const function<void (int)> &body);
+
+    // Threads taking part in a ParallelFor(), including the calling one
+    int Size() const;
+
+private:
+
+    vector<thread>              threads;
+    mutex                       jobMutex;       // Held by the thread running a ParallelFor()
+    mutex                       stateMutex;     // Guards the fields below
+    condition_variable          jobStarted;
+    condition_variable          jobFinished;
+    const function<void (int)>* job;
+    int                         jobCount;
+    atomic<int>                 nextIndex;
+    int                         busyWorkers;
+    int                         generation;     // Bumped for every job, so each worker runs it once
+    bool                        quit;
+
+    void Start();
+    void WorkerLoop();
+    void RunJob();
+};
+
+extern WorkerPool gWorkerPool;
+
+#endif